@@ -19,7 +19,7 @@ out vec3 vertex_normal;
 out vec2 vertex_uv;
 out mat3 TBN;
 
-uniform mat4 vp;
+#include "frame_constants.glsl"
 uniform float time;
 
 out flat uint material_idx_out;
@@ -64,6 +64,7 @@ in mat3 TBN;
 
 struct Material {
 	vec3 diffuse_color;
+	float alpha;
 	vec2 metallic_roughness;
 	uint64_t diffuse_texture;
 	uint64_t normal_texture;
@@ -78,7 +79,7 @@ struct Light {
 };
 
 
-uniform vec3 camera_pos;
+#include "frame_constants.glsl"
 
 #range(0, .9, 0.001)
 uniform float ambient = 0.2;
@@ -149,9 +150,12 @@ void main() {
 	}
 
 	vec3 albedo = materials[material_idx_out].diffuse_color;
+	float alpha = mat.alpha;
 
 	if (mat.diffuse_texture != 0) {
-		albedo *= texture(sampler2D(mat.diffuse_texture), vertex_uv).rgb;
+		vec4 diffuse = texture(sampler2D(mat.diffuse_texture), vertex_uv);
+		albedo *= diffuse.rgb;
+		alpha *= diffuse.a;
 	} 
 
 	vec3 N = normalize(vertex_normal);
@@ -191,7 +195,7 @@ void main() {
 	vec3 F0 = vec3(0.04); // approximation of F0 for dielectrics
 	F0 = mix(F0, albedo, metallic);
 
-	vec3 V = normalize(camera_pos - vertex_position_worldspace);
+	vec3 V = normalize(camera_pos.xyz - vertex_position_worldspace);
 
 	vec3 lo = vec3(0);
 
@@ -237,6 +241,7 @@ void main() {
 	color = color / (color + vec3(1.0));
 	color = pow(color, vec3(1.0/2.2));
 
-	fragColour = vec4(color, 1);
+	// Only blended materials are drawn with blending on, everything else ignores alpha
+	fragColour = vec4(color, alpha);
 }
 
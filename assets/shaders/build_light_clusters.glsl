@@ -0,0 +1,48 @@
+#type compute
+
+// Builds every cluster's light list, an invocation per cluster, testing each light in order against its box.
+// The lights are moved into view space a workgroup's worth at a time, into shared memory, so each is only
+// transformed once per group rather than once per cluster. No atomics, so the lists come out the same as
+// LightClusterBinner's on the CPU.
+
+layout (local_size_x = 64, local_size_y = 1, local_size_z = 1) in;
+
+#include "frame_constants.glsl"
+#include "light_clusters.glsl"
+
+shared vec4 group_spheres[gl_WorkGroupSize.x];
+
+void main() {
+	uint cluster = gl_GlobalInvocationID.x;
+	uint local_id = gl_LocalInvocationIndex;
+
+	uint cluster_count = cluster_dims.x * cluster_dims.y * cluster_dims.z;
+	uint max_lights = cluster_dims.w;
+	uint list = cluster * (max_lights + 1);
+
+	// No early returns, every invocation has to reach the barriers
+	bool active = cluster < cluster_count;
+	ClusterBox box;
+	if (active) box = cluster_boxes[cluster];
+
+	uint count = 0;
+
+	for (uint first = 0; first < light_count; first += gl_WorkGroupSize.x) {
+		if (first + local_id < light_count) group_spheres[local_id] = light_view_sphere(view, light_spheres[first + local_id]);
+
+		barrier();
+
+		uint batch = min(gl_WorkGroupSize.x, light_count - first);
+
+		for (uint i = 0; active && i < batch; i++) {
+			if (!sphere_in_cluster(group_spheres[i], box)) continue;
+
+			if (count < max_lights) cluster_lights[list + 1 + count] = first + i;
+			count++;
+		}
+
+		barrier();
+	}
+
+	if (active) cluster_lights[list] = min(count, max_lights);
+}
@@ -1,36 +1,137 @@
 #type compute
 
-layout (local_size_x = 32, local_size_y = 1, local_size_z = 1) in;
+// One workgroup. First prefix sums entity_count's per group visible counts into where each group's visible
+// entities go. Entities are sorted by mesh, so that's also every mesh's instances, back to back: a mesh's
+// instances are the visible entities in its range, which is two lookups, with no per mesh counting.
+// Then prefix sums the meshes with any instances into where their draw commands go, so the commands come
+// out packed with the empty ones left out. Both are scanned a workgroup's worth at a time, carrying the
+// totals over, so there's no limit on how many entities or meshes there are.
+// Also tells generate_per_instance_data where this pass's instances start.
+
+layout (local_size_x = 1024, local_size_y = 1, local_size_z = 1) in;
 
 
 #include "gpu_driven_renderer_includes.glsl"
 
 layout(location=0) uniform uint num_models;
+layout(location=1) uniform uint pass_index;			// 0 for the first pass of the frame. The late pass's commands, instances and draw count go after the early pass's.
+layout(location=2) uniform uint compact;			// Leave out empty commands. Without glMultiDrawElementsIndirectCount every mesh needs one.
+layout(location=3) uniform uint num_entity_groups;
+layout(location=4) uniform uint entity_group_size;	// entity_count's gl_WorkGroupSize.x
+
+shared uint partial[gl_WorkGroupSize.x];
+
+
+// Inclusive scan of value across the workgroup (Hillis-Steele)
+uint workgroup_scan(uint value) {
+    uint local_id = gl_LocalInvocationIndex;
+
+    partial[local_id] = value;
+    barrier();
+
+    for (uint stride = 1; stride < gl_WorkGroupSize.x; stride *= 2) {
+        uint other = local_id >= stride ? partial[local_id - stride] : 0;
+        barrier();
+        partial[local_id] += other;
+        barrier();
+    }
+
+    return partial[local_id];
+}
+
+
+// How many visible entities come before entity, once group_visible has been scanned.
+// Each group's visible entities are in entity order, so the ones before it in its group are found with a binary search.
+uint visible_before(uint entity) {
+    uint group = entity / entity_group_size;
+    uint group_first = group_visible[group];
+
+    if (group >= num_entity_groups) return group_first;
+
+    uint block = group * entity_group_size;
+    uint low = 0;
+    uint high = group_visible[group + 1] - group_first;
+
+    while (low < high) {
+        uint mid = (low + high) / 2;
+        if (visible_entities[block + mid] < entity) low = mid + 1;
+        else high = mid;
+    }
+
+    return group_first + low;
+}
+
+
+void main() {
+    uint local_id = gl_LocalInvocationIndex;
+
+    // Where each group's visible entities start
+    uint carry = 0;
+
+    for (uint chunk = 0; chunk < num_entity_groups; chunk += gl_WorkGroupSize.x) {
+        uint idx = chunk + local_id;
+        uint count = idx < num_entity_groups ? group_visible[idx] : 0;
+
+        uint end = workgroup_scan(count);
+
+        if (idx < num_entity_groups) group_visible[idx] = carry + end - count;
+
+        carry += partial[gl_WorkGroupSize.x - 1];
 
+        // Before partial is overwritten by the next chunk
+        barrier();
+    }
+
+    if (local_id == 0) group_visible[num_entity_groups] = carry;
+
+    // Every group's start has to be visible to every invocation before the meshes are looked up
+    memoryBarrierBuffer();
+    barrier();
+
+    uint total_visible = carry;
+    uint command_offset = pass_index * num_models;
+    uint instance_base_in = pass_index != 0 ? instance_base : 0;
 
-void main() {    
-	uint global_id = gl_GlobalInvocationID.x;
-    uint local_id = gl_LocalInvocationID.x;
+    uint command_carry = 0;
 
-    if (global_id < num_models) {
-        Mesh m = meshes[global_id];
+    for (uint chunk = 0; chunk < num_models; chunk += gl_WorkGroupSize.x) {
+        uint idx = chunk + local_id;
 
-        uint instance_count = instance_data[global_id].count;
+        uint first_instance = 0;
+        uint instance_count = 0;
 
-        // InstanceID start_idx -> start_idx + instance_count
-        uint start_idx = atomicAdd(render_offset, instance_count);
+        if (idx < num_models) {
+            MeshRange range = mesh_ranges[idx];
+            first_instance = visible_before(range.first_entity);
+            instance_count = visible_before(range.first_entity + range.entity_count) - first_instance;
+        }
 
-        instance_data[global_id].first_instance = start_idx;
+        uint command_count = idx < num_models && (compact == 0 || instance_count > 0) ? 1 : 0;
+        uint command_idx = command_carry + workgroup_scan(command_count) - command_count;
 
-        RenderCommand rc = RenderCommand(
-            m.num_vertices,
-            instance_count,
-            m.first_idx,
-            m.base_vertex,
-            start_idx
-        );
+        if (command_count != 0) {
+            Mesh m = meshes[idx];
+
+            // InstanceID base_instance -> base_instance + instance_count
+            commands[command_offset + command_idx] = RenderCommand(
+                m.num_vertices,
+                instance_count,
+                m.first_idx,
+                m.base_vertex,
+                instance_base_in + first_instance
+            );
+        }
+
+        command_carry += partial[gl_WorkGroupSize.x - 1];
+
+        // Before partial is overwritten by the next chunk
+        barrier();
+    }
 
-        commands[global_id] = rc;
-        instance_data[global_id].count = 0;
+    if (local_id == 0) {
+        visible_count = total_visible;
+        scatter_base = instance_base_in;
+        instance_base = instance_base_in + total_visible;
+        draw_counts[pass_index] = command_carry;
     }
 }
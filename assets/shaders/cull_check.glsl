@@ -0,0 +1,32 @@
+#type compute
+
+// Runs sphere_visible() over a list of models, so the CPU reference can be checked against it. See gpu_sphere_visible() in cull_check.cpp
+
+layout (local_size_x = 64, local_size_y = 1, local_size_z = 1) in;
+
+#include "culling.glsl"
+
+// Bound by gpu_sphere_visible(), from BindingTable::reserved_storage_begin up. Must match.
+layout(std430, binding = 24) readonly buffer CullCheckData {
+    CullData cull;
+    mat4 view;
+};
+
+layout(std430, binding = 25) readonly buffer CullCheckModels {
+    mat4 models[];
+};
+
+layout(std430, binding = 26) writeonly buffer CullCheckResults {
+    uint results[];
+};
+
+layout(location=0) uniform uint num_spheres;
+layout(location=1) uniform float radius;
+
+void main() {
+    uint global_id = gl_GlobalInvocationID.x;
+
+    if (global_id < num_spheres) {
+        results[global_id] = sphere_visible(cull, view, models[global_id], radius) ? 1 : 0;
+    }
+}
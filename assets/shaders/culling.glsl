@@ -0,0 +1,78 @@
+// Bounding sphere vs frustum, and contribution, culling. Must match sphere_cull() in culling.hpp exactly,
+// which is the CPU reference, so everything is precise and written out the same way.
+
+struct CullData {
+	mat4 view;
+	float frustum[4];	// x, z of the normalised left plane, then y, z of the bottom plane, in view space
+	float znear, zfar;
+	float contribution_scale_sq;
+	float min_pixels;
+	float frustum_offset[2];	// 0 for perspective, half the width and height of an orthographic box
+};
+
+// What sphere_cull() decided. Must match CullResult in culling.hpp.
+const uint CULL_VISIBLE = 0;
+const uint CULL_FRUSTUM = 1;
+const uint CULL_CONTRIBUTION = 2;
+
+
+bool sphere_outside(precise float dist, precise float radius_sq) {
+	return dist >= 0.0 && dist * dist >= radius_sq;
+}
+
+
+float length_sq(precise float x, precise float y, precise float z) {
+	precise float l = x * x + y * y + z * z;
+	return l;
+}
+
+
+// A mesh's own min_pixels wins if it's positive. Negative never culls the mesh, and 0 leaves it to cull.min_pixels.
+float contribution_min_pixels(CullData cull, float mesh_min_pixels) {
+	return mesh_min_pixels > 0.0 ? mesh_min_pixels : mesh_min_pixels < 0.0 ? 0.0 : cull.min_pixels;
+}
+
+
+// Is a sphere at view space depth cz at least min_pixels across on screen?
+bool sphere_contributes(CullData cull, precise float cz, precise float radius_sq, precise float min_pixels) {
+	precise float min_pixels_sq = min_pixels * min_pixels;
+	precise float size = radius_sq * cull.contribution_scale_sq;
+	precise float threshold = cz * cz * min_pixels_sq;
+	return size >= threshold;
+}
+
+
+uint sphere_cull(CullData cull, mat4 view, mat4 model, float radius, float min_pixels) {
+	precise float scale_sq = max(max(
+		length_sq(model[0].x, model[0].y, model[0].z),
+		length_sq(model[1].x, model[1].y, model[1].z)),
+		length_sq(model[2].x, model[2].y, model[2].z));
+
+	precise float radius_sq = radius * radius * scale_sq;
+
+	float wx = model[3].x, wy = model[3].y, wz = model[3].z;
+
+	precise float cx = view[0].x * wx + view[1].x * wy + view[2].x * wz + view[3].x;
+	precise float cy = view[0].y * wx + view[1].y * wy + view[2].y * wz + view[3].y;
+	precise float cz = view[0].z * wx + view[1].z * wy + view[2].z * wz + view[3].z;
+
+	precise float side_x = abs(cx) * cull.frustum[0] - cz * cull.frustum[1] - cull.frustum_offset[0];
+	precise float side_y = abs(cy) * cull.frustum[2] - cz * cull.frustum[3] - cull.frustum_offset[1];
+	precise float near_dist = cull.znear + cz;
+	precise float far_dist = -cz - cull.zfar;
+
+	if (sphere_outside(side_x, radius_sq)) return CULL_FRUSTUM;
+	if (sphere_outside(side_y, radius_sq)) return CULL_FRUSTUM;
+	if (sphere_outside(near_dist, radius_sq)) return CULL_FRUSTUM;
+	if (sphere_outside(far_dist, radius_sq)) return CULL_FRUSTUM;
+
+	if (!sphere_contributes(cull, cz, radius_sq, min_pixels)) return CULL_CONTRIBUTION;
+
+	return CULL_VISIBLE;
+}
+
+
+// Just the frustum test
+bool sphere_visible(CullData cull, mat4 view, mat4 model, float radius) {
+	return sphere_cull(cull, view, model, radius, 0.0) == CULL_VISIBLE;
+}
@@ -0,0 +1,40 @@
+#type compute
+
+// Lights the G-buffer, a pixel per invocation, into the framebuffer's colour. Pixels at the far plane
+// weren't drawn, and keep the clear colour. The position comes back from depth, and everything after
+// that is lighting.glsl, the same as the forward pass, cluster lists and all.
+
+layout (local_size_x = 8, local_size_y = 8, local_size_z = 1) in;
+
+layout(binding = 3) uniform sampler2D gbuffer_albedo_metallic;
+layout(binding = 4) uniform sampler2D gbuffer_normal_roughness;
+layout(binding = 5) uniform sampler2D gbuffer_depth;
+layout(binding = 0, rgba16f) uniform restrict writeonly image2D lit;
+
+#include "frame_constants.glsl"
+#include "lighting.glsl"
+#include "octahedral.glsl"
+
+void main() {
+	ivec2 pixel = ivec2(gl_GlobalInvocationID.xy);
+	if (any(greaterThanEqual(pixel, ivec2(viewport_size)))) return;
+
+	float depth = texelFetch(gbuffer_depth, pixel, 0).r;
+	if (depth == 1.0) return;
+
+	vec4 albedo_metallic = texelFetch(gbuffer_albedo_metallic, pixel, 0);
+	vec4 normal_roughness = texelFetch(gbuffer_normal_roughness, pixel, 0);
+
+	vec3 N = oct_decode(normal_roughness.xy * 2.0 - 1.0);
+
+	// Where the fragment was, from its depth
+	vec2 frag_coord = vec2(pixel) + 0.5;
+	vec4 clip = vec4(frag_coord / viewport_size * 2.0 - 1.0, depth * 2.0 - 1.0, 1.0);
+	vec4 world = inverse_vp * clip;
+	vec3 world_pos = world.xyz / world.w;
+
+	// Only the shaded normal is kept, so the sun's shadow is offset along that
+	vec3 color = light_surface(world_pos, frag_coord, N, N, albedo_metallic.rgb, albedo_metallic.a, normal_roughness.b);
+
+	imageStore(lit, pixel, vec4(color, 1.0));
+}
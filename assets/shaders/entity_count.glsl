@@ -1,15 +1,39 @@
 #type compute
 
-layout (local_size_x = 32, local_size_y = 1, local_size_z = 1) in;
+// Culls every entity, and packs the visible ones into the workgroup's block of visible_entities.
+// A prefix sum in shared memory gives each visible entity its place, so they stay in entity order, without any atomics.
+// The group's count goes in group_visible, for build_render_command to turn into where they all end up.
+// Entities too small on screen are culled too, and counted for the stats.
+
+layout (local_size_x = 256, local_size_y = 1, local_size_z = 1) in;
 
 #include "gpu_driven_renderer_includes.glsl"
+#include "occlusion.glsl"
 
 layout(location=0) uniform uint num_entities;
-layout(location=1) uniform mat4 model_view;
+layout(location=1) uniform uint phase;
+layout(location=2) uniform uint cull_index;		// Which of cull_data to cull against. 0 is the camera.
+
+// Without occlusion culling, there's one pass over everything in the frustum.
+// With it, the early pass draws what was visible last frame, and the late pass tests everything
+// against the Hi-Z pyramid built from that, draws what the early pass missed, and remembers what's visible.
+// The shadow phases are for a shadow cascade, frustum only, with every caster or just the static or dynamic ones.
+const uint PHASE_ALL = 0;
+const uint PHASE_EARLY = 1;
+const uint PHASE_LATE = 2;
+const uint PHASE_SHADOW = 3;
+const uint PHASE_SHADOW_STATIC = 4;
+const uint PHASE_SHADOW_DYNAMIC = 5;
+
+shared uint group_scan[gl_WorkGroupSize.x];
 
 void main() {   
 	uint global_id = gl_GlobalInvocationID.x;
-    uint local_id = gl_LocalInvocationID.x;
+    uint local_id = gl_LocalInvocationIndex;
+
+    // No early returns, every invocation has to reach the barriers
+    bool draw = false;
+    bool too_small = false;
 
     if(global_id < num_entities) {
         Entity e = entities[global_id];
@@ -17,12 +41,55 @@ void main() {
         mat4 t = transforms[e.transform_idx];
         Mesh m = meshes[e.mesh_idx];
 
-        vec4 pos = t[3];
+        CullData cull = cull_data[cull_index];
+        bool shadow = phase >= PHASE_SHADOW;
+
+        // Small things still cast shadows, and an orthographic cascade has no perspective to size them by
+        uint result = sphere_cull(cull, cull.view, t, m.bounding_sphere, shadow ? 0.0 : contribution_min_pixels(cull, m.min_pixels));
+        draw = result == CULL_VISIBLE;
+
+        // Counted once a frame, by the only pass or the late pass, which is the one that tests everything
+        too_small = result == CULL_CONTRIBUTION && (phase == PHASE_ALL || phase == PHASE_LATE);
+
+        if (phase == PHASE_SHADOW_STATIC) {
+            draw = draw && (e.flags & ENTITY_DYNAMIC) == 0;
+        }
+        else if (phase == PHASE_SHADOW_DYNAMIC) {
+            draw = draw && (e.flags & ENTITY_DYNAMIC) != 0;
+        }
+        else if (phase == PHASE_EARLY) {
+            draw = draw && visibility[global_id] != 0;
+        }
+        else if (phase == PHASE_LATE) {
+            bool visible = draw && sphere_unoccluded(t, m.bounding_sphere);
 
-        //pos *= model_view;
+            // Already drawn by the early pass
+            draw = visible && visibility[global_id] == 0;
+            visibility[global_id] = visible ? 1 : 0;
+        }
+    }
+
+    // Inclusive scan of who's visible (Hillis-Steele), with who's too small counted alongside in the top 16 bits
+    group_scan[local_id] = (draw ? 1 : 0) | (too_small ? 0x10000 : 0);
+    barrier();
+
+    for (uint stride = 1; stride < gl_WorkGroupSize.x; stride *= 2) {
+        uint value = local_id >= stride ? group_scan[local_id - stride] : 0;
+        barrier();
+        group_scan[local_id] += value;
+        barrier();
+    }
+
+    // So generate_per_instance_data only runs over what's visible, and doesn't have to cull again
+    if (draw) {
+        visible_entities[gl_WorkGroupID.x * gl_WorkGroupSize.x + (group_scan[local_id] & 0xFFFF) - 1] = global_id;
+    }
 
-        //if (pos.z < 0) return;
+    if (local_id == gl_WorkGroupSize.x - 1) {
+        uint totals = group_scan[local_id];
+        group_visible[gl_WorkGroupID.x] = totals & 0xFFFF;
 
-        atomicAdd(instance_data[e.mesh_idx].count, 1);
+        // Only for the stats, so the order doesn't matter
+        if ((totals >> 16) != 0) atomicAdd(contribution_culled, totals >> 16);
     }
 }
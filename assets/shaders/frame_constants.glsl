@@ -0,0 +1,11 @@
+// Set once per frame by the renderer. Must match FrameConstants in frame_constants.hpp!
+layout(std140) uniform FrameConstants {
+	mat4 view;
+	mat4 projection;
+	mat4 vp;
+	mat4 inverse_vp;		// Clip space back to world space, for positions from depth
+	vec4 camera_pos;		// w unused
+	vec2 viewport_size;
+	float znear;
+	float zfar;
+};
@@ -0,0 +1,30 @@
+#type vertex
+#include "mesh_vertex.glsl"
+
+
+#type fragment
+#extension GL_ARB_gpu_shader_int64 : enable
+#extension GL_ARB_bindless_texture : enable
+
+// The opaque pass in deferred mode. Same surface as no_debug_options.glsl, but written out to
+// the G-buffer instead of lit, and deferred_lighting.glsl lights it afterwards. See GBuffer.
+layout(location = 0) out vec4 albedo_metallic;		// RGBA8
+layout(location = 1) out vec4 normal_roughness;	// RGB10_A2, the octahedral normal in rg
+
+in flat uint material_idx_out;
+in vec3 vertex_position_worldspace;
+in vec3 vertex_normal;
+
+in vec2 vertex_uv;
+in mat3 TBN;
+
+#include "frame_constants.glsl"
+#include "surface.glsl"
+#include "octahedral.glsl"
+
+void main() {
+	Surface surface = sample_surface(material_idx_out, vertex_uv, vertex_normal, TBN);
+
+	albedo_metallic = vec4(surface.albedo, surface.metallic);
+	normal_roughness = vec4(oct_encode(surface.N) * 0.5 + 0.5, surface.roughness, 0.0);
+}
@@ -1,23 +1,27 @@
 #type compute
 
-layout (local_size_x = 32, local_size_y = 1, local_size_z = 1) in;
+// Places each visible entity's instance data. Dispatched with a workgroup per entity_count workgroup,
+// so the group size has to match, and each group copies its block of visible_entities to where
+// build_render_command said it starts. In entity order, so each mesh's instances come out together.
 
-#include "gpu_driven_renderer_includes.glsl"
+layout (local_size_x = 256, local_size_y = 1, local_size_z = 1) in;
 
-layout(location=0) uniform uint num_entities;
+#include "gpu_driven_renderer_includes.glsl"
 
 void main() {    
-	uint global_id = gl_GlobalInvocationID.x;
+    uint group = gl_WorkGroupID.x;
+    uint local_id = gl_LocalInvocationIndex;
+
+    uint group_first = group_visible[group];
 
-    if(global_id < num_entities) {
-        Entity e = entities[global_id];
+    if (local_id < group_visible[group + 1] - group_first) {
+        Entity e = entities[visible_entities[group * gl_WorkGroupSize.x + local_id]];
         
         PerInstanceData pid = PerInstanceData(
             e.transform_idx,
             e.material_idx
         );
 
-        uint model_offset = atomicAdd(instance_data[e.mesh_idx].count, 1);
-        per_instance_data[instance_data[e.mesh_idx].first_instance + model_offset] = pid;
+        per_instance_data[scatter_base + group_first + local_id] = pid;
     }
 }
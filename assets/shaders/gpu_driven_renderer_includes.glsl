@@ -5,6 +5,7 @@ struct Mesh {
 		uint first_idx;
 		int base_vertex;
 		float bounding_sphere;
+		float min_pixels;		// Contribution culling threshold, see contribution_min_pixels()
 		// vec3 aabb_min;
 		// float padding_2;
 		// vec3 aabb_max;
@@ -15,9 +16,12 @@ struct Entity {
     uint mesh_idx;
     uint material_idx;
     uint transform_idx;
-    uint padding;
+    uint flags;
 };
 
+// Entity flags. Must match GPUEntity in draw_data.hpp.
+const uint ENTITY_DYNAMIC = 1;      // Has moved since it was made resident, so its shadow isn't cached
+
 struct RenderCommand {
     uint count;
     uint instance_count;
@@ -31,16 +35,15 @@ struct PerInstanceData {
     uint material_idx;
 };
 
-struct ModelInstanceData {
-    uint count;
-    uint first_instance;
+// Each mesh's entities are one contiguous run of the Entities buffer, which is kept sorted by mesh and material
+struct MeshRange {
+    uint first_entity;
+    uint entity_count;
 };
 
 
-struct CullData {
-    float frustum[4];
-	float znear, zfar;
-};
+#include "frame_constants.glsl"
+#include "culling.glsl"
 
 
 layout(std430) restrict readonly buffer Transforms {
@@ -60,17 +63,41 @@ layout(std430) restrict readonly buffer Meshes {
 	Mesh meshes[];
 };
 
+layout(std430) restrict readonly buffer MeshRanges {
+	MeshRange mesh_ranges[];
+};
+
 layout(std430) restrict writeonly buffer RenderCommands {
     RenderCommand commands[];
 };
 
-layout(std430) restrict buffer RenderData {
-    uint render_offset;
-    ModelInstanceData instance_data[];
+// Everything here is reset by the passes that use it, so the CPU never has to clear it.
+// The header must match CullCounters in culling.hpp.
+// Coherent, as build_render_command reads back what other invocations of its workgroup wrote.
+layout(std430) restrict coherent buffer RenderData {
+    uint visible_count;         // Entities visible in the last pass
+    uint instance_base;         // Where the next pass's instances go, after the previous pass's
+    uint scatter_base;          // Where generate_per_instance_data puts this pass's instances
+    uint contribution_culled;   // Entities in the frustum but too small to draw, this frame. Cleared by the CPU.
+    uint draw_counts[2];        // Commands written by each pass, for glMultiDrawElementsIndirectCount
+    uint padding_2[2];
+    uint group_visible[];       // Per entity_count workgroup, how many entities it found visible. Scanned by build_render_command
+                                // into where each group's visible entities start, with the total after the last group.
 };
 
 layout(std430) restrict writeonly buffer PerInstance {
     PerInstanceData per_instance_data[];
 };
 
+// The entities that passed culling. Each entity_count workgroup packs its own into the start of its block
+// of gl_WorkGroupSize.x, in entity order, so they're sorted by mesh like the entities are.
+layout(std430) restrict buffer VisibleEntities {
+    uint visible_entities[];
+};
+
+// Per entity, whether it passed the late cull last frame. Persists between frames.
+layout(std430) restrict buffer Visibility {
+    uint visibility[];
+};
+
 
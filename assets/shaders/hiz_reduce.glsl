@@ -0,0 +1,34 @@
+#type compute
+
+layout (local_size_x = 8, local_size_y = 8, local_size_z = 1) in;
+
+// One level of the Hi-Z pyramid, from the level below it (or the depth buffer)
+layout(binding = 0) uniform sampler2D source;
+layout(binding = 0, r32f) uniform restrict writeonly image2D destination;
+
+layout(location = 0) uniform int source_level;
+
+void main() {
+	ivec2 texel = ivec2(gl_GlobalInvocationID.xy);
+	ivec2 size = imageSize(destination);
+
+	if (any(greaterThanEqual(texel, size))) return;
+
+	ivec2 source_size = textureSize(source, source_level);
+
+	// Every source texel this one covers, rounding outwards, since the depth buffer
+	// isn't a power of two and nothing can be left out
+	ivec2 first = (texel * source_size) / size;
+	ivec2 last = min(((texel + 1) * source_size + size - 1) / size, source_size);
+
+	// Farthest depth wins
+	float depth = 0.0;
+
+	for (int y = first.y; y < last.y; y++) {
+		for (int x = first.x; x < last.x; x++) {
+			depth = max(depth, texelFetch(source, ivec2(x, y), source_level).r);
+		}
+	}
+
+	imageStore(destination, texel, vec4(depth));
+}
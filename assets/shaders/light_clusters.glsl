@@ -0,0 +1,78 @@
+// Clustered light lists, built by build_light_clusters.glsl. Must match light_clusters.hpp, whose
+// LightClusterBinner is the CPU reference, so the tests are precise and written out the same way.
+// cluster_index() uses viewport_size, so frame_constants.glsl has to be included first.
+
+// Set by the renderer. Must match ClusterConstants in light_clusters.hpp!
+layout(std140) uniform ClusterConstants {
+	uvec4 cluster_dims;			// Clusters across, up and deep, then the most lights a cluster's list holds
+	float cluster_depth_scale;	// A view depth's slice is log(depth) * cluster_depth_scale + cluster_depth_bias
+	float cluster_depth_bias;
+	uint light_count;			// Visible lights
+	uint clusters_enabled;		// 0 shades with every light
+};
+
+// The lights in view, compacted by the renderer every frame (see VisibleLights), light_count of each
+layout(std430) restrict readonly buffer LightSpheres {
+	vec4 light_spheres[];		// World space position, radius squared in w
+};
+
+layout(std430) restrict readonly buffer LightRadiance {
+	uvec2 light_radiance[];		// color * intensity, as halfs
+};
+
+// A cluster's box in view space, w unused
+struct ClusterBox {
+	vec4 min_point;
+	vec4 max_point;
+};
+
+// Only change with the projection, so they're uploaded by the renderer
+layout(std430) restrict readonly buffer ClusterBounds {
+	ClusterBox cluster_boxes[];
+};
+
+// cluster_dims.w + 1 uints per cluster: its count, then that many light indices, in light order
+layout(std430) restrict buffer ClusterLights {
+	uint cluster_lights[];
+};
+
+
+vec3 unpack_radiance(uint light) {
+	uvec2 packed = light_radiance[light];
+	return vec3(unpackHalf2x16(packed.x), unpackHalf2x16(packed.y).x);
+}
+
+
+// A world space light sphere, moved into view space
+vec4 light_view_sphere(mat4 view, vec4 sphere) {
+	precise float cx = view[0].x * sphere.x + view[1].x * sphere.y + view[2].x * sphere.z + view[3].x;
+	precise float cy = view[0].y * sphere.x + view[1].y * sphere.y + view[2].y * sphere.z + view[3].y;
+	precise float cz = view[0].z * sphere.x + view[1].z * sphere.y + view[2].z * sphere.z + view[3].z;
+
+	return vec4(cx, cy, cz, sphere.w);
+}
+
+
+float axis_outside(precise float c, precise float lo, precise float hi) {
+	precise float d = max(max(lo - c, 0.0), c - hi);
+	return d;
+}
+
+
+bool sphere_in_cluster(vec4 sphere, ClusterBox box) {
+	precise float dx = axis_outside(sphere.x, box.min_point.x, box.max_point.x);
+	precise float dy = axis_outside(sphere.y, box.min_point.y, box.max_point.y);
+	precise float dz = axis_outside(sphere.z, box.min_point.z, box.max_point.z);
+
+	precise float distance_sq = dx * dx + dy * dy + dz * dz;
+	return distance_sq <= sphere.w;
+}
+
+
+// The cluster a fragment's in, from where it is on screen and how far it is in front of the camera
+uint cluster_index(vec2 frag_coord, float view_depth) {
+	uvec2 tile = uvec2(clamp(frag_coord / viewport_size * vec2(cluster_dims.xy), vec2(0), vec2(cluster_dims.xy) - 1.0));
+	float slice = clamp(log(view_depth) * cluster_depth_scale + cluster_depth_bias, 0.0, float(cluster_dims.z) - 1.0);
+
+	return tile.x + cluster_dims.x * (tile.y + cluster_dims.y * uint(slice));
+}
@@ -0,0 +1,115 @@
+// Lighting a surface, the same way whether it's shaded forward (no_debug_options.glsl) or deferred (deferred_lighting.glsl).
+// frame_constants.glsl has to be included first.
+
+#include "shadows.glsl"
+#include "light_clusters.glsl"
+
+
+const float PI = 3.141;
+
+vec3 fresnelSchlick(float cosTheta, vec3 F0) {
+    return F0 + (1.0 - F0) * pow(clamp(1.0 - cosTheta, 0.0, 1.0), 5.0);
+}  
+
+float DistributionGGX(vec3 N, vec3 H, float roughness)
+{
+    float a      = roughness*roughness;
+    float a2     = a*a;
+    float NdotH  = max(dot(N, H), 0.0);
+    float NdotH2 = NdotH*NdotH;
+	
+    float num   = a2;
+    float denom = (NdotH2 * (a2 - 1.0) + 1.0);
+    denom = PI * denom * denom;
+	
+    return num / denom;
+}
+
+float GeometrySchlickGGX(float NdotV, float roughness)
+{
+    float r = (roughness + 1.0);
+    float k = (r*r) / 8.0;
+
+    float num   = NdotV;
+    float denom = NdotV * (1.0 - k) + k;
+	
+    return num / denom;
+}
+float GeometrySmith(vec3 N, vec3 V, vec3 L, float roughness)
+{
+    float NdotV = max(dot(N, V), 0.0);
+    float NdotL = max(dot(N, L), 0.0);
+    float ggx2  = GeometrySchlickGGX(NdotV, roughness);
+    float ggx1  = GeometrySchlickGGX(NdotL, roughness);
+	
+    return ggx1 * ggx2;
+}
+
+// Cook-Torrance, for light coming from L with the given radiance
+vec3 shade(vec3 N, vec3 V, vec3 L, vec3 radiance, vec3 albedo, float metallic, float roughness, vec3 F0) {
+	vec3 H = normalize(L + V);
+
+	float NDF = DistributionGGX(N, H, roughness);
+	float G = GeometrySmith(N, V, L, roughness);
+	vec3 F = fresnelSchlick(max(dot(H, V), 0.0), F0);
+
+	vec3 kS = F;
+	vec3 kD = vec3(1.0) - kS;
+	
+	kD *= 1.0 - metallic;	
+
+	vec3 numerator = NDF * G * F;
+	float demoninator = 4.0 * max(dot(N, V), 0.0) * max(dot(N, L), 0.0) + 0.0001;
+	vec3 specular = numerator / demoninator;
+
+	float n_dot_l = max(dot(N, L), 0.0);
+	return (kD * albedo / PI + specular) * radiance * n_dot_l;
+}
+
+
+// Everything lighting a surface at world_pos: the point lights in its cluster, the sun and ambient, tonemapped.
+// shadow_N is the normal the sun's shadow lookup is offset along.
+vec3 light_surface(vec3 world_pos, vec2 frag_coord, vec3 N, vec3 shadow_N, vec3 albedo, float metallic, float roughness) {
+	vec3 F0 = vec3(0.04); // approximation of F0 for dielectrics
+	F0 = mix(F0, albedo, metallic);
+
+	vec3 V = normalize(camera_pos.xyz - world_pos);
+
+	vec3 lo = vec3(0);
+
+	// Only the lights that reach this fragment's cluster, unless clustering is off
+	float view_depth = -(view * vec4(world_pos, 1)).z;
+	uint list = cluster_index(frag_coord, view_depth) * (cluster_dims.w + 1);
+	uint count = clusters_enabled != 0 ? cluster_lights[list] : light_count;
+
+	for (uint i = 0; i < count; i++) {
+		uint light = clusters_enabled != 0 ? cluster_lights[list + 1 + i] : i;
+		vec4 sphere = light_spheres[light];
+
+		vec3 to_light = sphere.xyz - world_pos;
+		float distance_sq = dot(to_light, to_light);
+		float radius_sq = sphere.w;
+
+		if (distance_sq >= radius_sq) continue;
+
+		// Inverse square, faded to nothing at the light's radius
+		float fade = 1.0 - (distance_sq * distance_sq) / (radius_sq * radius_sq);
+		float attenuation = fade * fade / max(distance_sq, 0.0001);
+
+		vec3 radiance = unpack_radiance(light) * attenuation;
+		vec3 L = to_light * inversesqrt(distance_sq);
+
+		lo += shade(N, V, L, radiance, albedo, metallic, roughness, F0);
+	}
+
+	if (light_color.rgb != vec3(0)) {
+		vec3 sun = shade(N, V, light_direction.xyz, light_color.rgb, albedo, metallic, roughness, F0);
+		lo += sun * sun_shadow(world_pos, shadow_N);
+	}
+	
+	vec3 ambient = vec3(0.05) * albedo;
+	vec3 color = ambient + lo;
+
+	color = color / (color + vec3(1.0));
+	return pow(color, vec3(1.0/2.2));
+}
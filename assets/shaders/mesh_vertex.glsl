@@ -0,0 +1,46 @@
+#extension GL_ARB_gpu_shader_int64 : enable
+#extension GL_ARB_bindless_texture : enable
+
+// The vertex stage for full vertices, shared by the forward and G-buffer passes
+
+layout(location = 0) in vec3 vertex_position;
+layout(location = 1) in vec3 normal;
+layout(location = 2) in vec2 uv;
+layout(location = 3) in vec3 tangent;
+layout(location = 4) in uint transform_idx;
+layout(location = 5) in uint material_idx;
+
+layout(std430, binding=7) restrict readonly buffer Transforms {
+	mat4 transforms[];
+};
+
+out vec3 vertex_position_worldspace;
+out vec3 vertex_normal;
+out vec2 vertex_uv;
+out mat3 TBN;
+
+#include "frame_constants.glsl"
+uniform float time;
+
+out flat uint material_idx_out;
+
+void main() {
+	mat4 model = transforms[transform_idx];
+	mat4 mvp = vp * model;
+	vec4 vertex_pos = vec4(vertex_position, 1);
+
+	vertex_position_worldspace = (model * vertex_pos).xyz;
+	gl_Position = mvp * vertex_pos;
+
+	vertex_normal = mat3(inverse(transpose(model))) * normal;
+
+	material_idx_out = material_idx;
+	vertex_uv = uv;
+
+	// Calculate TBN matrix for normal maps!
+	// TODO: Look into tangent space lighting or whatever?
+	vec3 bi_tan = cross(normal, tangent);
+	
+	vec3 T = normalize(vec3(model * vec4(tangent, 0)));
+	vec3 B = normalize(vec3(model * vec4(bi_tan, 0)));
+	vec3 N = normalize(vec3(model * vec4(normal, 0)));
@@ -0,0 +1,63 @@
+
+// Sphere vs Hi-Z pyramid occlusion culling. Needs frame_constants.glsl.
+// Conservative rather than exact, so unlike culling.glsl there's no CPU version to match.
+
+layout(binding = 1) uniform sampler2D depth_pyramid;
+
+
+// Screen space bounds of a sphere, in uv. c is in view space with z pointing forward.
+// 2D Polyhedral Bounds of a Clipped, Perspective-Projected 3D Sphere. Mara, McGuire 2013, as done in niagara.
+// False if the sphere crosses the near plane, where the bounds fall apart.
+bool project_sphere(vec3 c, float r, float znear, float P00, float P11, out vec4 aabb) {
+	if (c.z < r + znear) return false;
+
+	vec3 cr = c * r;
+	float czr2 = c.z * c.z - r * r;
+
+	float vx = sqrt(c.x * c.x + czr2);
+	float minx = (vx * c.x - cr.z) / (vx * c.z + cr.x);
+	float maxx = (vx * c.x + cr.z) / (vx * c.z - cr.x);
+
+	float vy = sqrt(c.y * c.y + czr2);
+	float miny = (vy * c.y - cr.z) / (vy * c.z + cr.y);
+	float maxy = (vy * c.y + cr.z) / (vy * c.z - cr.y);
+
+	// Clip space to uv. GL's uv and clip space y both point up, so no flip.
+	aabb = vec4(minx * P00, miny * P11, maxx * P00, maxy * P11) * 0.5 + 0.5;
+	return true;
+}
+
+
+// Could any of the bounding sphere be in front of what's in the pyramid?
+bool sphere_unoccluded(mat4 model, float radius) {
+	float scale_sq = max(max(dot(model[0].xyz, model[0].xyz), dot(model[1].xyz, model[1].xyz)), dot(model[2].xyz, model[2].xyz));
+	float r = radius * sqrt(scale_sq);
+
+	vec3 c = (view * vec4(model[3].xyz, 1.0)).xyz;
+	c.z = -c.z;
+
+	vec4 aabb;
+	if (!project_sphere(c, r, znear, projection[0][0], projection[1][1], aabb)) return true;
+
+	// The level where the box is at most a texel across, so it touches 2x2 texels at most
+	vec2 extent = (aabb.zw - aabb.xy) * vec2(textureSize(depth_pyramid, 0));
+	int level = clamp(int(ceil(log2(max(max(extent.x, extent.y), 1.0)))), 0, textureQueryLevels(depth_pyramid) - 1);
+
+	ivec2 level_size = textureSize(depth_pyramid, level);
+	ivec2 lo = clamp(ivec2(aabb.xy * vec2(level_size)), ivec2(0), level_size - 1);
+	ivec2 hi = clamp(ivec2(aabb.zw * vec2(level_size)), ivec2(0), level_size - 1);
+
+	float depth = 0.0;
+
+	for (int y = lo.y; y <= hi.y; y++) {
+		for (int x = lo.x; x <= hi.x; x++) {
+			depth = max(depth, texelFetch(depth_pyramid, ivec2(x, y), level).r);
+		}
+	}
+
+	// Window space depth of the sphere's nearest point
+	float z = r - c.z;
+	float sphere_depth = (projection[2][2] * z + projection[3][2]) / -z * 0.5 + 0.5;
+
+	return sphere_depth <= depth;
+}
@@ -0,0 +1,17 @@
+// Unit vectors packed into two numbers in [-1, 1], by projecting onto an octahedron and folding
+// the bottom half out over the corners (Cigolle et al., "A Survey of Efficient Representations for Independent Unit Vectors")
+
+vec2 sign_not_zero(vec2 v) {
+	return vec2(v.x >= 0.0 ? 1.0 : -1.0, v.y >= 0.0 ? 1.0 : -1.0);
+}
+
+vec2 oct_encode(vec3 n) {
+	vec2 p = n.xy / (abs(n.x) + abs(n.y) + abs(n.z));
+	return n.z <= 0.0 ? (1.0 - abs(p.yx)) * sign_not_zero(p) : p;
+}
+
+vec3 oct_decode(vec2 e) {
+	vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+	if (n.z < 0.0) n.xy = (1.0 - abs(n.yx)) * sign_not_zero(n.xy);
+	return normalize(n);
+}
@@ -0,0 +1,30 @@
+#type compute
+
+// Copies each record's element to its destination index. See scatter_upload() in ring_buffer.hpp
+
+layout (local_size_x = 64, local_size_y = 1, local_size_z = 1) in;
+
+// From BindingTable::reserved_storage_begin up. Must match.
+layout(std430, binding = 24) readonly buffer ScatterRecords {
+    uint records[];
+};
+
+layout(std430, binding = 25) writeonly buffer ScatterDestination {
+    uint destination[];
+};
+
+layout(location=0) uniform uint num_records;
+layout(location=1) uniform uint element_words;
+
+void main() {
+    uint global_id = gl_GlobalInvocationID.x;
+
+    if (global_id < num_records) {
+        uint record = global_id * (element_words + 1);
+        uint base = records[record] * element_words;
+
+        for (uint i = 0; i < element_words; i++) {
+            destination[base + i] = records[record + 1 + i];
+        }
+    }
+}
@@ -0,0 +1,19 @@
+#type vertex
+
+// Depth from the sun, into one cascade of the shadow map. Draws from the position stream, like z_prepass.glsl.
+layout(location = 0) in vec3 vertex_position;
+layout(location = 4) in uint transform_idx;
+layout(location = 5) in uint material_idx;
+
+layout(std430, binding=7) restrict readonly buffer Transforms {
+	mat4 transforms[];
+};
+
+#include "frame_constants.glsl"
+#include "shadows.glsl"
+
+uniform uint cascade;
+
+void main() {
+	gl_Position = cascade_vp[cascade] * transforms[transform_idx] * vec4(vertex_position, 1);
+}
@@ -0,0 +1,40 @@
+// The sun, and its cascaded shadow map. Set once per frame by the renderer. Must match ShadowConstants in shadows.hpp!
+// Uses camera_pos, so frame_constants.glsl has to be included first.
+layout(std140) uniform ShadowConstants {
+	mat4 cascade_vp[4];			// World space to each cascade's clip space
+	vec4 cascade_radius;		// How far from the camera each cascade covers
+	vec4 cascade_texel_size;	// In world space
+	vec4 light_direction;		// Towards the light, w unused
+	vec4 light_color;			// Times intensity. Black without a sun.
+	uint cascade_count;			// 0 when shadows are off
+};
+
+layout(binding = 2) uniform sampler2DArrayShadow shadow_map;
+
+
+// How much of the sun reaches world_pos, from 0 in shadow to 1 lit. N is the surface normal.
+// The first cascade that reaches it is used, with a 3x3 PCF of hardware filtered taps.
+float sun_shadow(vec3 world_pos, vec3 N) {
+	float distance = length(world_pos - camera_pos.xyz);
+
+	for (uint c = 0; c < cascade_count; c++) {
+		if (distance >= cascade_radius[c]) continue;
+
+		// Pushed out along the normal by a texel or so, which keeps surfaces from shadowing themselves
+		vec3 offset_pos = world_pos + N * cascade_texel_size[c] * 1.5;
+		vec3 shadow_pos = (cascade_vp[c] * vec4(offset_pos, 1)).xyz * 0.5 + 0.5;
+
+		vec2 texel = 1.0 / vec2(textureSize(shadow_map, 0).xy);
+		float lit = 0.0;
+
+		for (int y = -1; y <= 1; y++) {
+			for (int x = -1; x <= 1; x++) {
+				lit += texture(shadow_map, vec4(shadow_pos.xy + vec2(x, y) * texel, float(c), shadow_pos.z));
+			}
+		}
+
+		return lit / 9.0;
+	}
+
+	return 1.0;
+}
@@ -0,0 +1,58 @@
+// A mesh's material, sampled at a point on its surface. Bindless, so the including stage needs
+// GL_ARB_gpu_shader_int64 and GL_ARB_bindless_texture.
+
+struct Material {
+	vec3 diffuse_color;
+	float alpha;
+	vec2 metallic_roughness;
+	uint64_t diffuse_texture;
+	uint64_t normal_texture;
+	uint64_t metallic_roughness_texture;
+	uint64_t emissive_texture;
+};
+
+layout(std430, binding=4) restrict readonly buffer Materials {
+	Material materials[];
+};
+
+struct Surface {
+	vec3 albedo;
+	float alpha;
+	vec3 N;			// From the normal map, if there is one
+	float metallic;
+	float roughness;
+};
+
+
+Surface sample_surface(uint material_idx, vec2 uv, vec3 vertex_normal, mat3 TBN) {
+	Material mat = materials[material_idx];
+	Surface surface;
+
+	surface.albedo = mat.diffuse_color;
+	surface.alpha = mat.alpha;
+
+	if (mat.diffuse_texture != 0) {
+		vec4 diffuse = texture(sampler2D(mat.diffuse_texture), uv);
+		surface.albedo *= diffuse.rgb;
+		surface.alpha *= diffuse.a;
+	} 
+
+	surface.N = normalize(vertex_normal);
+
+	if (mat.normal_texture != 0) {
+		vec3 N = texture(sampler2D(mat.normal_texture), uv).rgb;
+		N = N * 2.0 - 1.0;
+		surface.N = normalize(TBN * N);
+	}
+
+	surface.metallic = mat.metallic_roughness.x;
+	surface.roughness = mat.metallic_roughness.y;
+
+	if (mat.metallic_roughness_texture != 0) {
+		vec4 metallic_roughness = texture(sampler2D(mat.metallic_roughness_texture), uv);
+		surface.metallic *= metallic_roughness.b;
+		surface.roughness *= metallic_roughness.g;
+	}
+
+	return surface;
+}
@@ -1,9 +1,7 @@
 #type vertex
 
+// Only the positions, so depth only passes can draw from MeshBundle::m_position_buffer
 layout(location = 0) in vec3 vertex_position;
-layout(location = 1) in vec3 normal;
-layout(location = 2) in vec2 uv;
-layout(location = 3) in vec3 tangent;
 layout(location = 4) in uint transform_idx;
 layout(location = 5) in uint material_idx;
 
@@ -11,7 +9,7 @@ layout(std430, binding=7) restrict readonly buffer Transforms {
 	mat4 transforms[];
 };
 
-uniform mat4 vp;
+#include "frame_constants.glsl"
 
 void main() {
 	mat4 model = transforms[transform_idx];
@@ -1,3 +1,8 @@
+newoption {
+   trigger = "gl-call-stats",
+   description = "Count GL calls per entry point every frame, and show them in the Instrumentor"
+}
+
 workspace "rendererer-demo"
    configurations { "Debug", "OptimizedDebug", "Release" }
    architecture "x86_64"
@@ -21,6 +26,11 @@ workspace "rendererer-demo"
       defines { "NDEBUG" }
       optimize "Full"
 
+   filter "options:gl-call-stats"
+      defines { "GL_CALL_STATS" }
+
+   filter {}
+
 
 
 project "GLFW"
@@ -0,0 +1,112 @@
+#pragma once
+
+#include <chrono>
+#include <string>
+#include <vector>
+#include <functional>
+#include <limits>
+#include <algorithm>
+
+#include <imgui.h>
+
+#include "util.hpp"
+
+// In-app benchmarks.
+// Benchmarks are registered once at startup, and run on demand from the "Benchmarks" window.
+// A benchmark can time any number of labelled sections, so e.g. insert / refit / query
+// can be reported separately from a single run.
+
+struct BenchmarkContext {
+	using Clock = std::chrono::high_resolution_clock;
+
+	struct Result {
+		std::string label;
+		double value;
+		const char* unit;
+	};
+
+	// Time a section of the benchmark, and record it under label
+	template <typename F>
+	double measure(const std::string& label, F&& func) {
+		auto start = Clock::now();
+		func();
+		double ms = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+		results.push_back({ label, ms, "ms" });
+		return ms;
+	}
+
+	// Record some other value, like a count or a ratio
+	void note(const std::string& label, double value, const char* unit = "") {
+		results.push_back({ label, value, unit });
+	}
+
+	std::vector<Result> results;
+};
+
+
+class Benchmarks {
+public:
+	using BenchmarkFunc = std::function<void(BenchmarkContext&)>;
+
+	static Benchmarks& get() {
+		static Benchmarks benchmarks;
+		return benchmarks;
+	}
+
+	void add(std::string name, BenchmarkFunc func) {
+		m_benchmarks.push_back({ name, func });
+	}
+
+	void run(size_t idx) {
+		Benchmark& b = m_benchmarks[idx];
+
+		BenchmarkContext ctx;
+		double ms = ctx.measure("Total", [&]() { b.func(ctx); });
+
+		b.last_results = std::move(ctx.results);
+		b.best_ms = std::min(b.best_ms, ms);
+		b.runs++;
+	}
+
+	void show_window() {
+		if (ImGui::Begin("Benchmarks")) {
+			for (size_t i = 0; i < m_benchmarks.size(); i++) {
+				Benchmark& b = m_benchmarks[i];
+				ImGui::Tag tag((int)i);
+
+				if (ImGui::Button("Run")) {
+					run(i);
+				}
+
+				ImGui::SameLine();
+
+				if (ImGui::TreeNode(b.name.c_str())) {
+					if (b.runs) {
+						ImGui::Text("Runs: %u, best: %.3f ms", b.runs, b.best_ms);
+					}
+
+					for (auto& result : b.last_results) {
+						ImGui::LabelText(result.label.c_str(), "%.3f %s", result.value, result.unit);
+					}
+
+					ImGui::TreePop();
+				}
+			}
+		}
+		ImGui::End();
+	}
+
+private:
+	Benchmarks() {}
+
+	struct Benchmark {
+		std::string name;
+		BenchmarkFunc func;
+
+		std::vector<BenchmarkContext::Result> last_results = {};
+		double best_ms = std::numeric_limits<double>::infinity();
+		uint32_t runs = 0;
+	};
+
+	std::vector<Benchmark> m_benchmarks;
+};
@@ -5,6 +5,8 @@
 #include <map>
 #include <vector>
 #include <array>
+#include <unordered_map>
+#include <algorithm>
 
 
 #include <imgui.h>
@@ -43,6 +45,24 @@ public:
 
 		m_frame->last_start_time = get_time();
 		m_current_entry = m_frame;
+
+		m_last_frame_counts.assign(m_counts.begin(), m_counts.end());
+		std::sort(m_last_frame_counts.begin(), m_last_frame_counts.end(), [](const auto& a, const auto& b) { return a.second > b.second; });
+		m_counts.clear();
+	}
+
+	// Count an event, like a GL call. Counts are per frame, and shown under the timings.
+	// name is used as the key, so it has to outlive the frame (string literals are fine)
+	void count(const char* name) {
+		m_counts[name]++;
+	}
+
+	// Add a time measured some other way, like a GPU timer query, as an event under the current one.
+	// duration is in nanoseconds, like everything else here.
+	void record(const std::string& name, double duration) {
+		start_event(name);
+		add_duration(duration);
+		m_current_entry = m_current_entry->parent.lock();
 	}
 
 	void end_frame() {
@@ -59,7 +79,12 @@ public:
 					ImGui::LabelText(name.c_str(), "%f ms", entry->mean_time / 1000.0 / 1000.0);
 				}
 			});
-			
+
+			if (m_last_frame_counts.size() > 0 && ImGui::CollapsingHeader("Counts (last frame)")) {
+				for (const auto& [name, count] : m_last_frame_counts) {
+					ImGui::LabelText(name, "%u", count);
+				}
+			}
 		}
 		ImGui::End();
 	}
@@ -116,11 +141,14 @@ protected:
 
 	// Ends the last started event
 	void end_event() {
-		double duration = (get_time() - m_current_entry->last_start_time).count();
+		add_duration((get_time() - m_current_entry->last_start_time).count());
+		m_current_entry = m_current_entry->parent.lock();
+	}
+
+	void add_duration(double duration) {
 		m_current_entry->durations[m_current_entry->circular_buffer_idx] += duration; // += so multiple calls will accumulate to a single time
 		m_current_entry->sum_time += duration;										  // note that calls from different parent functions will not accumulate this way
 		m_current_entry->mean_time = m_current_entry->sum_time / 1024.0;
-		m_current_entry = m_current_entry->parent.lock();
 	}
 
 
@@ -151,6 +179,9 @@ private:
 
 	std::map <std::string, InstrumentationEntry> m_entries;
 
+	std::unordered_map<const char*, uint32_t> m_counts;
+	std::vector<std::pair<const char*, uint32_t>> m_last_frame_counts;
+
 	Clock m_clock;
 	
 	TimeStamp start_time;
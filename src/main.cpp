@@ -5,6 +5,7 @@
 #include <filesystem>
 #include <variant>
 #include <numbers>
+#include <thread>
 
 #define WIN32_LEAN_AND_MEAN
 #include <windows.h>
@@ -31,11 +32,16 @@
 #include "renderer/shader.hpp"
 #include "renderer/material.hpp"
 #include "renderer/gltf.hpp"
+#include "renderer/cull_check.hpp"
 
 #include "renderer/vertex_buffer.hpp"
 #include "renderer/index_buffer.hpp"
 
 #include "instrumentation/instrumentor.hpp"
+#include "instrumentation/benchmarks.hpp"
+
+#include "spawn.hpp"
+#include "systems.hpp"
 
 
 void set_entity_transform(flecs::entity& e, Position translation = Position(), Rotation rotation = Rotation(), Scale scale = Scale()) {
@@ -60,8 +66,8 @@ void set_entity_transform(flecs::entity& e, Position translation = Position(), R
 
 
 float random_float(float min, float max) {
-    std::random_device rd;
-    std::default_random_engine re(rd());
+    // Seeding an engine is far more expensive than drawing from it, so only do it once per thread
+    thread_local std::default_random_engine re(std::random_device{}());
     std::uniform_real_distribution dist(min, max);
     
     return float(dist(re));
@@ -86,21 +92,44 @@ flecs::entity spawn_cube(MeshBundle& mb, Model model) {
 }
 
 
+// A few random materials, registered the first time they're needed, and shared by everything spawn_cubes() makes.
+// A material each would grow the material table with every batch.
+std::span<const MaterialHandle> random_material_palette(MeshBundle& mb) {
+    constexpr size_t palette_size = 16;
+    static std::vector<MaterialHandle> palette;
 
-void update_tree_transforms(flecs::entity e, glm::mat4 parent_transform = glm::mat4(1)) {
-    // Get entity position
+    if (palette.empty()) {
+        for (size_t i = 0; i < palette_size; i++) {
+            palette.push_back(mb.register_material({ random_vec3(0, 1), glm::vec2(random_float(.1f, .9f), random_float(.1f, .9f)) }));
+        }
+    }
 
-    glm::mat4 local_transform = e.has<TransformComponent, Local>() ? glm::mat4(*e.get<TransformComponent, Local>()) : glm::mat4(1);
-    glm::mat4 world_transform = parent_transform * local_transform;
+    return palette;
+}
 
-    e.set<TransformComponent, World>({ world_transform });
 
-    // Iterate children recursively
-    e.children([&](flecs::entity child) {
-        update_tree_transforms(child, world_transform);
-        });
+// Spawn count randomly placed entities with a given mesh, and a random material from the palette each, in one batch
+std::vector<flecs::entity_t> spawn_cubes(MeshBundle& mb, flecs::entity parent, MeshHandle mesh, size_t count, float extent = 10.0f) {
+    std::vector<TransformComponent> transforms(count);
+    std::vector<MaterialHandle> materials(count);
+
+    std::span<const MaterialHandle> palette = random_material_palette(mb);
+
+    for (size_t i = 0; i < count; i++) {
+        transforms[i] = Position(random_vec3(-extent, extent)).mat4() * Rotation(glm::quat(random_vec3(-3.14f, 3.14f))).mat4() * Scale(random_float(0.5f, 1.5f)).mat4();
+        materials[i] = palette[size_t(random_float(0, float(palette.size()))) % palette.size()];
+    }
+
+    return spawn_bulk(mb, {
+        .parent = parent,
+        .transforms = transforms,
+        .meshes = std::span(&mesh, 1),
+        .materials = materials
+    });
 }
 
+
+
 static flecs::entity selected_entity;
 
 
@@ -199,8 +228,18 @@ void draw_entity_inspector(MeshBundle& bundle, flecs::entity root, Camera& camer
 
             static bool local = false;
 
-            if (EditTransform(camera, selected_entity.get_mut<TransformComponent, World>()->transform)) {
-                selected_entity.modified<TransformComponent, World>();
+            glm::mat4 world_transform = *selected_entity.get<TransformComponent, World>();
+
+            if (EditTransform(camera, world_transform)) {
+                // Edit the local transform, so PropagateTransforms carries the change down to the children
+                flecs::entity parent = selected_entity.parent();
+                glm::mat4 parent_transform = glm::mat4(1);
+
+                if (parent && parent.has<TransformComponent, World>()) {
+                    parent_transform = *parent.get<TransformComponent, World>();
+                }
+
+                selected_entity.set<TransformComponent, Local>({ glm::inverse(parent_transform) * world_transform });
             }
 
             if (selected_entity.has<Model>()) {
@@ -219,8 +258,17 @@ void draw_entity_inspector(MeshBundle& bundle, flecs::entity root, Camera& camer
 
                 if (ImGui::ColorPicker3("Color", &light.color[0])) selected_entity.modified<Light>();
                 if(ImGui::DragFloat("Intesnsity", &light.intensity)) selected_entity.modified<Light>();
+                if (ImGui::DragFloat("Radius (0 from intensity)", &light.radius, 0.1f, 0.0f, 1000.0f)) selected_entity.modified<Light>();
 
             }
+
+            if (selected_entity.has<DirectionalLight>()) {
+                auto& light = *selected_entity.get_mut<DirectionalLight>();
+
+                ImGui::DragFloat3("Direction", &light.direction[0], 0.01f);
+                ImGui::ColorPicker3("Color", &light.color[0]);
+                ImGui::DragFloat("Intensity", &light.intensity, 0.1f, 0.0f);
+            }
         }
     }
     ImGui::End();
@@ -233,41 +281,10 @@ int main() {
     ecs = flecs::world();
 
 
-    ecs.observer<const LocalTransform>().event(flecs::OnSet | flecs::OnAdd).each(
-        [](flecs::entity e, const TransformComponent& t) {
-            // If any of these components are changed, let's update the translation matrices for all the children!!
-            auto parent = e.parent();
-            glm::mat4 parent_transform = glm::mat4(1);
-
-            if (parent && parent.has<WorldTransform>()) {
-                parent_transform = *parent.get<WorldTransform>();
-            }
-
-            e.set<TransformComponent, World>(TransformComponent(parent_transform * t.transform));
-        }
-    );
-
-    ecs.observer <const WorldTransform>().event(flecs::OnSet | flecs::OnAdd).each(
-        [](flecs::entity e, const TransformComponent& t) {
-            e.children([&](flecs::entity child) {
-                update_tree_transforms(child, t);
-            });
-        }
-    );
-
+    ecs.set_threads(std::max(std::thread::hardware_concurrency(), 1u));
 
-
-
-    ecs.observer().term<const Position>().or_().term<const Rotation>().or_().term<const Scale>().event(flecs::OnSet | flecs::OnAdd).each(
-        [](flecs::entity e) {
-            const glm::mat4 p = (e.has<Position>() ? *e.get<Position>() : Position()).mat4();
-            const glm::mat4 r = (e.has<Rotation>() ? *e.get<Rotation>() : Rotation()).mat4();
-            const glm::mat4 s = (e.has<Scale>() ? *e.get<Scale>() : Scale()).mat4();
-
-            glm::mat4 local_transform = p * r * s;
-            e.set<TransformComponent, Local>({ local_transform });
-        }
-    );
+    Phases phases = register_phases(ecs);
+    register_transform_systems(ecs, phases);
 
 
     flecs::entity root_node = ecs.entity("Root")
@@ -280,8 +297,6 @@ int main() {
     Renderer renderer;
     renderer.initialize();
     {    
-        auto gpu_driven_shader = asset_manager.GetByPath<Shader>("assets/shaders/gpu_driven.glsl");
-
         auto entity_count_shader = asset_manager.GetByPath<Shader>("assets/shaders/entity_count.glsl");
         auto build_render_comand = asset_manager.GetByPath<Shader>("assets/shaders/build_render_command.glsl");
         auto generate_per_instance_data = asset_manager.GetByPath<Shader>("assets/shaders/generate_per_instance_data.glsl");
@@ -418,12 +433,37 @@ int main() {
                 .set<Position>(glm::vec3{ -50, 50, 20 })
                 .set<Model>(big_cube_model);
 
+
+            // See through panes in front of the balls, for the transparent pass
+            auto panes = ecs.entity("Glass Panes")
+                .child_of(root_node);
+
+            set_entity_transform(panes);
+
+            for (int i = 0; i < 4; i++) {
+                MaterialHandle glass = bundle.register_material({ .diffuse_color = random_vec3(0.3f, 1), .metallic_roughness = { 0, .1f }, .blend = true, .alpha = 0.35f });
+
+                auto pane = ecs.entity(std::format("Pane {}", i).c_str())
+                    .child_of(panes)
+                    .set<Model>(Model(cube_mesh, glass));
+
+                set_entity_transform(pane, glm::vec3{ 20 + i * 3, 5, 3 + i }, Rotation(), Scale(glm::vec3{ 1.5f, 5, 0.05f }));
+            }
+
         }
 
 
        
 
 
+        // Everything's cached static shadows are drawn from here, and only the moving things redrawn each frame
+        ecs.entity("Sun")
+            .child_of(root_node)
+            .add<Scale>()
+            .add<Rotation>()
+            .set<Position>(glm::vec3(0, 50, 0))
+            .set<DirectionalLight>({ glm::vec3(-0.4f, -1.0f, -0.3f), glm::vec3(1.0f, 0.95f, 0.85f), 3.0f });
+
         auto light = ecs.entity("MainLight")
             .child_of(root_node)
             .add<Scale>()
@@ -447,6 +487,523 @@ int main() {
 
 
 
+        Benchmarks::get().add("Spawn 1M entities", [&](BenchmarkContext& ctx) {
+            constexpr size_t count = 1'000'000;
+
+            // The entities are kept around afterwards, so we can look at how the renderer copes with them
+            flecs::entity holder = ecs.entity().child_of(root_node);
+            set_entity_transform(holder);
+
+            std::vector<TransformComponent> transforms(count);
+            const MaterialHandle material = default_material;
+
+            ctx.measure("Generate transforms", [&]() {
+                for (size_t i = 0; i < count; i++) {
+                    transforms[i] = Position(random_vec3(-500, 500)).mat4();
+                }
+            });
+
+            ctx.measure("spawn_bulk", [&]() {
+                spawn_bulk(bundle, {
+                    .parent = holder,
+                    .transforms = transforms,
+                    .meshes = std::span(&cube_mesh, 1),
+                    .materials = std::span(&material, 1)
+                });
+            });
+
+            ctx.note("Entities", double(count));
+        });
+
+
+        // Runs the same frames on 1, 2, 4 and all workers. Every frame moves the roots of a forest of hierarchies,
+        // so ApplyVelocity, PropagateTransforms and the staging systems all have work to split up.
+        // RenderScene is in there too, on the main thread whatever the count.
+        // Per stage storage is sized for the thread count at startup, so that's as far as it goes.
+        Benchmarks::get().add("Frame core scaling", [&](BenchmarkContext& ctx) {
+            constexpr size_t roots = 1000;
+            constexpr size_t children = 100;
+            constexpr int frames = 20;
+            const int32_t max_threads = static_cast<int32_t>(std::max(std::thread::hardware_concurrency(), 1u));
+
+            flecs::entity holder = ecs.entity().child_of(root_node);
+            set_entity_transform(holder);
+
+            std::vector<flecs::entity> moving(roots);
+            std::vector<TransformComponent> transforms(children);
+            const MaterialHandle material = default_material;
+
+            for (flecs::entity& root : moving) {
+                Position position(random_vec3(-500, 500));
+
+                root = ecs.entity().child_of(holder);
+                set_entity_transform(root, position);
+                root.set<Position>(position);
+                root.set<Velocity>(Velocity(random_vec3(-1, 1)));
+
+                for (auto& transform : transforms) transform = Position(random_vec3(-5, 5)).mat4();
+
+                spawn_bulk(bundle, {
+                    .parent = root,
+                    .transforms = transforms,
+                    .meshes = std::span(&cube_mesh, 1),
+                    .materials = std::span(&material, 1)
+                });
+            }
+
+            std::vector<int32_t> thread_counts;
+            for (int32_t threads : { 1, 2, 4 }) {
+                if (threads < max_threads) thread_counts.push_back(threads);
+            }
+            thread_counts.push_back(max_threads);
+
+            double single_thread_ms = 0.0;
+
+            for (int32_t threads : thread_counts) {
+                ecs.set_threads(threads);
+
+                // The first frame after a change has the new workers to start, and everything to make resident
+                ecs.progress(1.0f / 60.0f);
+
+                double ms = ctx.measure(std::to_string(threads) + " threads, 20 frames", [&]() {
+                    for (int i = 0; i < frames; i++) ecs.progress(1.0f / 60.0f);
+                });
+
+                if (threads == 1) single_thread_ms = ms;
+                else ctx.note(std::to_string(threads) + " thread speedup", single_thread_ms / ms);
+            }
+
+            ecs.set_threads(max_threads);
+
+            // Kept around afterwards like the spawn benchmark's, but standing still
+            for (flecs::entity& root : moving) root.remove<Velocity>();
+
+            ctx.note("Entities", double(roots * (children + 1)));
+        });
+
+
+        Benchmarks::get().add("Spawn / despawn churn", [&](BenchmarkContext& ctx) {
+            constexpr size_t live_count = 50'000;
+            constexpr size_t churn_per_frame = 5'000;
+            constexpr int frames = 100;
+
+            flecs::entity holder = ecs.entity().child_of(root_node);
+            set_entity_transform(holder);
+
+            const MaterialHandle material = default_material;
+
+            auto spawn_batch = [&](size_t count) {
+                std::vector<TransformComponent> transforms(count);
+                for (auto& t : transforms) t = Position(random_vec3(-100, 100)).mat4();
+
+                return spawn_bulk(bundle, {
+                    .parent = holder,
+                    .transforms = transforms,
+                    .meshes = std::span(&cube_mesh, 1),
+                    .materials = std::span(&material, 1)
+                });
+            };
+
+            std::vector<flecs::entity_t> live = spawn_batch(live_count);
+            ecs.progress(0.0f);
+
+            size_t resident_before = bundle.get_resident_entity_count();
+
+            // Every frame, a random set of entities is destroyed and the same number spawned,
+            // so the live count stays constant while slots keep being freed and refilled
+            ctx.measure("100 frames", [&]() {
+                for (int frame = 0; frame < frames; frame++) {
+                    ecs.defer_begin();
+                    for (size_t i = 0; i < churn_per_frame; i++) {
+                        size_t idx = size_t(random_float(0, float(live.size() - 1)));
+                        ecs_delete(ecs.c_ptr(), live[idx]);
+                        live[idx] = live.back();
+                        live.pop_back();
+                    }
+                    ecs.defer_end();
+
+                    std::vector<flecs::entity_t> spawned = spawn_batch(churn_per_frame);
+                    live.insert(live.end(), spawned.begin(), spawned.end());
+
+                    ecs.progress(0.0f);
+                }
+            });
+
+            ctx.note("Churn per frame", double(churn_per_frame));
+            ctx.note("Resident entities before", double(resident_before));
+            ctx.note("Resident entities after", double(bundle.get_resident_entity_count()));
+
+            holder.destruct();
+        });
+
+
+        Benchmarks::get().add("TLSF allocator churn", [&](BenchmarkContext& ctx) {
+            constexpr size_t live_count = 100'000;
+            constexpr size_t churn_count = 1'000'000;
+
+            TLSFAllocator allocator(size_t(1) << 30);
+            std::vector<HeapAllocation> live(live_count);
+
+            // Mesh-like sizes, from a few hundred bytes to a few megabytes
+            auto random_size = []() { return size_t(std::exp2(random_float(8, 22))); };
+
+            ctx.measure("Fill", [&]() {
+                for (auto& a : live) a = allocator.allocate(random_size(), 64);
+            });
+
+            size_t failed = 0;
+            ctx.measure("Free + allocate", [&]() {
+                for (size_t i = 0; i < churn_count; i++) {
+                    HeapAllocation& a = live[size_t(random_float(0, float(live_count - 1)))];
+                    if (a) allocator.free(a);
+
+                    a = allocator.allocate(random_size(), 64);
+                    failed += !a;
+                }
+            });
+
+            HeapStats stats = allocator.stats();
+            ctx.note("Failed allocations", double(failed));
+            ctx.note("Used", double(stats.used) / (1024 * 1024), "MB");
+            ctx.note("Free blocks", double(stats.free_blocks));
+            ctx.note("Fragmentation", stats.fragmentation() * 100.0, "%");
+        });
+
+
+        Benchmarks::get().add("BVH 1M leaves", [&](BenchmarkContext& ctx) {
+            constexpr size_t count = 1'000'000;
+
+            std::vector<AABB> bounds(count);
+            for (auto& b : bounds) {
+                glm::vec3 center = random_vec3(-500, 500);
+                b = { center - glm::vec3(0.5f), center + glm::vec3(0.5f) };
+            }
+
+            BVH bvh;
+            std::vector<BVH::NodeID> leaves(count);
+
+            ctx.measure("Insert", [&]() {
+                for (size_t i = 0; i < count; i++) leaves[i] = bvh.insert(bounds[i], i);
+            });
+
+            ctx.note("Height", double(bvh.height()));
+            ctx.note("Area ratio", bvh.area_ratio());
+
+            // Small moves stay inside the fat bounds, big ones force a re-insert
+            size_t reinserted = 0;
+            ctx.measure("Refit (small moves)", [&]() {
+                for (size_t i = 0; i < count; i++) {
+                    glm::vec3 offset = glm::vec3(0.05f);
+                    reinserted += bvh.move(leaves[i], { bounds[i].min + offset, bounds[i].max + offset });
+                }
+            });
+            ctx.note("Re-inserted", double(reinserted));
+
+            ctx.measure("Refit (10% teleported)", [&]() {
+                for (size_t i = 0; i < count; i += 10) {
+                    glm::vec3 center = random_vec3(-500, 500);
+                    bvh.move(leaves[i], { center - glm::vec3(0.5f), center + glm::vec3(0.5f) });
+                }
+            });
+
+            size_t visible = 0;
+            ctx.measure("Frustum query", [&]() {
+                bvh.query_frustum(Frustum::from_matrix(c.projection() * c.view()), [&](uint64_t) { visible++; });
+            });
+            ctx.note("Visible", double(visible));
+
+            size_t overlapping = 0;
+            ctx.measure("1000 sphere queries", [&]() {
+                for (int i = 0; i < 1000; i++) {
+                    bvh.query_sphere({ random_vec3(-500, 500), 10.0f }, [&](uint64_t) { overlapping++; });
+                }
+            });
+            ctx.note("Sphere overlaps", double(overlapping));
+
+            size_t hits = 0;
+            ctx.measure("1000 raycasts", [&]() {
+                uint64_t hit_user_data;
+                float hit_t;
+
+                for (int i = 0; i < 1000; i++) {
+                    Ray ray = { random_vec3(-500, 500), glm::normalize(random_vec3(-1, 1)) };
+                    hits += bvh.raycast(ray, 1000.0f, hit_user_data, hit_t);
+                }
+            });
+            ctx.note("Ray hits", double(hits));
+        });
+
+
+        Benchmarks::get().add("Frustum cull 1M spheres (CPU reference)", [&](BenchmarkContext& ctx) {
+            constexpr size_t count = 1'000'000;
+
+            std::vector<glm::mat4> models(count);
+            for (auto& model : models) {
+                glm::vec3 axis = glm::normalize(random_vec3(-1, 1) + glm::vec3(0, 0.001f, 0));
+                model = glm::translate(glm::mat4(1), random_vec3(-500, 500))
+                    * glm::rotate(glm::mat4(1), random_float(0, 6.28f), axis)
+                    * glm::scale(glm::mat4(1), random_vec3(0.5f, 4.0f));
+            }
+
+            const glm::mat4 view = c.view();
+            const CullData cull = CullData::from_projection(c.projection(), c.near_clip, c.far_clip);
+            constexpr float radius = 1.0f;
+
+            std::vector<uint8_t> visible(count);
+            ctx.measure("sphere_visible", [&]() {
+                for (size_t i = 0; i < count; i++) visible[i] = sphere_visible(cull, view, models[i], radius);
+            });
+
+            size_t visible_count = std::count(visible.begin(), visible.end(), 1);
+            ctx.note("Visible", double(visible_count));
+
+            // The same again, dropping anything under a pixel across at 1080p
+            const CullData cull_small = CullData::from_projection(c.projection(), c.near_clip, c.far_clip, 1080.0f, 1.0f);
+            size_t too_small = 0;
+
+            ctx.measure("sphere_cull, 1 pixel", [&]() {
+                for (size_t i = 0; i < count; i++) too_small += sphere_cull(cull_small, view, models[i], radius, cull_small.min_pixels) == CullResult::Contribution;
+            });
+
+            ctx.note("Contribution culled", double(too_small));
+
+            // The exact test against all six world space planes should agree, bar spheres right on an edge
+            Frustum frustum = Frustum::from_matrix(c.projection() * view);
+            size_t disagreements = 0;
+
+            for (size_t i = 0; i < count; i++) {
+                const glm::mat4& m = models[i];
+                float scale = std::sqrt(std::max({ glm::dot(glm::vec3(m[0]), glm::vec3(m[0])), glm::dot(glm::vec3(m[1]), glm::vec3(m[1])), glm::dot(glm::vec3(m[2]), glm::vec3(m[2])) }));
+
+                disagreements += frustum.overlaps(Sphere{ glm::vec3(m[3]), radius * scale }) != bool(visible[i]);
+            }
+
+            ctx.note("Disagree with Frustum::overlaps", double(disagreements));
+
+            // And with culling.glsl itself, run over the same spheres on the GPU. This one should be exact.
+            std::vector<uint32_t> gpu_visible = gpu_sphere_visible(cull, view, models, radius);
+            size_t gpu_disagreements = 0;
+
+            for (size_t i = 0; i < count; i++) gpu_disagreements += gpu_visible[i] != visible[i];
+
+            ctx.note("Disagree with the GPU", double(gpu_disagreements));
+        });
+
+
+        // Draws the current scene with Hi-Z occlusion culling off and then on, and compares the triangles drawn.
+        // Only the GPU driven backend does occlusion culling. Look at the boombox grid through the Big Box to see it do something.
+        // Each draw is a frame of its own, flushed first like the RenderScene system does. glFinish makes it the whole frame, GPU included.
+        Benchmarks::get().add("Occlusion culling", [&](BenchmarkContext& ctx) {
+            constexpr int frames = 20;
+            const bool original_occlusion = bundle.get_occlusion_culling();
+            const RenderBackend original_backend = bundle.get_backend();
+
+            bundle.set_backend(RenderBackend::GPU);
+
+            auto frame = [&]() {
+                bundle.flush_uploads();
+                bundle.draw(c);
+            };
+
+            auto run_frames = [&](bool occlusion) {
+                bundle.set_occlusion_culling(occlusion);
+
+                // The early pass goes on what was visible last frame, so give it one to go on
+                frame();
+                glFinish();
+
+                ctx.measure(occlusion ? "Occlusion culled, 20 frames" : "Frustum culled, 20 frames", [&]() {
+                    for (int i = 0; i < frames; i++) frame();
+                    glFinish();
+                });
+
+                return bundle.read_rendered_tri_count();
+            };
+
+            uint64_t frustum_triangles = run_frames(false);
+            uint64_t occlusion_triangles = run_frames(true);
+
+            bundle.set_occlusion_culling(original_occlusion);
+            bundle.set_backend(original_backend);
+
+            ctx.note("Triangles, frustum culled", double(frustum_triangles));
+            ctx.note("Triangles, occlusion culled", double(occlusion_triangles));
+            ctx.note("Triangles cut", frustum_triangles > 0 ? 100.0 * (1.0 - double(occlusion_triangles) / double(frustum_triangles)) : 0.0, "%");
+        });
+
+
+        // The transparent pass's back to front sort, on its own and against std::sort, then the whole of
+        // culling, sorting and building draws for as many blended entities
+        Benchmarks::get().add("Transparent sort 100k instances", [&](BenchmarkContext& ctx) {
+            constexpr size_t count = 100'000;
+            WorkerPool pool;
+
+            std::vector<uint32_t> unsorted_keys(count);
+            for (auto& key : unsorted_keys) key = TransparentDrawBuilder::depth_key(random_float(0, 1000));
+
+            std::vector<uint32_t> keys = unsorted_keys;
+            std::vector<uint32_t> values(count);
+            for (uint32_t i = 0; i < count; i++) values[i] = i;
+
+            RadixSort<uint32_t, uint32_t> radix_sort;
+            ctx.measure("Radix sort", [&]() { radix_sort.sort(pool, keys, values); });
+
+            std::vector<uint32_t> reference = unsorted_keys;
+            ctx.measure("std::sort", [&]() { std::sort(reference.begin(), reference.end()); });
+
+            bool values_follow = true;
+            for (size_t i = 0; i < count; i++) values_follow &= unsorted_keys[values[i]] == keys[i];
+
+            ctx.note("Matches std::sort", double(keys == reference && values_follow));
+            ctx.note("Passes", double(radix_sort.passes()));
+            ctx.note("Threads", double(pool.size()));
+
+            // A handful of meshes, spread around the camera
+            std::vector<GPUMesh> meshes(8);
+            for (uint32_t i = 0; i < meshes.size(); i++) meshes[i] = { .num_vertices = 36, .first_idx = 0, .base_vertex = 0, .bounding_sphere = 1.0f, .min_pixels = 0.0f };
+
+            std::vector<glm::mat4> transforms(count);
+            std::vector<GPUEntity> entities(count);
+
+            for (uint32_t i = 0; i < count; i++) {
+                transforms[i] = glm::translate(glm::mat4(1), c.position + random_vec3(-200, 200));
+                entities[i] = { .mesh_idx = i % 8, .material_idx = 0, .transform_idx = i };
+            }
+
+            const CullData cull = CullData::from_projection(c.projection(), c.near_clip, c.far_clip, 1080.0f, 0.0f);
+            TransparentDrawBuilder builder;
+
+            ctx.measure("Cull, sort and build", [&]() { builder.build(pool, cull, c.view(), entities, transforms, meshes); });
+
+            const TransparentDrawBuilder::Stats& stats = builder.stats();
+            ctx.note("Visible", double(stats.visible));
+            ctx.note("Commands", double(stats.commands));
+            ctx.note("Sort (of the above)", stats.sort_ms, "ms");
+        });
+
+
+        // Draws the current scene a few times with each backend. glFinish makes it the whole frame, GPU included.
+        // Each draw is a frame of its own, flushed first like the RenderScene system does, so the upload ring moves on
+        // rather than every draw's commands piling up in one frame's region and growing it.
+        // Spawn 1M entities first for something worth measuring.
+        Benchmarks::get().add("CPU vs GPU draw building", [&](BenchmarkContext& ctx) {
+            constexpr int frames = 20;
+            const RenderBackend original_backend = bundle.get_backend();
+
+            auto frame = [&]() {
+                bundle.flush_uploads();
+                bundle.draw(c);
+            };
+
+            auto run_frames = [&](RenderBackend backend) {
+                bundle.set_backend(backend);
+                frame();
+                glFinish();
+
+                return ctx.measure(backend == RenderBackend::GPU ? "GPU driven, 20 frames" : "CPU, 20 frames", [&]() {
+                    for (int i = 0; i < frames; i++) frame();
+                    glFinish();
+                });
+            };
+
+            double gpu_ms = run_frames(RenderBackend::GPU);
+            double cpu_ms = run_frames(RenderBackend::CPU);
+
+            bundle.set_backend(original_backend);
+
+            const CPUDrawBuilder::Stats& stats = bundle.get_cpu_draw_stats();
+            ctx.note("Entities", double(stats.tested));
+            ctx.note("Visible", double(stats.visible));
+            ctx.note("Commands", double(stats.commands));
+            ctx.note("CPU cull + build (last frame)", stats.ms, "ms");
+            ctx.note("CPU key sort (of the above)", stats.sort_ms, "ms");
+            ctx.note("CPU / GPU frame time", cpu_ms / gpu_ms);
+        });
+
+
+        // The CPU reference binner on the scene's visible lights, checked against the lists the GPU built for the same frame
+        // (with Clustered Lighting on), then compacting and binning a lot more lights
+        Benchmarks::get().add("Light clusters", [&](BenchmarkContext& ctx) {
+            WorkerPool pool;
+
+            bundle.flush_uploads();
+            bundle.draw(c);
+            glFinish();
+
+            std::vector<uint32_t> gpu_lists = bundle.read_light_clusters();
+            LightClusterBinner binner;
+
+            ctx.measure("CPU binner, scene lights", [&]() { binner.build(pool, bundle.get_cluster_grid(), c.view(), bundle.get_visible_lights().spheres()); });
+
+            // Past a list's count is whatever was there before
+            std::span<const uint32_t> cpu_lists = binner.lists();
+            size_t mismatched = 0;
+
+            for (size_t list = 0; list < cpu_lists.size(); list += ClusterGrid::stride) {
+                mismatched += !std::equal(&cpu_lists[list], &cpu_lists[list] + 1 + cpu_lists[list], &gpu_lists[list]);
+            }
+
+            const LightClusterBinner::Stats& stats = binner.stats();
+            ctx.note("Lights", double(stats.lights));
+            ctx.note("Clusters differing from the GPU", double(mismatched));
+            ctx.note("Lights per cluster", double(stats.references) / ClusterGrid::cluster_count);
+            ctx.note("Most in a cluster", double(stats.max_per_cluster));
+
+            // Scattered around the camera, most of them small
+            std::vector<Light::Packed> many(16384);
+            for (auto& light : many) light = { c.position + random_vec3(-200, 200), Light::radius_sq(random_float(1, 100)) };
+
+            const CullData cull = CullData::from_projection(c.projection(), c.near_clip, c.far_clip);
+            VisibleLights visible;
+
+            ctx.measure("Compact visible, 16k lights", [&]() { visible.build(pool, cull, c.view(), many); });
+            ctx.note("16k visible", double(visible.stats().visible));
+
+            ctx.measure("CPU binner, 16k lights", [&]() { binner.build(pool, bundle.get_cluster_grid(), c.view(), visible.spheres()); });
+
+            ctx.note("16k lights per cluster", double(binner.stats().references) / ClusterGrid::cluster_count);
+            ctx.note("16k overflowed clusters", double(binner.stats().overflowed));
+        });
+
+
+        // The same frames shaded forward, then deferred, each flushed first like in the CPU vs GPU benchmark.
+        // The opaque pass's GPU time is the last frame's, waited for after the glFinish, so it's the mode just measured.
+        Benchmarks::get().add("Forward vs deferred shading", [&](BenchmarkContext& ctx) {
+            constexpr int frames = 20;
+            const bool original_deferred = bundle.get_deferred();
+
+            auto frame = [&]() {
+                bundle.flush_uploads();
+                bundle.draw(c);
+            };
+
+            auto run_frames = [&](bool deferred) {
+                bundle.set_deferred(deferred);
+                frame();
+                glFinish();
+
+                double ms = ctx.measure(deferred ? "Deferred, 20 frames" : "Forward, 20 frames", [&]() {
+                    for (int i = 0; i < frames; i++) frame();
+                    glFinish();
+                });
+
+                ctx.note(deferred ? "Deferred opaque pass (GPU)" : "Forward opaque pass (GPU)", bundle.read_opaque_gpu_ms(), "ms");
+                return ms;
+            };
+
+            double forward_ms = run_frames(false);
+            double deferred_ms = run_frames(true);
+
+            bundle.set_deferred(original_deferred);
+
+            ctx.note("Visible lights", double(bundle.get_visible_lights().stats().visible));
+            ctx.note("Deferred / forward frame time", deferred_ms / forward_ms);
+        });
+
+
+        bundle.register_systems(phases, c);
+
+
         while (!glfwWindowShouldClose(renderer.get_platform_window())) {
             Instrumentor::get().new_frame();
             PROFILE_SCOPE("Render Loop");
@@ -506,6 +1063,31 @@ int main() {
 
             glm::mat4 vp = c.projection() * c.view();
 
+
+            // Right click picks whatever is under the cursor
+            static bool last_pick_button = false;
+            bool pick_button = glfwGetMouseButton(renderer.get_platform_window(), GLFW_MOUSE_BUTTON_2);
+
+            if (pick_button && !last_pick_button && !ImGui::GetIO().WantCaptureMouse) {
+                glm::vec2 ndc = {
+                    float(mouse_pos.x / renderer.get_window_width()) * 2.0f - 1.0f,
+                    1.0f - float(mouse_pos.y / renderer.get_window_height()) * 2.0f
+                };
+
+                glm::mat4 inverse_vp = glm::inverse(vp);
+                glm::vec4 near_point = inverse_vp * glm::vec4(ndc, -1, 1);
+                glm::vec4 far_point = inverse_vp * glm::vec4(ndc, 1, 1);
+
+                glm::vec3 origin = glm::vec3(near_point) / near_point.w;
+                glm::vec3 direction = glm::vec3(far_point) / far_point.w - origin;
+
+                if (flecs::entity picked = bundle.pick({ origin, direction })) {
+                    selected_entity = picked;
+                }
+            }
+
+            last_pick_button = pick_button;
+
             
                 //Instrumentor::InstrumentationEvent e("Render Loop");
                 
@@ -544,18 +1126,19 @@ int main() {
 
 
                 if (ImGui::Button("Spawn Joker")) {
-                    for (int i = 0; i < 1000; i++)
-                        spawn_cube(bundle, joker_mesh);
+                    spawn_cubes(bundle, root_node, joker_mesh, 1000);
                 }
 
 
                 ImGui::End();
 
 
-                bundle.render(c);
+                // Runs every phase, from Simulate through to Render
+                ecs.progress(static_cast<float>(delta_time));
 
 
                 Instrumentor::get().show_profiler();
+                Benchmarks::get().show_window();
                 renderer.end_frame();
 
 
@@ -0,0 +1,115 @@
+#pragma once
+
+#include <cstdint>
+#include <cassert>
+#include <string>
+#include <vector>
+
+#include "glad/gl.h"
+
+#include "util.hpp"
+#include "buffer.hpp"
+#include "shader.hpp"
+
+// Gives each named buffer block a fixed binding point, shared by every program that uses it.
+// Programs resolve their block indices once when linked, so binding never needs a name lookup,
+// and bind() only issues GL calls for programs which have been (re)linked and buffers which have
+// been reallocated since the last call. Which makes it cheap enough to call every frame.
+//
+// The table owns binding points [0, n) of each target it uses, so nothing else should bind there.
+// Passes which bind buffers of their own every time they run use storage points from reserved_storage_begin up.
+class BindingTable {
+public:
+	// Never handed out by the table. Shaders which use these points must match.
+	static constexpr uint32_t reserved_storage_begin = 24;
+
+	// Binding points are handed out in the order blocks are added
+	uint32_t add_storage(const std::string& name, Buffer* buffer) {
+		assert(m_storage_count < reserved_storage_begin);
+		return add_block(name, GL_SHADER_STORAGE_BUFFER, m_storage_count++, buffer);
+	}
+
+	uint32_t add_uniform(const std::string& name, Buffer* buffer) {
+		return add_block(name, GL_UNIFORM_BUFFER, m_uniform_count++, buffer);
+	}
+
+	void add_program(Ref<Shader> shader) {
+		m_programs.push_back({ shader });
+	}
+
+	void bind() {
+		m_last_bind_calls = 0;
+
+		for (auto& block : m_blocks) {
+			Buffer& buffer = *block.buffer;
+
+			if (block.bound_generation == buffer.generation()) continue;
+
+			buffer.bind(block.target, block.binding);
+			block.bound_generation = buffer.generation();
+			m_last_bind_calls++;
+		}
+
+		for (auto& program : m_programs) {
+			Shader& shader = *program.shader;
+
+			// Otherwise a pending hot reload would only happen when the program is next used, after this
+			shader.reload_if_needed();
+
+			if (program.generation == shader.get_generation()) continue;
+
+			for (const auto& block : m_blocks) {
+				if (block.target == GL_SHADER_STORAGE_BUFFER) {
+					uint32_t index = shader.storage_block_index(block.name);
+					if (index == GL_INVALID_INDEX) continue;
+
+					glShaderStorageBlockBinding(shader.get_id(), index, block.binding);
+				}
+				else {
+					uint32_t index = shader.uniform_block_index(block.name);
+					if (index == GL_INVALID_INDEX) continue;
+
+					glUniformBlockBinding(shader.get_id(), index, block.binding);
+				}
+
+				m_last_bind_calls++;
+			}
+
+			program.generation = shader.get_generation();
+		}
+
+		GL_ERROR_CHECK();
+	}
+
+	// GL calls made by the last bind(), which should be 0 most frames
+	uint32_t last_bind_calls() const { return m_last_bind_calls; }
+
+private:
+	struct Block {
+		std::string name;
+		GLenum target;
+		uint32_t binding;
+		Buffer* buffer;
+
+		// What was bound last time, to tell if it needs doing again
+		uint32_t bound_generation = UINT32_MAX;
+	};
+
+	struct Program {
+		Ref<Shader> shader;
+		uint32_t generation = UINT32_MAX;
+	};
+
+	uint32_t add_block(const std::string& name, GLenum target, uint32_t binding, Buffer* buffer) {
+		m_blocks.push_back({ name, target, binding, buffer });
+		return binding;
+	}
+
+	std::vector<Block> m_blocks;
+	std::vector<Program> m_programs;
+
+	uint32_t m_storage_count = 0;
+	uint32_t m_uniform_count = 0;
+
+	uint32_t m_last_bind_calls = 0;
+};
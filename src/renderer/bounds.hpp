@@ -0,0 +1,145 @@
+#pragma once
+
+#include <cfloat>
+#include <algorithm>
+
+#include "glm.hpp"
+
+// Bounding volumes, and the intersection tests between them.
+// These are shared by the BVH, culling and picking.
+
+
+struct AABB {
+	glm::vec3 min = glm::vec3(FLT_MAX);
+	glm::vec3 max = glm::vec3(-FLT_MAX);
+
+	static AABB merge(const AABB& a, const AABB& b) {
+		return { glm::min(a.min, b.min), glm::max(a.max, b.max) };
+	}
+
+	// Transform a local space AABB, and return the AABB around the result (Arvo's method)
+	static AABB transform(const AABB& local, const glm::mat4& m) {
+		AABB result = { glm::vec3(m[3]), glm::vec3(m[3]) };
+
+		for (int i = 0; i < 3; i++) {
+			glm::vec3 a = glm::vec3(m[i]) * local.min[i];
+			glm::vec3 b = glm::vec3(m[i]) * local.max[i];
+
+			result.min += glm::min(a, b);
+			result.max += glm::max(a, b);
+		}
+
+		return result;
+	}
+
+	AABB fattened(float margin) const {
+		return { min - glm::vec3(margin), max + glm::vec3(margin) };
+	}
+
+	bool contains(const AABB& other) const {
+		return glm::all(glm::lessThanEqual(min, other.min)) && glm::all(glm::greaterThanEqual(max, other.max));
+	}
+
+	bool overlaps(const AABB& other) const {
+		return glm::all(glm::lessThanEqual(min, other.max)) && glm::all(glm::greaterThanEqual(max, other.min));
+	}
+
+	glm::vec3 center() const { return (min + max) * 0.5f; }
+	glm::vec3 extent() const { return (max - min) * 0.5f; }
+
+	float surface_area() const {
+		glm::vec3 d = max - min;
+		return 2.0f * (d.x * d.y + d.y * d.z + d.z * d.x);
+	}
+};
+
+
+struct Sphere {
+	glm::vec3 center;
+	float radius;
+
+	bool overlaps(const AABB& aabb) const {
+		glm::vec3 closest = glm::clamp(center, aabb.min, aabb.max);
+		glm::vec3 d = closest - center;
+		return glm::dot(d, d) <= radius * radius;
+	}
+};
+
+
+struct Ray {
+	glm::vec3 origin;
+	glm::vec3 direction;
+
+	// Slab test. Returns the distance along the ray to the box, or FLT_MAX for a miss.
+	// inv_direction is passed in so it can be computed once per query.
+	static float intersect(const glm::vec3& origin, const glm::vec3& inv_direction, const AABB& aabb, float max_t) {
+		glm::vec3 t0 = (aabb.min - origin) * inv_direction;
+		glm::vec3 t1 = (aabb.max - origin) * inv_direction;
+
+		glm::vec3 t_near = glm::min(t0, t1);
+		glm::vec3 t_far = glm::max(t0, t1);
+
+		float t_enter = std::max(std::max(t_near.x, t_near.y), std::max(t_near.z, 0.0f));
+		float t_exit = std::min(std::min(t_far.x, t_far.y), std::min(t_far.z, max_t));
+
+		return t_enter <= t_exit ? t_enter : FLT_MAX;
+	}
+};
+
+
+enum class Containment : uint8_t {
+	Outside,
+	Intersecting,
+	Inside
+};
+
+
+// Six normalized planes, pointing inwards: left, right, bottom, top, near, far
+struct Frustum {
+	glm::vec4 planes[6];
+
+	// Gribb-Hartmann plane extraction from a view projection matrix (GL clip space)
+	static Frustum from_matrix(const glm::mat4& vp) {
+		glm::mat4 t = glm::transpose(vp);
+		Frustum f;
+
+		f.planes[0] = t[3] + t[0];
+		f.planes[1] = t[3] - t[0];
+		f.planes[2] = t[3] + t[1];
+		f.planes[3] = t[3] - t[1];
+		f.planes[4] = t[3] + t[2];
+		f.planes[5] = t[3] - t[2];
+
+		for (auto& plane : f.planes) {
+			plane /= glm::length(glm::vec3(plane));
+		}
+
+		return f;
+	}
+
+	Containment test(const AABB& aabb) const {
+		glm::vec3 center = aabb.center();
+		glm::vec3 extent = aabb.extent();
+
+		Containment result = Containment::Inside;
+
+		for (const auto& plane : planes) {
+			glm::vec3 n = glm::vec3(plane);
+			float d = glm::dot(n, center) + plane.w;
+			float r = glm::dot(glm::abs(n), extent);
+
+			if (d < -r) return Containment::Outside;
+			if (d < r) result = Containment::Intersecting;
+		}
+
+		return result;
+	}
+
+	bool overlaps(const Sphere& sphere) const {
+		for (const auto& plane : planes) {
+			if (glm::dot(glm::vec3(plane), sphere.center) + plane.w < -sphere.radius) return false;
+		}
+
+		return true;
+	}
+};
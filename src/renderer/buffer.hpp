@@ -1,7 +1,12 @@
 #pragma once
 
 #include <cstdint>
+#include <cstring>
+#include <cassert>
 #include <iostream>
+#include <vector>
+#include <span>
+#include <algorithm>
 
 #include "glad/gl.h"
 
@@ -35,9 +40,19 @@ private:
 };
 
 
+// GL upload traffic from every Buffer, counted per frame
+struct BufferUploadStats {
+	uint32_t calls = 0;				// glNamedBufferSubData / glCopyNamedBufferSubData calls
+	size_t bytes = 0;
+	uint32_t dirty_ranges = 0;		// Ranges recorded by shadowed buffers...
+	uint32_t merged_ranges = 0;		// ...and what they were merged into when flushed
+};
+
+
 class Buffer {
 public:
-	Buffer(BufferUsage usage=BufferUsage::STATIC) : m_usage(usage) {
+	// With a page size, the storage is immutable and grows in whole pages, rather than doubling
+	Buffer(BufferUsage usage=BufferUsage::STATIC, size_t page_size=0) : m_usage(usage), m_page_size(page_size) {
 		glCreateBuffers(1, &m_gl_id);
 
 		std::cerr << "Allocated Buffer " << m_gl_id << "\n";
@@ -66,11 +81,16 @@ public:
 
 	// This will clear the buffer, and reallocate it to 1K
 	void clear(size_t size=1024) {
+		m_shadow.clear();
+		m_dirty_ranges.clear();
+		m_size = 0;
+
 		glDeleteBuffers(1, &m_gl_id);
 		m_gl_id = 0;
 		glCreateBuffers(1, &m_gl_id);
-		glNamedBufferData(m_gl_id, size, nullptr, m_usage);
+		allocate_storage(m_gl_id, size);
 		m_reserved_size = size;
+		m_generation++;
 	}
 
 
@@ -78,18 +98,27 @@ public:
 		if (m_reserved_size < size) {
 			std::cerr << "Resize buffer " << m_gl_id << ": " << m_reserved_size << " -> " << size << "\n";
 
-			if (m_size != 0) {
-				// We need to make a copy if we already have some data
+			if (m_size != 0 && m_reserved_size != 0) {
+				// We need to make a copy if we already have some data.
+				// A shadowed buffer's size can run ahead of what's on the GPU, so only copy what fits.
 				uint32_t new_buffer = 0;
 				glCreateBuffers(1, &new_buffer);
-				glNamedBufferData(new_buffer, size, 0, m_usage);
-				glCopyNamedBufferSubData(m_gl_id, new_buffer, 0, 0, m_size);
+				allocate_storage(new_buffer, size);
+				glCopyNamedBufferSubData(m_gl_id, new_buffer, 0, 0, std::min(m_size, m_reserved_size));
 				glDeleteBuffers(1, &m_gl_id);
 				m_gl_id = new_buffer;
+				m_generation++;
+			}
+			else if (m_page_size != 0 && m_reserved_size != 0) {
+				// Immutable storage can't be respecified, so it always needs a new buffer
+				glDeleteBuffers(1, &m_gl_id);
+				glCreateBuffers(1, &m_gl_id);
+				allocate_storage(m_gl_id, size);
+				m_generation++;
 			}
 			else {
 				//Otherwise, just set the size
-				glNamedBufferData(m_gl_id, size, 0, m_usage);
+				allocate_storage(m_gl_id, size);
 				GL_ERROR_CHECK();
 			}
 
@@ -98,42 +127,64 @@ public:
 	}
 
 	void set_data(const void* data, size_t size) {
-		if (size > m_reserved_size) {
-			uint32_t new_size = m_reserved_size || 1;
-
-			while (new_size < size) {
-				new_size *= 2;
-			}
+		m_size = size;
 
-			resize(new_size);
+		if (m_shadowed) {
+			// Replacing everything, so nothing past the new end is kept
+			m_shadow.resize(size);
+			write_shadow(data, 0, size);
+			return;
 		}
 
+		grow_to(size);
+
 		glNamedBufferSubData(m_gl_id, 0, size, data);
+		count_upload(size);
 		GL_ERROR_CHECK();
-
-		m_size = size;
 	}
 
 	void set_subdata(const void* data, size_t offset, size_t size) {
 		size_t min_size = offset + size;
 
-		if (min_size > m_reserved_size) {
-			uint32_t new_size = m_reserved_size || 1;
-
-			while (new_size < min_size) {
-				new_size *= 2;
-			}
-
-			resize(new_size);
+		if (m_shadowed) {
+			if (min_size > m_size) m_size = min_size;
+			write_shadow(data, offset, size);
+			return;
 		}
 
+		grow_to(min_size);
+
 		glNamedBufferSubData(m_gl_id, offset, size, data);
+		count_upload(size);
 
 		if (min_size > m_size) m_size = min_size;
 		GL_ERROR_CHECK();
 
 	}
 
+	// Copy size bytes from another GL buffer into this one, growing it if needed
+	void copy_subdata(uint32_t src_buffer, size_t src_offset, size_t offset, size_t size) {
+		// The shadow would go stale, as the data never passes through the CPU
+		assert(!m_shadowed);
+
+		size_t min_size = offset + size;
+
+		grow_to(min_size);
+
+		glCopyNamedBufferSubData(src_buffer, m_gl_id, src_offset, offset, size);
+		count_upload(size);
+
+		if (min_size > m_size) m_size = min_size;
+		GL_ERROR_CHECK();
+	}
+
+	// Append size bytes copied from another GL buffer, and return the offset they were placed at
+	size_t extend_copy(uint32_t src_buffer, size_t src_offset, size_t size) {
+		size_t offset = m_size;
+		copy_subdata(src_buffer, src_offset, offset, size);
+		return offset;
+	}
+
 	void bind(uint32_t bind_point) {
 		glBindBuffer(bind_point, m_gl_id);
 		GL_ERROR_CHECK();
@@ -144,6 +195,15 @@ public:
 		GL_ERROR_CHECK();
 	}
 
+	// Set the number of bytes in use, growing the GL buffer if needed.
+	// Shrinking only forgets the tail, the storage is kept.
+	void set_size(size_t size) {
+		if (m_shadowed) m_shadow.resize(size);
+		else grow_to(size);
+
+		m_size = size;
+	}
+
 	// Append some data to a buffer!
 	size_t extend(const void* data, size_t len) {
 		size_t offset = m_size;
@@ -176,12 +236,154 @@ public:
 		set_subdata(&val, offset, sizeof(T));
 	}
 
+	// Keep a CPU copy of the contents. Writes then only touch the copy and record a dirty range,
+	// and nothing reaches the GPU until flush(), which merges ranges less than merge_gap bytes apart.
+	void enable_shadow(size_t merge_gap = 256) {
+		m_shadowed = true;
+		m_merge_gap = merge_gap;
+
+		m_shadow.resize(m_size);
+		if (m_size > 0) glGetNamedBufferSubData(m_gl_id, 0, m_size, m_shadow.data());
+	}
+
+	// Upload the dirty ranges of a shadowed buffer, in as few calls as the merge gap allows.
+	// Returns true if the GL buffer was reallocated, so it needs binding again.
+	bool flush() {
+		if (m_dirty_ranges.empty()) return false;
+
+		uint32_t old_id = m_gl_id;
+
+		grow_to(m_size);
+
+		// Anything past the end may have been dropped by set_size() since it was written
+		for (auto& [range_begin, range_end] : m_dirty_ranges) {
+			range_end = std::min(range_end, m_shadow.size());
+		}
+
+		std::erase_if(m_dirty_ranges, [](const auto& range) { return range.first >= range.second; });
+		if (m_dirty_ranges.empty()) return m_gl_id != old_id;
+
+		std::sort(m_dirty_ranges.begin(), m_dirty_ranges.end());
+
+		auto upload = [this](size_t begin, size_t end) {
+			glNamedBufferSubData(m_gl_id, begin, end - begin, m_shadow.data() + begin);
+			count_upload(end - begin);
+			s_frame_stats.merged_ranges++;
+		};
+
+		// Anything this close together is cheaper to upload as one, gap included
+		auto [begin, end] = m_dirty_ranges[0];
+
+		for (const auto& [next_begin, next_end] : m_dirty_ranges) {
+			if (next_begin <= end + m_merge_gap) {
+				end = std::max(end, next_end);
+			}
+			else {
+				upload(begin, end);
+				begin = next_begin;
+				end = next_end;
+			}
+		}
+
+		upload(begin, end);
+		m_dirty_ranges.clear();
+
+		GL_ERROR_CHECK();
+
+		return m_gl_id != old_id;
+	}
+
 	uint32_t get_id() { return m_gl_id; }
 
+	// Bumped whenever the GL buffer is swapped for a new one, so anything bound to the old one is stale
+	uint32_t generation() const { return m_generation; }
+
+	// Number of bytes used in the buffer
+	size_t size() const { return m_size; }
+
+	// The CPU copy of a shadowed buffer, which can be ahead of the GPU until it's flushed
+	template <typename T>
+	std::span<const T> shadow() const {
+		assert(m_shadowed);
+		return { reinterpret_cast<const T*>(m_shadow.data()), m_shadow.size() / sizeof(T) };
+	}
+
+	// Size of the GL buffer, in bytes
+	size_t reserved_size() const { return m_reserved_size; }
+
+	size_t page_size() const { return m_page_size; }
+
+	// Upload stats for the previous frame, across all buffers
+	static const BufferUploadStats& upload_stats() { return s_last_frame_stats; }
+
+	static void next_frame_stats() {
+		s_last_frame_stats = s_frame_stats;
+		s_frame_stats = {};
+	}
+
 private:
+	// Make sure the GL buffer holds at least min_size bytes
+	void grow_to(size_t min_size) {
+		if (min_size <= m_reserved_size) return;
+
+		size_t new_size;
+
+		if (m_page_size != 0) {
+			new_size = (min_size + m_page_size - 1) / m_page_size * m_page_size;
+		}
+		else {
+			new_size = std::max<size_t>(m_reserved_size, 1);
+
+			while (new_size < min_size) {
+				new_size *= 2;
+			}
+		}
+
+		resize(new_size);
+	}
+
+	void allocate_storage(uint32_t buffer, size_t size) {
+		if (m_page_size != 0) {
+			glNamedBufferStorage(buffer, size, nullptr, GL_DYNAMIC_STORAGE_BIT);
+		}
+		else {
+			glNamedBufferData(buffer, size, nullptr, m_usage);
+		}
+	}
+
+	void write_shadow(const void* data, size_t offset, size_t size) {
+		if (offset + size > m_shadow.size()) m_shadow.resize(offset + size);
+		memcpy(m_shadow.data() + offset, data, size);
+
+		// Writing element after element only grows the last range
+		if (!m_dirty_ranges.empty() && m_dirty_ranges.back().second == offset) {
+			m_dirty_ranges.back().second = offset + size;
+			return;
+		}
+
+		m_dirty_ranges.push_back({ offset, offset + size });
+		s_frame_stats.dirty_ranges++;
+	}
+
+	static void count_upload(size_t size) {
+		s_frame_stats.calls++;
+		s_frame_stats.bytes += size;
+	}
+
 	uint32_t m_gl_id = 0;
+	uint32_t m_generation = 0;
 	size_t m_reserved_size = 0; // Size of the buffer on GPU, in bytes
 	size_t m_size = 0;			// Amount of bytes used in the buffer
 
 	BufferUsage m_usage;
+	size_t m_page_size = 0;
+
+	// Only used by shadowed buffers
+	bool m_shadowed = false;
+	size_t m_merge_gap = 0;
+	std::vector<uint8_t> m_shadow;
+	std::vector<std::pair<size_t, size_t>> m_dirty_ranges;	// [begin, end) in bytes
+
+	static inline BufferUploadStats s_frame_stats;
+	static inline BufferUploadStats s_last_frame_stats;
 };
\ No newline at end of file
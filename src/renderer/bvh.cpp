@@ -0,0 +1,314 @@
+
+#include "bvh.hpp"
+
+#include <cassert>
+
+
+BVH::NodeID BVH::allocate_node() {
+	NodeID id;
+
+	if (m_free_list == null_node) {
+		id = static_cast<NodeID>(m_nodes.size());
+		m_nodes.emplace_back();
+	}
+	else {
+		id = m_free_list;
+		m_free_list = m_nodes[id].parent;
+		m_free_count--;
+		m_nodes[id] = Node();
+	}
+
+	return id;
+}
+
+
+void BVH::free_node(NodeID node) {
+	m_nodes[node].parent = m_free_list;
+	m_nodes[node].height = -1;
+	m_free_list = node;
+	m_free_count++;
+}
+
+
+BVH::NodeID BVH::insert(const AABB& bounds, uint64_t user_data) {
+	NodeID leaf = allocate_node();
+
+	m_nodes[leaf].bounds = bounds.fattened(m_margin);
+	m_nodes[leaf].user_data = user_data;
+	m_nodes[leaf].height = 0;
+
+	insert_leaf(leaf);
+	m_leaf_count++;
+
+	return leaf;
+}
+
+
+void BVH::remove(NodeID leaf) {
+	assert(m_nodes[leaf].is_leaf());
+
+	remove_leaf(leaf);
+	free_node(leaf);
+	m_leaf_count--;
+}
+
+
+bool BVH::move(NodeID leaf, const AABB& bounds) {
+	const AABB& fat = m_nodes[leaf].bounds;
+
+	// Still inside the fat bounds, and they haven't become much too big for the object (e.g. after shrinking)
+	if (fat.contains(bounds) && bounds.fattened(4.0f * m_margin).contains(fat)) {
+		return false;
+	}
+
+	remove_leaf(leaf);
+	m_nodes[leaf].bounds = bounds.fattened(m_margin);
+	insert_leaf(leaf);
+
+	return true;
+}
+
+
+void BVH::clear() {
+	m_nodes.clear();
+	m_root = null_node;
+	m_free_list = null_node;
+	m_leaf_count = 0;
+	m_free_count = 0;
+}
+
+
+void BVH::insert_leaf(NodeID leaf) {
+	if (m_root == null_node) {
+		m_root = leaf;
+		m_nodes[leaf].parent = null_node;
+		return;
+	}
+
+	// Find the best sibling, by walking down the tree following the cheapest surface area cost
+	const AABB leaf_bounds = m_nodes[leaf].bounds;
+	NodeID index = m_root;
+
+	while (!m_nodes[index].is_leaf()) {
+		const Node& node = m_nodes[index];
+
+		float area = node.bounds.surface_area();
+		float combined_area = AABB::merge(node.bounds, leaf_bounds).surface_area();
+
+		// Cost of making a new parent for this node and the leaf
+		float cost = 2.0f * combined_area;
+
+		// Minimum cost of pushing the leaf further down the tree
+		float inheritance_cost = 2.0f * (combined_area - area);
+
+		auto child_cost = [&](NodeID child) {
+			const Node& c = m_nodes[child];
+			float merged_area = AABB::merge(c.bounds, leaf_bounds).surface_area();
+			return c.is_leaf() ? merged_area + inheritance_cost : (merged_area - c.bounds.surface_area()) + inheritance_cost;
+		};
+
+		float cost_left = child_cost(node.left);
+		float cost_right = child_cost(node.right);
+
+		if (cost < cost_left && cost < cost_right) break;
+
+		index = cost_left < cost_right ? node.left : node.right;
+	}
+
+	NodeID sibling = index;
+
+	// Make a new parent for the sibling and the leaf
+	NodeID old_parent = m_nodes[sibling].parent;
+	NodeID new_parent = allocate_node();
+
+	m_nodes[new_parent].parent = old_parent;
+	m_nodes[new_parent].bounds = AABB::merge(leaf_bounds, m_nodes[sibling].bounds);
+	m_nodes[new_parent].height = m_nodes[sibling].height + 1;
+	m_nodes[new_parent].left = sibling;
+	m_nodes[new_parent].right = leaf;
+
+	m_nodes[sibling].parent = new_parent;
+	m_nodes[leaf].parent = new_parent;
+
+	if (old_parent != null_node) {
+		if (m_nodes[old_parent].left == sibling) m_nodes[old_parent].left = new_parent;
+		else m_nodes[old_parent].right = new_parent;
+	}
+	else {
+		m_root = new_parent;
+	}
+
+	refit_ancestors(m_nodes[leaf].parent);
+}
+
+
+void BVH::remove_leaf(NodeID leaf) {
+	if (leaf == m_root) {
+		m_root = null_node;
+		return;
+	}
+
+	NodeID parent = m_nodes[leaf].parent;
+	NodeID grandparent = m_nodes[parent].parent;
+	NodeID sibling = m_nodes[parent].left == leaf ? m_nodes[parent].right : m_nodes[parent].left;
+
+	if (grandparent != null_node) {
+		// Replace the parent with the sibling
+		if (m_nodes[grandparent].left == parent) m_nodes[grandparent].left = sibling;
+		else m_nodes[grandparent].right = sibling;
+
+		m_nodes[sibling].parent = grandparent;
+		free_node(parent);
+
+		refit_ancestors(grandparent);
+	}
+	else {
+		m_root = sibling;
+		m_nodes[sibling].parent = null_node;
+		free_node(parent);
+	}
+}
+
+
+void BVH::refit_ancestors(NodeID index) {
+	while (index != null_node) {
+		index = balance(index);
+
+		Node& node = m_nodes[index];
+		const Node& left = m_nodes[node.left];
+		const Node& right = m_nodes[node.right];
+
+		node.height = 1 + std::max(left.height, right.height);
+		node.bounds = AABB::merge(left.bounds, right.bounds);
+
+		index = node.parent;
+	}
+}
+
+
+BVH::NodeID BVH::balance(NodeID i_a) {
+	Node& a = m_nodes[i_a];
+
+	if (a.is_leaf() || a.height < 2) {
+		return i_a;
+	}
+
+	NodeID i_b = a.left;
+	NodeID i_c = a.right;
+
+	Node& b = m_nodes[i_b];
+	Node& c = m_nodes[i_c];
+
+	int32_t imbalance = c.height - b.height;
+
+	// Rotate c up
+	if (imbalance > 1) {
+		NodeID i_f = c.left;
+		NodeID i_g = c.right;
+		Node& f = m_nodes[i_f];
+		Node& g = m_nodes[i_g];
+
+		c.left = i_a;
+		c.parent = a.parent;
+		a.parent = i_c;
+
+		if (c.parent != null_node) {
+			if (m_nodes[c.parent].left == i_a) m_nodes[c.parent].left = i_c;
+			else m_nodes[c.parent].right = i_c;
+		}
+		else {
+			m_root = i_c;
+		}
+
+		if (f.height > g.height) {
+			c.right = i_f;
+			a.right = i_g;
+			g.parent = i_a;
+
+			a.bounds = AABB::merge(b.bounds, g.bounds);
+			c.bounds = AABB::merge(a.bounds, f.bounds);
+
+			a.height = 1 + std::max(b.height, g.height);
+			c.height = 1 + std::max(a.height, f.height);
+		}
+		else {
+			c.right = i_g;
+			a.right = i_f;
+			f.parent = i_a;
+
+			a.bounds = AABB::merge(b.bounds, f.bounds);
+			c.bounds = AABB::merge(a.bounds, g.bounds);
+
+			a.height = 1 + std::max(b.height, f.height);
+			c.height = 1 + std::max(a.height, g.height);
+		}
+
+		return i_c;
+	}
+
+	// Rotate b up
+	if (imbalance < -1) {
+		NodeID i_d = b.left;
+		NodeID i_e = b.right;
+		Node& d = m_nodes[i_d];
+		Node& e = m_nodes[i_e];
+
+		b.left = i_a;
+		b.parent = a.parent;
+		a.parent = i_b;
+
+		if (b.parent != null_node) {
+			if (m_nodes[b.parent].left == i_a) m_nodes[b.parent].left = i_b;
+			else m_nodes[b.parent].right = i_b;
+		}
+		else {
+			m_root = i_b;
+		}
+
+		if (d.height > e.height) {
+			b.right = i_d;
+			a.left = i_e;
+			e.parent = i_a;
+
+			a.bounds = AABB::merge(c.bounds, e.bounds);
+			b.bounds = AABB::merge(a.bounds, d.bounds);
+
+			a.height = 1 + std::max(c.height, e.height);
+			b.height = 1 + std::max(a.height, d.height);
+		}
+		else {
+			b.right = i_e;
+			a.left = i_d;
+			d.parent = i_a;
+
+			a.bounds = AABB::merge(c.bounds, d.bounds);
+			b.bounds = AABB::merge(a.bounds, e.bounds);
+
+			a.height = 1 + std::max(c.height, d.height);
+			b.height = 1 + std::max(a.height, e.height);
+		}
+
+		return i_b;
+	}
+
+	return i_a;
+}
+
+
+bool BVH::raycast(const Ray& ray, float max_t, uint64_t& hit_user_data, float& hit_t) const {
+	return raycast(ray, max_t, [](uint64_t, const Ray&, float t_bounds) { return t_bounds; }, hit_user_data, hit_t);
+}
+
+
+float BVH::area_ratio() const {
+	if (m_root == null_node) return 0.0f;
+
+	float root_area = m_nodes[m_root].bounds.surface_area();
+	float total_area = 0.0f;
+
+	for (const auto& node : m_nodes) {
+		if (node.height > 0) total_area += node.bounds.surface_area();
+	}
+
+	return total_area / root_area;
+}
@@ -0,0 +1,240 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "glm.hpp"
+
+#include "bounds.hpp"
+
+/*
+	A dynamic AABB tree, in the style of Box2D's b2DynamicTree.
+
+	Leaves store a fattened copy of their bounds, so objects which move a little don't touch
+	the tree at all, and the ones which do move out are removed and re-inserted.
+	Inserting picks the sibling with the lowest surface area cost, and the tree is kept
+	balanced with AVL style rotations on the way back up.
+
+	Each leaf carries a uint64_t of user data (for the scene this is the flecs entity id).
+	Node ids are stable for the lifetime of a leaf, so they can be stored on the entity.
+*/
+
+class BVH {
+public:
+	using NodeID = int32_t;
+	static constexpr NodeID null_node = -1;
+
+	BVH(float margin = 0.1f) : m_margin(margin) {}
+
+	NodeID insert(const AABB& bounds, uint64_t user_data);
+	void remove(NodeID leaf);
+
+	// Update the bounds of a leaf. Returns true if the leaf had to be re-inserted.
+	bool move(NodeID leaf, const AABB& bounds);
+
+	void clear();
+
+	// Calls callback(user_data) for every leaf that might be inside the frustum.
+	// Once a node is entirely inside, its whole subtree is reported without any more plane tests.
+	template <typename F>
+	void query_frustum(const Frustum& frustum, F&& callback) const;
+
+	// Calls callback(user_data) for every leaf overlapping the sphere
+	template <typename F>
+	void query_sphere(const Sphere& sphere, F&& callback) const;
+
+	// Calls callback(user_data) for every leaf overlapping the box
+	template <typename F>
+	void query_aabb(const AABB& aabb, F&& callback) const;
+
+	// Find the closest leaf along the ray.
+	// hit_test(user_data, ray, t_bounds) gets the distance to the leaf's fat bounds, and returns the distance
+	// to the object, or FLT_MAX for a miss. This allows for exact tests against whatever the leaf represents.
+	// Returns false if nothing was hit.
+	template <typename F>
+	bool raycast(const Ray& ray, float max_t, F&& hit_test, uint64_t& hit_user_data, float& hit_t) const;
+
+	// Closest leaf along the ray, testing against the leaf bounds only
+	bool raycast(const Ray& ray, float max_t, uint64_t& hit_user_data, float& hit_t) const;
+
+	const AABB& get_fat_bounds(NodeID leaf) const { return m_nodes[leaf].bounds; }
+	uint64_t get_user_data(NodeID leaf) const { return m_nodes[leaf].user_data; }
+
+	size_t leaf_count() const { return m_leaf_count; }
+	size_t node_count() const { return m_nodes.size() - m_free_count; }
+	int32_t height() const { return m_root == null_node ? 0 : m_nodes[m_root].height; }
+
+	// Sum of internal node surface areas divided by the root's. Lower is better.
+	float area_ratio() const;
+
+private:
+	struct Node {
+		AABB bounds;
+		uint64_t user_data = 0;
+
+		NodeID parent = null_node;	// Doubles as the next pointer in the free list
+		NodeID left = null_node;
+		NodeID right = null_node;
+
+		int32_t height = 0;			// Leaves are 0, free nodes are -1
+
+		bool is_leaf() const { return left == null_node; }
+	};
+
+	NodeID allocate_node();
+	void free_node(NodeID node);
+
+	void insert_leaf(NodeID leaf);
+	void remove_leaf(NodeID leaf);
+
+	// Rotate the subtree at node if it is imbalanced, and return the new root of the subtree
+	NodeID balance(NodeID node);
+
+	// Recompute bounds and heights from node to the root, rebalancing along the way
+	void refit_ancestors(NodeID node);
+
+	std::vector<Node> m_nodes;
+	NodeID m_root = null_node;
+	NodeID m_free_list = null_node;
+
+	size_t m_leaf_count = 0;
+	size_t m_free_count = 0;
+
+	float m_margin;
+
+	// Traversal stack, reused between queries to avoid allocating.
+	// This means queries on the same tree can't run concurrently.
+	mutable std::vector<NodeID> m_stack;
+};
+
+
+
+template <typename F>
+void BVH::query_frustum(const Frustum& frustum, F&& callback) const {
+	if (m_root == null_node) return;
+
+	// The sign bit of each stack entry marks a subtree that is known to be fully inside
+	constexpr uint32_t inside_bit = 0x80000000u;
+
+	m_stack.clear();
+	m_stack.push_back(m_root);
+
+	while (!m_stack.empty()) {
+		uint32_t entry = static_cast<uint32_t>(m_stack.back());
+		m_stack.pop_back();
+
+		bool inside = entry & inside_bit;
+		const Node& node = m_nodes[entry & ~inside_bit];
+
+		if (!inside) {
+			Containment c = frustum.test(node.bounds);
+			if (c == Containment::Outside) continue;
+			inside = c == Containment::Inside;
+		}
+
+		if (node.is_leaf()) {
+			callback(node.user_data);
+		}
+		else {
+			uint32_t flag = inside ? inside_bit : 0;
+			m_stack.push_back(static_cast<NodeID>(node.left | flag));
+			m_stack.push_back(static_cast<NodeID>(node.right | flag));
+		}
+	}
+}
+
+
+template <typename F>
+void BVH::query_sphere(const Sphere& sphere, F&& callback) const {
+	if (m_root == null_node) return;
+
+	m_stack.clear();
+	m_stack.push_back(m_root);
+
+	while (!m_stack.empty()) {
+		const Node& node = m_nodes[m_stack.back()];
+		m_stack.pop_back();
+
+		if (!sphere.overlaps(node.bounds)) continue;
+
+		if (node.is_leaf()) {
+			callback(node.user_data);
+		}
+		else {
+			m_stack.push_back(node.left);
+			m_stack.push_back(node.right);
+		}
+	}
+}
+
+
+template <typename F>
+void BVH::query_aabb(const AABB& aabb, F&& callback) const {
+	if (m_root == null_node) return;
+
+	m_stack.clear();
+	m_stack.push_back(m_root);
+
+	while (!m_stack.empty()) {
+		const Node& node = m_nodes[m_stack.back()];
+		m_stack.pop_back();
+
+		if (!aabb.overlaps(node.bounds)) continue;
+
+		if (node.is_leaf()) {
+			callback(node.user_data);
+		}
+		else {
+			m_stack.push_back(node.left);
+			m_stack.push_back(node.right);
+		}
+	}
+}
+
+
+template <typename F>
+bool BVH::raycast(const Ray& ray, float max_t, F&& hit_test, uint64_t& hit_user_data, float& hit_t) const {
+	if (m_root == null_node) return false;
+
+	const glm::vec3 inv_direction = 1.0f / ray.direction;
+	bool hit = false;
+	hit_t = max_t;
+
+	m_stack.clear();
+	m_stack.push_back(m_root);
+
+	while (!m_stack.empty()) {
+		const Node& node = m_nodes[m_stack.back()];
+		m_stack.pop_back();
+
+		// Anything further than the closest hit so far can be skipped
+		float t_bounds = Ray::intersect(ray.origin, inv_direction, node.bounds, hit_t);
+		if (t_bounds == FLT_MAX) continue;
+
+		if (node.is_leaf()) {
+			float t = hit_test(node.user_data, ray, t_bounds);
+
+			if (t < hit_t) {
+				hit_t = t;
+				hit_user_data = node.user_data;
+				hit = true;
+			}
+		}
+		else {
+			// Visit the nearer child first, so hit_t shrinks as early as possible
+			float t_left = Ray::intersect(ray.origin, inv_direction, m_nodes[node.left].bounds, hit_t);
+			float t_right = Ray::intersect(ray.origin, inv_direction, m_nodes[node.right].bounds, hit_t);
+
+			if (t_left < t_right) {
+				if (t_right != FLT_MAX) m_stack.push_back(node.right);
+				m_stack.push_back(node.left);
+			}
+			else {
+				if (t_left != FLT_MAX) m_stack.push_back(node.left);
+				if (t_right != FLT_MAX) m_stack.push_back(node.right);
+			}
+		}
+	}
+
+	return hit;
+}
@@ -0,0 +1,286 @@
+
+#include "command_list.hpp"
+
+#include <algorithm>
+#include <tuple>
+#include <cassert>
+
+#include "util.hpp"
+#include "instrumentation/instrumentor.hpp"
+
+
+void GLStateCache::reset() {
+	m_program = unknown;
+	m_vertex_array = unknown;
+	m_indirect_buffer = unknown;
+	m_parameter_buffer = unknown;
+	m_dispatch_indirect_buffer = unknown;
+
+	m_depth_func = unknown;
+	m_depth_write = unknown;
+	m_color_write = unknown;
+	m_blend = unknown;
+
+	m_vertex_bindings.clear();
+	m_element_buffers.clear();
+}
+
+
+bool GLStateCache::changed(uint32_t& cached, uint32_t value) {
+	if (cached == value) {
+		m_stats.elided++;
+		return false;
+	}
+
+	cached = value;
+	m_stats.issued++;
+	return true;
+}
+
+
+void GLStateCache::use_program(Shader& shader) {
+	// A hot reload gives the program a new id, so it's never mistaken for the old one
+	shader.reload_if_needed();
+
+	if (changed(m_program, shader.get_id())) glUseProgram(shader.get_id());
+
+	shader.upload_uniforms();
+}
+
+
+void GLStateCache::bind_vertex_array(uint32_t vao) {
+	if (changed(m_vertex_array, vao)) glBindVertexArray(vao);
+}
+
+
+void GLStateCache::vertex_buffer(uint32_t vao, uint32_t binding, const VertexBinding& vertex_binding) {
+	auto it = std::find_if(m_vertex_bindings.begin(), m_vertex_bindings.end(), [&](const CachedVertexBinding& cached) {
+		return cached.vao == vao && cached.binding == binding;
+	});
+
+	if (it != m_vertex_bindings.end() && it->vertex_binding == vertex_binding) {
+		m_stats.elided++;
+		return;
+	}
+
+	if (it != m_vertex_bindings.end()) it->vertex_binding = vertex_binding;
+	else m_vertex_bindings.push_back({ vao, binding, vertex_binding });
+
+	glVertexArrayVertexBuffer(vao, binding, vertex_binding.buffer, vertex_binding.offset, vertex_binding.stride);
+	m_stats.issued++;
+}
+
+
+void GLStateCache::element_buffer(uint32_t vao, uint32_t buffer) {
+	auto it = std::find_if(m_element_buffers.begin(), m_element_buffers.end(), [&](const auto& cached) { return cached.first == vao; });
+
+	if (it != m_element_buffers.end() && it->second == buffer) {
+		m_stats.elided++;
+		return;
+	}
+
+	if (it != m_element_buffers.end()) it->second = buffer;
+	else m_element_buffers.push_back({ vao, buffer });
+
+	glVertexArrayElementBuffer(vao, buffer);
+	m_stats.issued++;
+}
+
+
+void GLStateCache::indirect_buffer(uint32_t buffer) {
+	if (changed(m_indirect_buffer, buffer)) glBindBuffer(GL_DRAW_INDIRECT_BUFFER, buffer);
+}
+
+
+void GLStateCache::parameter_buffer(uint32_t buffer) {
+	if (changed(m_parameter_buffer, buffer)) glBindBuffer(GL_PARAMETER_BUFFER, buffer);
+}
+
+
+void GLStateCache::dispatch_indirect_buffer(uint32_t buffer) {
+	if (changed(m_dispatch_indirect_buffer, buffer)) glBindBuffer(GL_DISPATCH_INDIRECT_BUFFER, buffer);
+}
+
+
+void GLStateCache::raster_state(const RasterState& raster) {
+	if (changed(m_depth_func, raster.depth_func)) glDepthFunc(raster.depth_func);
+	if (changed(m_depth_write, raster.depth_write)) glDepthMask(raster.depth_write);
+
+	if (changed(m_color_write, raster.color_write)) {
+		glColorMask(raster.color_write, raster.color_write, raster.color_write, raster.color_write);
+	}
+
+	if (changed(m_blend, raster.blend)) {
+		if (raster.blend) {
+			glEnable(GL_BLEND);
+			glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+		}
+		else {
+			glDisable(GL_BLEND);
+		}
+	}
+}
+
+
+GLCallStats GLStateCache::take_stats() {
+	GLCallStats stats = m_stats;
+	m_stats = {};
+	return stats;
+}
+
+
+
+uint32_t CommandList::snapshot() {
+	if (m_states.empty() || !(m_states.back() == m_pending)) {
+		m_states.push_back(m_pending);
+	}
+
+	return static_cast<uint32_t>(m_states.size() - 1);
+}
+
+
+void CommandList::dispatch(uint32_t x, uint32_t y, uint32_t z) {
+	m_commands.push_back({ .type = Command::Dispatch, .state = snapshot(), .x = x, .y = y, .z = z });
+}
+
+
+void CommandList::dispatch_indirect(uint32_t buffer, size_t offset) {
+	m_commands.push_back({ .type = Command::DispatchIndirect, .state = snapshot(), .offset = offset, .x = buffer });
+}
+
+
+void CommandList::draw_elements_indirect(size_t offset, uint32_t draw_count, uint32_t stride) {
+	if (draw_count == 0) return;
+
+	m_commands.push_back({ .type = Command::Draw, .state = snapshot(), .offset = offset, .x = draw_count, .y = stride });
+}
+
+
+void CommandList::draw_elements_indirect_count(size_t offset, size_t count_offset, uint32_t max_draw_count, uint32_t stride) {
+	if (max_draw_count == 0) return;
+
+	m_commands.push_back({ .type = Command::DrawCount, .state = snapshot(), .offset = offset, .count_offset = count_offset, .x = max_draw_count, .y = stride });
+}
+
+
+void CommandList::memory_barrier(GLbitfield barriers) {
+	m_commands.push_back({ .type = Command::Barrier, .x = barriers });
+}
+
+
+void CommandList::begin_query(GLenum target, uint32_t query) {
+	m_commands.push_back({ .type = Command::BeginQuery, .x = target, .y = query });
+}
+
+
+void CommandList::end_query(GLenum target) {
+	m_commands.push_back({ .type = Command::EndQuery, .x = target });
+}
+
+
+void CommandList::sort() {
+	auto key = [this](const Command& command) {
+		const State& state = m_states[command.state];
+		return std::make_tuple(state.program ? state.program->get_id() : 0, state.vertex_array, state.element_buffer, state.indirect_buffer, state.parameter_buffer);
+	};
+
+	auto run_begin = m_commands.begin();
+
+	while (run_begin != m_commands.end()) {
+		if (!run_begin->is_draw()) {
+			++run_begin;
+			continue;
+		}
+
+		// Consecutive draws with the same raster state
+		const RasterState& raster = m_states[run_begin->state].raster;
+
+		auto run_end = std::find_if(run_begin, m_commands.end(), [&](const Command& command) {
+			return !command.is_draw() || !(m_states[command.state].raster == raster);
+		});
+
+		std::stable_sort(run_begin, run_end, [&](const Command& a, const Command& b) { return key(a) < key(b); });
+
+		run_begin = run_end;
+	}
+}
+
+
+void CommandList::apply(GLStateCache& cache, const State& state, bool draw) {
+	if (state.program) cache.use_program(*state.program);
+
+	// Dispatches don't care about any of the rest
+	if (!draw) return;
+
+	cache.bind_vertex_array(state.vertex_array);
+
+	for (uint32_t i = 0; i < max_vertex_bindings; i++) {
+		if (state.vertex_buffers[i].buffer != 0) cache.vertex_buffer(state.vertex_array, i, state.vertex_buffers[i]);
+	}
+
+	if (state.element_buffer != 0) cache.element_buffer(state.vertex_array, state.element_buffer);
+
+	cache.indirect_buffer(state.indirect_buffer);
+	if (state.parameter_buffer != 0) cache.parameter_buffer(state.parameter_buffer);
+	cache.raster_state(state.raster);
+}
+
+
+void CommandList::execute(GLStateCache& cache) {
+	PROFILE_FUNC();
+
+	cache.reset();
+
+	for (const Command& command : m_commands) {
+		switch (command.type) {
+		case Command::Draw:
+			apply(cache, m_states[command.state], true);
+			glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, (void*)command.offset, command.x, command.y);
+			break;
+
+		case Command::DrawCount:
+			apply(cache, m_states[command.state], true);
+			glMultiDrawElementsIndirectCount(GL_TRIANGLES, GL_UNSIGNED_INT, (void*)command.offset, static_cast<GLintptr>(command.count_offset), command.x, command.y);
+			break;
+
+		case Command::Dispatch:
+			apply(cache, m_states[command.state], false);
+			glDispatchCompute(command.x, command.y, command.z);
+			break;
+
+		case Command::DispatchIndirect:
+			apply(cache, m_states[command.state], false);
+			cache.dispatch_indirect_buffer(command.x);
+			glDispatchComputeIndirect(static_cast<GLintptr>(command.offset));
+			break;
+
+		case Command::Barrier:
+			glMemoryBarrier(command.x);
+			break;
+
+		case Command::BeginQuery:
+			glBeginQuery(command.x, command.y);
+			break;
+
+		case Command::EndQuery:
+			glEndQuery(command.x);
+			break;
+
+		case Command::Uniform:
+			assert(command.program);
+			std::visit([&](auto value) { command.program->set(command.handle, value); }, command.value);
+			continue;	// Only CPU side until the program is next used
+		}
+
+		cache.count_issued();
+	}
+
+	GL_ERROR_CHECK();
+}
+
+
+void CommandList::clear() {
+	m_pending = {};
+	m_states.clear();
+	m_commands.clear();
+}
@@ -0,0 +1,218 @@
+#pragma once
+
+#include <cstdint>
+#include <array>
+#include <variant>
+#include <vector>
+
+#include "glad/gl.h"
+#include <glm.hpp>
+
+#include "shader.hpp"
+
+/*
+	Draws and dispatches are recorded into a CommandList along with the state they need, and
+	replayed to GL later through a GLStateCache, which skips any state change that wouldn't change anything.
+
+	Usage:
+		list.use_program(shader);
+		list.set_uniform<uint32_t>(handle, count);
+		list.dispatch(groups);
+		list.memory_barrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+		list.bind_vertex_array(vao);
+		list.vertex_buffer(0, vbo, 0, stride);
+		list.draw_elements_indirect(0, draw_count);
+
+		list.parameter_buffer(counts);
+		list.draw_elements_indirect_count(0, count_offset, max_draw_count);	// Draw count read from the GPU
+
+		list.sort();	// Optional
+		list.execute(state);
+
+	State set on the list sticks, and applies to everything recorded after it, like it would in GL.
+	Indexed buffer bindings (SSBOs, UBOs) aren't covered, they belong to BindingTable.
+*/
+
+// GL calls made by CommandLists, and how many state changes were skipped because they were already set
+struct GLCallStats {
+	uint32_t issued = 0;
+	uint32_t elided = 0;
+};
+
+
+// Depth and colour writes, and blending. Order matters between draws with different raster state
+// (a depth prepass has to come before the GL_EQUAL pass), so sort() never reorders across it.
+struct RasterState {
+	GLenum depth_func = GL_LESS;
+	bool depth_write = true;
+	bool color_write = true;
+	bool blend = false;		// Straight alpha, over what's already there
+
+	bool operator==(const RasterState&) const = default;
+};
+
+
+struct VertexBinding {
+	uint32_t buffer = 0;	// 0 leaves the binding alone
+	size_t offset = 0;
+	int32_t stride = 0;
+
+	bool operator==(const VertexBinding&) const = default;
+};
+
+
+// What GL is known to have bound. Anything outside a CommandList (imgui, Shader::use(), uploads) can
+// change it behind our back, so execute() starts by forgetting everything.
+class GLStateCache {
+public:
+	static constexpr uint32_t unknown = UINT32_MAX;
+
+	void reset();
+
+	// Always uploads the program's dirty uniforms, even if the program is already bound
+	void use_program(Shader& shader);
+	void bind_vertex_array(uint32_t vao);
+	void vertex_buffer(uint32_t vao, uint32_t binding, const VertexBinding& vertex_binding);
+	void element_buffer(uint32_t vao, uint32_t buffer);
+	void indirect_buffer(uint32_t buffer);
+	void parameter_buffer(uint32_t buffer);
+	void dispatch_indirect_buffer(uint32_t buffer);
+	void raster_state(const RasterState& raster);
+
+	// Draws, dispatches and barriers always go through, and are counted as issued
+	void count_issued() { m_stats.issued++; }
+
+	// Since the last call
+	GLCallStats take_stats();
+
+private:
+	bool changed(uint32_t& cached, uint32_t value);
+
+	uint32_t m_program = unknown;
+	uint32_t m_vertex_array = unknown;
+	uint32_t m_indirect_buffer = unknown;
+	uint32_t m_parameter_buffer = unknown;
+	uint32_t m_dispatch_indirect_buffer = unknown;
+
+	GLenum m_depth_func = unknown;
+	uint32_t m_depth_write = unknown;
+	uint32_t m_color_write = unknown;
+	uint32_t m_blend = unknown;
+
+	// Both part of the vertex array's state, so keyed by it
+	struct CachedVertexBinding {
+		uint32_t vao;
+		uint32_t binding;
+		VertexBinding vertex_binding;
+	};
+
+	std::vector<CachedVertexBinding> m_vertex_bindings;
+	std::vector<std::pair<uint32_t, uint32_t>> m_element_buffers;	// vao, buffer
+
+	GLCallStats m_stats;
+};
+
+
+class CommandList {
+public:
+	static constexpr uint32_t max_vertex_bindings = 4;
+
+	using UniformValue = std::variant<uint32_t, int32_t, float, glm::vec2, glm::vec3, glm::vec4, glm::mat4>;
+
+	// State
+	void use_program(Shader& shader) { m_pending.program = &shader; }
+	void bind_vertex_array(uint32_t vao) { m_pending.vertex_array = vao; }
+	void vertex_buffer(uint32_t binding, uint32_t buffer, size_t offset, int32_t stride) { m_pending.vertex_buffers[binding] = { buffer, offset, stride }; }
+	void element_buffer(uint32_t buffer) { m_pending.element_buffer = buffer; }
+	void indirect_buffer(uint32_t buffer) { m_pending.indirect_buffer = buffer; }
+	void parameter_buffer(uint32_t buffer) { m_pending.parameter_buffer = buffer; }
+
+	void depth_func(GLenum func) { m_pending.raster.depth_func = func; }
+	void depth_mask(bool write) { m_pending.raster.depth_write = write; }
+	void color_mask(bool write) { m_pending.raster.color_write = write; }
+	void blend(bool enable) { m_pending.raster.blend = enable; }
+
+	// Set a uniform on the current program. Recorded, so it takes effect in order when replayed.
+	template <typename T>
+	void set_uniform(Shader::UniformHandle handle, T value) {
+		m_commands.push_back({ .type = Command::Uniform, .program = m_pending.program, .handle = handle, .value = value });
+	}
+
+	// Work
+	void dispatch(uint32_t x, uint32_t y = 1, uint32_t z = 1);
+	void dispatch_indirect(uint32_t buffer, size_t offset);
+	void draw_elements_indirect(size_t offset, uint32_t draw_count, uint32_t stride = 0);
+
+	// The draw count is read from the parameter buffer at count_offset, up to max_draw_count. GL 4.6.
+	void draw_elements_indirect_count(size_t offset, size_t count_offset, uint32_t max_draw_count, uint32_t stride = 0);
+	void memory_barrier(GLbitfield barriers);
+
+	// Queries can be left open across lists, as long as they're executed in order
+	void begin_query(GLenum target, uint32_t query);
+	void end_query(GLenum target);
+
+	// Reorder draws so those sharing a program and buffers end up next to each other.
+	// Only runs of draws with nothing else in between are reordered, and never across a raster state change.
+	void sort();
+
+	void execute(GLStateCache& cache);
+
+	// Forget the commands, and the state
+	void clear();
+
+	size_t size() const { return m_commands.size(); }
+
+private:
+	struct State {
+		Shader* program = nullptr;
+		uint32_t vertex_array = 0;
+		std::array<VertexBinding, max_vertex_bindings> vertex_buffers = {};
+		uint32_t element_buffer = 0;
+		uint32_t indirect_buffer = 0;
+		uint32_t parameter_buffer = 0;
+		RasterState raster;
+
+		bool operator==(const State&) const = default;
+	};
+
+	struct Command {
+		enum Type : uint8_t {
+			Draw,
+			DrawCount,
+			Dispatch,
+			DispatchIndirect,
+			Barrier,
+			BeginQuery,
+			EndQuery,
+			Uniform
+		} type;
+
+		uint32_t state = 0;		// Index into m_states, for draws and dispatches
+
+		// Draw: offset into the indirect buffer, count, stride
+		// DrawCount: as Draw, with the max count in x, and count_offset into the parameter buffer
+		// Dispatch: group counts in x, y, z
+		// DispatchIndirect: buffer in x, offset
+		// Barrier: bits in x
+		// BeginQuery, EndQuery: target in x, query in y
+		size_t offset = 0;
+		size_t count_offset = 0;
+		uint32_t x = 0, y = 0, z = 0;
+
+		bool is_draw() const { return type == Draw || type == DrawCount; }
+
+		Shader* program = nullptr;
+		Shader::UniformHandle handle = 0;
+		UniformValue value = {};
+	};
+
+	// Snapshot the pending state for a draw or dispatch, sharing the last one if nothing changed
+	uint32_t snapshot();
+
+	void apply(GLStateCache& cache, const State& state, bool draw);
+
+	State m_pending;
+	std::vector<State> m_states;
+	std::vector<Command> m_commands;
+};
@@ -0,0 +1,133 @@
+
+#include "cpu_draw_builder.hpp"
+
+#include <chrono>
+#include <algorithm>
+#include <bit>
+
+#include "instrumentation/instrumentor.hpp"
+
+
+void CPUDrawBuilder::build(WorkerPool& pool, const CullData& cull, const glm::mat4& view,
+	std::span<const GPUEntity> entities, std::span<const glm::mat4> transforms, std::span<const GPUMesh> meshes) {
+
+	PROFILE_FUNC();
+
+	auto start = std::chrono::high_resolution_clock::now();
+
+	uint32_t entity_count = static_cast<uint32_t>(entities.size());
+
+	// Padded to a whole number of lanes, so the last chunk can be loaded eight at a time too
+	size_t padded = (entity_count + 7) & ~size_t(7);
+	m_x.resize(padded);
+	m_y.resize(padded);
+	m_z.resize(padded);
+	m_radius_sq.resize(padded);
+	m_min_pixels.resize(padded);
+
+	m_workers.resize(pool.size());
+
+	for (Worker& worker : m_workers) {
+		worker.keys.clear();
+		worker.visible.clear();
+		worker.too_small = 0;
+	}
+
+	// A multiple of 8, so chunks never share a group of lanes
+	constexpr uint32_t grain = 4096;
+
+	pool.parallel_for(entity_count, grain, [&](uint32_t begin, uint32_t end, uint32_t worker_idx) {
+		Worker& worker = m_workers[worker_idx];
+
+		for (uint32_t i = begin; i < end; i++) {
+			const GPUEntity& e = entities[i];
+			const glm::mat4& model = transforms[e.transform_idx];
+			const GPUMesh& mesh = meshes[e.mesh_idx];
+
+			m_x[i] = model[3].x;
+			m_y[i] = model[3].y;
+			m_z[i] = model[3].z;
+			m_radius_sq[i] = bounding_radius_sq(model, mesh.bounding_sphere);
+			m_min_pixels[i] = contribution_min_pixels(cull, mesh.min_pixels);
+		}
+
+		// Lanes past the end are whatever was there before, and masked off below
+		for (uint32_t i = begin; i < end; i += 8) {
+			uint32_t too_small;
+			uint32_t mask = sphere_visible_x8(cull, view, &m_x[i], &m_y[i], &m_z[i], &m_radius_sq[i], &m_min_pixels[i], too_small);
+
+			if (end - i < 8) {
+				mask &= (1u << (end - i)) - 1;
+				too_small &= (1u << (end - i)) - 1;
+			}
+
+			worker.too_small += std::popcount(too_small);
+
+			while (mask) {
+				uint32_t idx = i + std::countr_zero(mask);
+				mask &= mask - 1;
+
+				// Looking down -z, so the distance in front of the camera is -z
+				float cz = view[0].z * m_x[idx] + view[1].z * m_y[idx] + view[2].z * m_z[idx] + view[3].z;
+
+				// One program and vertex format for now
+				const GPUEntity& e = entities[idx];
+				worker.keys.push_back(draw_key::make(draw_key::Pass::Opaque, 0, 0, e.mesh_idx, e.material_idx, draw_key::quantize_depth(-cz)));
+				worker.visible.push_back(idx);
+			}
+		}
+	});
+
+	// Gather everyone's keys, then sort them
+	uint32_t visible_count = 0;
+
+	for (Worker& worker : m_workers) {
+		worker.first = visible_count;
+		visible_count += static_cast<uint32_t>(worker.keys.size());
+	}
+
+	m_keys.resize(visible_count);
+	m_visible.resize(visible_count);
+
+	pool.parallel_for(static_cast<uint32_t>(m_workers.size()), 1, [&](uint32_t begin, uint32_t end, uint32_t) {
+		for (uint32_t w = begin; w < end; w++) {
+			const Worker& worker = m_workers[w];
+			std::copy(worker.keys.begin(), worker.keys.end(), m_keys.begin() + worker.first);
+			std::copy(worker.visible.begin(), worker.visible.end(), m_visible.begin() + worker.first);
+		}
+	});
+
+	auto sort_start = std::chrono::high_resolution_clock::now();
+	m_sort.sort(pool, m_keys, m_visible);
+	m_stats.sort_ms = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - sort_start).count();
+
+	// The instances are just the sorted entities, and a new command starts wherever the batch changes
+	m_instances.resize(visible_count);
+
+	pool.parallel_for(visible_count, grain, [&](uint32_t begin, uint32_t end, uint32_t) {
+		for (uint32_t i = begin; i < end; i++) {
+			const GPUEntity& e = entities[m_visible[i]];
+			m_instances[i] = { e.transform_idx, e.material_idx };
+		}
+	});
+
+	m_commands.clear();
+
+	for (uint32_t i = 0; i < visible_count; i++) {
+		if (i != 0 && draw_key::batch(m_keys[i]) == draw_key::batch(m_keys[i - 1])) {
+			m_commands.back().instance_count++;
+			continue;
+		}
+
+		const GPUMesh& m = meshes[draw_key::mesh(m_keys[i])];
+		m_commands.push_back({ m.num_vertices, 1, m.first_idx, m.base_vertex, i });
+	}
+
+	m_stats.tested = entity_count;
+	m_stats.visible = visible_count;
+	m_stats.contribution_culled = 0;
+	for (const Worker& worker : m_workers) m_stats.contribution_culled += worker.too_small;
+	m_stats.commands = static_cast<uint32_t>(m_commands.size());
+	m_stats.sort_passes = m_sort.passes();
+	m_stats.ms = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <cstdint>
+#include <span>
+#include <vector>
+
+#include <glm.hpp>
+
+#include "draw_data.hpp"
+#include "culling.hpp"
+#include "draw_key.hpp"
+#include "radix_sort.hpp"
+#include "worker_pool.hpp"
+
+/*
+	The CPU side of draw building: frustum and contribution culls every entity, and groups what's left into
+	instanced draw commands, like the entity_count / build_render_command / generate_per_instance_data
+	passes do on the GPU.
+
+	Entities are split across a WorkerPool in chunks. Each chunk's bounding spheres are gathered into SoA
+	arrays, then tested eight at a time with sphere_visible_x8(). Every visible entity gets a draw key
+	(see draw_key.hpp), and the keys are radix sorted across the pool. Each run of keys with the same batch is
+	one command, with its instances by material and then front to back.
+
+	Everything is kept between builds and only ever grows, so a steady scene doesn't allocate.
+*/
+
+class CPUDrawBuilder {
+public:
+	struct Stats {
+		uint32_t tested = 0;
+		uint32_t visible = 0;
+		uint32_t contribution_culled = 0;
+		uint32_t commands = 0;
+		uint32_t sort_passes = 0;
+		double sort_ms = 0;
+		double ms = 0;
+	};
+
+	// transforms and meshes are indexed by the entities' transform_idx and mesh_idx
+	void build(WorkerPool& pool, const CullData& cull, const glm::mat4& view,
+		std::span<const GPUEntity> entities, std::span<const glm::mat4> transforms, std::span<const GPUMesh> meshes);
+
+	// Only meshes with visible instances get a command, in key order
+	std::span<const RenderCommand> commands() const { return m_commands; }
+	std::span<const PerInstanceData> instances() const { return m_instances; }
+
+	const Stats& stats() const { return m_stats; }
+
+private:
+	struct Worker {
+		std::vector<uint64_t> keys;
+		std::vector<uint32_t> visible;		// Entity indices
+		uint32_t too_small = 0;			// In the frustum, but contribution culled
+		uint32_t first = 0;				// Where this worker's go in m_keys
+	};
+
+	std::vector<Worker> m_workers;
+
+	// Every visible entity's key and index, sorted
+	std::vector<uint64_t> m_keys;
+	std::vector<uint32_t> m_visible;
+	RadixSort<uint64_t, uint32_t> m_sort;
+
+	// Bounding spheres, SoA, by entity index
+	std::vector<float> m_x, m_y, m_z, m_radius_sq, m_min_pixels;
+
+	std::vector<RenderCommand> m_commands;
+	std::vector<PerInstanceData> m_instances;
+
+	Stats m_stats;
+};
@@ -0,0 +1,54 @@
+#include "cull_check.hpp"
+
+#include "glad/gl.h"
+
+#include "util.hpp"
+#include "buffer.hpp"
+#include "shader.hpp"
+#include "binding_table.hpp"
+#include "assets/asset_manager.hpp"
+
+
+std::vector<uint32_t> gpu_sphere_visible(const CullData& cull, const glm::mat4& view, std::span<const glm::mat4> models, float radius) {
+	static Ref<Shader> check_shader = asset_manager.GetByPath<Shader>("assets/shaders/cull_check.glsl");
+	static Shader::UniformHandle num_spheres = check_shader->uniform_handle("num_spheres");
+	static Shader::UniformHandle sphere_radius = check_shader->uniform_handle("radius");
+
+	// The CullCheckData block. std430 puts view on the next 16 bytes after cull, as C++ does.
+	struct CheckData {
+		CullData cull;
+		glm::mat4 view;
+	};
+
+	const CheckData data = { cull, view };
+	const uint32_t count = static_cast<uint32_t>(models.size());
+
+	std::vector<uint32_t> results(count);
+	if (count == 0) return results;
+
+	Buffer data_buffer;
+	Buffer model_buffer;
+	Buffer result_buffer;
+
+	data_buffer.set_data(&data, sizeof(data));
+	model_buffer.set_data(models.data(), models.size_bytes());
+	result_buffer.resize(count * sizeof(uint32_t));
+
+	// The table never hands these out, so binding here doesn't disturb it
+	data_buffer.bind(GL_SHADER_STORAGE_BUFFER, BindingTable::reserved_storage_begin);
+	model_buffer.bind(GL_SHADER_STORAGE_BUFFER, BindingTable::reserved_storage_begin + 1);
+	result_buffer.bind(GL_SHADER_STORAGE_BUFFER, BindingTable::reserved_storage_begin + 2);
+
+	check_shader->set<uint32_t>(num_spheres, count);
+	check_shader->set<float>(sphere_radius, radius);
+	check_shader->use();
+
+	glDispatchCompute((count + 63) / 64, 1, 1);
+	glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+
+	glGetNamedBufferSubData(result_buffer.get_id(), 0, count * sizeof(uint32_t), results.data());
+
+	GL_ERROR_CHECK();
+
+	return results;
+}
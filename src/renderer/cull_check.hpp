@@ -0,0 +1,14 @@
+#pragma once
+
+#include <cstdint>
+#include <span>
+#include <vector>
+
+#include <glm.hpp>
+
+#include "culling.hpp"
+
+// Runs sphere_visible() from culling.glsl on the GPU for each model, and reads back what it decided,
+// 1 for visible and 0 for culled. For checking sphere_visible() in culling.hpp against the real thing.
+// GL, so main thread only! Waits for the GPU to finish.
+std::vector<uint32_t> gpu_sphere_visible(const CullData& cull, const glm::mat4& view, std::span<const glm::mat4> models, float radius);
@@ -0,0 +1,233 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <cmath>
+#include <algorithm>
+#include <immintrin.h>
+
+#include <glm.hpp>
+
+/*
+	Bounding sphere vs frustum culling, as done on the GPU by assets/shaders/culling.glsl.
+
+	sphere_visible() here is the same test, operation for operation, so it gives the same answer
+	bit for bit, and culling can be checked and benchmarked without a GPU. To keep it that way:
+		* The GLSL marks everything precise, so nothing is fused or reordered, and this must be built
+		  without floating point contraction (the MSVC default, /fp:precise).
+		* There are no sqrts, since the GPU's aren't correctly rounded. The radius is compared squared.
+		* Matrix maths is written out by hand, rather than trusting mat * vec to add things up in the same order.
+
+	Only the side planes and near / far are tested, using the symmetry of the frustum to test both
+	sides with one plane (see niagara, https://github.com/zeux/niagara).
+
+	Spheres that pass can still be culled for being too small to matter: contribution culling drops anything
+	whose projected diameter is under a number of pixels. Also squared, and also the same on both sides.
+*/
+
+struct alignas(16) CullData {
+	glm::mat4 view = glm::mat4(1.0f);	// What the GPU culls with. The functions here take it separately.
+	float frustum[4];	// x, z of the normalised left plane, then y, z of the bottom plane, in view space
+	float znear, zfar;
+	float contribution_scale_sq;	// (projection[1][1] * viewport height)^2, which turns radius / distance into pixels across
+	float min_pixels;				// Smallest projected diameter drawn, for meshes without their own. 0 draws everything.
+	float frustum_offset[2] = { 0.0f, 0.0f };	// How far out the side planes are from the view axis. 0 for a perspective frustum, whose planes go through the eye.
+
+	static CullData from_projection(const glm::mat4& projection, float znear, float zfar, float viewport_height = 0.0f, float min_pixels = 0.0f) {
+		auto normalize_plane = [](glm::vec4 plane) { return plane / glm::length(glm::vec3(plane)); };
+
+		glm::mat4 projection_transpose = glm::transpose(projection);
+		glm::vec4 frustum_x = normalize_plane(projection_transpose[3] + projection_transpose[0]);
+		glm::vec4 frustum_y = normalize_plane(projection_transpose[3] + projection_transpose[1]);
+
+		CullData cull;
+		cull.frustum[0] = frustum_x.x;
+		cull.frustum[1] = frustum_x.z;
+		cull.frustum[2] = frustum_y.y;
+		cull.frustum[3] = frustum_y.z;
+		cull.znear = znear;
+		cull.zfar = zfar;
+
+		float pixel_scale = projection[1][1] * viewport_height;
+		cull.contribution_scale_sq = pixel_scale * pixel_scale;
+		cull.min_pixels = min_pixels;
+
+		return cull;
+	}
+
+	// An orthographic box looking down -z from the origin of view, half_width by half_height across,
+	// like glm::ortho(-half_width, half_width, -half_height, half_height, znear, zfar).
+	// The side planes are straight down the box, with no contribution culling, as size doesn't change with distance.
+	static CullData orthographic(const glm::mat4& view, float half_width, float half_height, float znear, float zfar) {
+		CullData cull;
+		cull.view = view;
+		cull.frustum[0] = 1.0f;
+		cull.frustum[1] = 0.0f;
+		cull.frustum[2] = 1.0f;
+		cull.frustum[3] = 0.0f;
+		cull.frustum_offset[0] = half_width;
+		cull.frustum_offset[1] = half_height;
+		cull.znear = znear;
+		cull.zfar = zfar;
+		cull.contribution_scale_sq = 0.0f;
+		cull.min_pixels = 0.0f;
+
+		return cull;
+	}
+};
+
+static_assert(sizeof(CullData) == 112, "Must match the std430 layout of CullData in culling.glsl");
+
+
+// The header of RenderData in gpu_driven_renderer_includes.glsl, which the culling passes count into
+struct CullCounters {
+	uint32_t visible_count;
+	uint32_t instance_base;
+	uint32_t scatter_base;
+	uint32_t contribution_culled;
+	uint32_t draw_counts[2];		// Commands written by the early (or only) pass, and the late pass, for glMultiDrawElementsIndirectCount
+	uint32_t padding_2[2];
+};
+
+static_assert(sizeof(CullCounters) == 32, "Must match the std430 layout of RenderData");
+
+
+// Which pass the entity count shader is culling for. Must match the PHASE_ constants in entity_count.glsl.
+// Early and Late are the two halves of Hi-Z occlusion culling, All is a single pass without it.
+// The Shadow phases cull for a shadow cascade: frustum only, and either every caster, or only the static
+// or dynamic ones (see GPUEntity::flags), so the static ones can be cached.
+enum class CullPhase : uint32_t {
+	All = 0,
+	Early = 1,
+	Late = 2,
+	Shadow = 3,
+	ShadowStatic = 4,
+	ShadowDynamic = 5
+};
+
+
+// What sphere_cull() decided. Must match the CULL_ constants in culling.glsl.
+enum class CullResult : uint32_t {
+	Visible = 0,
+	Frustum = 1,		// Outside the frustum
+	Contribution = 2	// Inside, but too small on screen
+};
+
+
+// dist is how far the centre of the sphere is past a plane. It's outside if that's at least the radius.
+inline bool sphere_outside(float dist, float radius_sq) {
+	return dist >= 0.0f && dist * dist >= radius_sq;
+}
+
+
+inline float length_sq(float x, float y, float z) {
+	return x * x + y * y + z * z;
+}
+
+
+// The squared radius of a mesh's bounding sphere once transformed by model.
+// The largest axis scale grows the sphere, squared like everything else.
+inline float bounding_radius_sq(const glm::mat4& model, float radius) {
+	float scale_sq = std::max(std::max(
+		length_sq(model[0].x, model[0].y, model[0].z),
+		length_sq(model[1].x, model[1].y, model[1].z)),
+		length_sq(model[2].x, model[2].y, model[2].z));
+
+	return radius * radius * scale_sq;
+}
+
+
+// The smallest projected diameter, in pixels, a mesh is drawn at. A mesh's own min_pixels wins if it's positive.
+// Negative never culls the mesh, and 0 leaves it to the global one in CullData.
+inline float contribution_min_pixels(const CullData& cull, float mesh_min_pixels) {
+	return mesh_min_pixels > 0.0f ? mesh_min_pixels : mesh_min_pixels < 0.0f ? 0.0f : cull.min_pixels;
+}
+
+
+// Is a sphere at view space depth cz at least min_pixels across on screen? That's radius * scale / -cz >= min_pixels,
+// squared and multiplied out so there's no divide or sqrt.
+inline bool sphere_contributes(const CullData& cull, float cz, float radius_sq, float min_pixels) {
+	float min_pixels_sq = min_pixels * min_pixels;
+	return radius_sq * cull.contribution_scale_sq >= cz * cz * min_pixels_sq;
+}
+
+
+// Is a mesh's bounding sphere, centred on its origin, at least partly inside the frustum once transformed by model,
+// and no smaller than min_pixels across on screen?
+inline CullResult sphere_cull(const CullData& cull, const glm::mat4& view, const glm::mat4& model, float radius, float min_pixels) {
+	float radius_sq = bounding_radius_sq(model, radius);
+
+	// Centre in view space, looking down -z
+	float wx = model[3].x, wy = model[3].y, wz = model[3].z;
+
+	float cx = view[0].x * wx + view[1].x * wy + view[2].x * wz + view[3].x;
+	float cy = view[0].y * wx + view[1].y * wy + view[2].y * wz + view[3].y;
+	float cz = view[0].z * wx + view[1].z * wy + view[2].z * wz + view[3].z;
+
+	if (sphere_outside(std::fabs(cx) * cull.frustum[0] - cz * cull.frustum[1] - cull.frustum_offset[0], radius_sq)) return CullResult::Frustum;
+	if (sphere_outside(std::fabs(cy) * cull.frustum[2] - cz * cull.frustum[3] - cull.frustum_offset[1], radius_sq)) return CullResult::Frustum;
+
+	if (sphere_outside(cull.znear + cz, radius_sq)) return CullResult::Frustum;
+	if (sphere_outside(-cz - cull.zfar, radius_sq)) return CullResult::Frustum;
+
+	if (!sphere_contributes(cull, cz, radius_sq, min_pixels)) return CullResult::Contribution;
+
+	return CullResult::Visible;
+}
+
+
+// Just the frustum test
+inline bool sphere_visible(const CullData& cull, const glm::mat4& view, const glm::mat4& model, float radius) {
+	return sphere_cull(cull, view, model, radius, 0.0f) == CullResult::Visible;
+}
+
+
+// sphere_cull() for 8 spheres at once, given their world space centres, squared radii (from bounding_radius_sq())
+// and minimum sizes (from contribution_min_pixels()) as SoA.
+// The same operations in the same order, and no FMA, so every lane agrees with sphere_cull() bit for bit.
+// Returns a mask with bit i set if sphere i is visible. too_small gets the ones in the frustum but culled for their size.
+inline uint32_t sphere_visible_x8(const CullData& cull, const glm::mat4& view, const float* x, const float* y, const float* z, const float* radius_sq,
+	const float* min_pixels, uint32_t& too_small) {
+	const __m256 sign = _mm256_set1_ps(-0.0f);
+	const __m256 zero = _mm256_setzero_ps();
+
+	__m256 wx = _mm256_loadu_ps(x);
+	__m256 wy = _mm256_loadu_ps(y);
+	__m256 wz = _mm256_loadu_ps(z);
+	__m256 r_sq = _mm256_loadu_ps(radius_sq);
+
+	// Left to right, like the scalar version: ((a + b) + c) + d
+	auto transform = [&](int row) {
+		__m256 v = _mm256_mul_ps(_mm256_set1_ps(view[0][row]), wx);
+		v = _mm256_add_ps(v, _mm256_mul_ps(_mm256_set1_ps(view[1][row]), wy));
+		v = _mm256_add_ps(v, _mm256_mul_ps(_mm256_set1_ps(view[2][row]), wz));
+		return _mm256_add_ps(v, _mm256_set1_ps(view[3][row]));
+	};
+
+	__m256 cx = transform(0);
+	__m256 cy = transform(1);
+	__m256 cz = transform(2);
+
+	auto outside = [&](__m256 dist) {
+		return _mm256_and_ps(_mm256_cmp_ps(dist, zero, _CMP_GE_OQ), _mm256_cmp_ps(_mm256_mul_ps(dist, dist), r_sq, _CMP_GE_OQ));
+	};
+
+	__m256 side_x = _mm256_sub_ps(_mm256_mul_ps(_mm256_andnot_ps(sign, cx), _mm256_set1_ps(cull.frustum[0])), _mm256_mul_ps(cz, _mm256_set1_ps(cull.frustum[1])));
+	__m256 side_y = _mm256_sub_ps(_mm256_mul_ps(_mm256_andnot_ps(sign, cy), _mm256_set1_ps(cull.frustum[2])), _mm256_mul_ps(cz, _mm256_set1_ps(cull.frustum[3])));
+	side_x = _mm256_sub_ps(side_x, _mm256_set1_ps(cull.frustum_offset[0]));
+	side_y = _mm256_sub_ps(side_y, _mm256_set1_ps(cull.frustum_offset[1]));
+	__m256 near_dist = _mm256_add_ps(_mm256_set1_ps(cull.znear), cz);
+	__m256 far_dist = _mm256_sub_ps(_mm256_xor_ps(cz, sign), _mm256_set1_ps(cull.zfar));
+
+	__m256 culled = _mm256_or_ps(_mm256_or_ps(outside(side_x), outside(side_y)), _mm256_or_ps(outside(near_dist), outside(far_dist)));
+
+	__m256 min_pixels_8 = _mm256_loadu_ps(min_pixels);
+	__m256 min_pixels_sq = _mm256_mul_ps(min_pixels_8, min_pixels_8);
+	__m256 contributes = _mm256_cmp_ps(_mm256_mul_ps(r_sq, _mm256_set1_ps(cull.contribution_scale_sq)), _mm256_mul_ps(_mm256_mul_ps(cz, cz), min_pixels_sq), _CMP_GE_OQ);
+
+	uint32_t in_frustum = ~static_cast<uint32_t>(_mm256_movemask_ps(culled)) & 0xFFu;
+	uint32_t big_enough = static_cast<uint32_t>(_mm256_movemask_ps(contributes));
+
+	too_small = in_frustum & ~big_enough;
+	return in_frustum & big_enough;
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include <algorithm>
+
+#include "flecs.h"
+
+// Keeps a GPU array dense while entities come and go.
+// Each slot is owned by one entity. Removing a slot moves the last one into the hole (swap-remove),
+// so the caller has to point the moved entity at its new slot.
+// Slots whose contents are out of date are collected, and re-uploaded from their current owners
+// when the buffer is flushed. Doing it then, rather than when the slot changes, means a slot which
+// changes hands several times in a frame is uploaded once, with whoever owns it at the end.
+class DenseSlots {
+public:
+	// Hand out the next slot to owner
+	uint32_t add(flecs::entity_t owner) {
+		uint32_t slot = static_cast<uint32_t>(m_owners.size());
+		m_owners.push_back(owner);
+		m_stale.push_back(slot);
+		return slot;
+	}
+
+	// Add count slots which have already been uploaded
+	uint32_t add_uploaded(size_t count) {
+		uint32_t first = static_cast<uint32_t>(m_owners.size());
+		m_owners.resize(m_owners.size() + count, 0);
+		return first;
+	}
+
+	void set_owner(uint32_t slot, flecs::entity_t owner) {
+		m_owners[slot] = owner;
+	}
+
+	// Free a slot. Returns the entity which moved into it, or 0 if it was the last slot.
+	flecs::entity_t remove(uint32_t slot) {
+		flecs::entity_t moved = 0;
+		uint32_t last = static_cast<uint32_t>(m_owners.size() - 1);
+
+		if (slot != last) {
+			moved = m_owners[last];
+			m_owners[slot] = moved;
+			m_stale.push_back(slot);
+		}
+
+		m_owners.pop_back();
+		return moved;
+	}
+
+	void mark_stale(uint32_t slot) {
+		m_stale.push_back(slot);
+	}
+
+	// The slots which need uploading, each once, and only those still in use
+	std::vector<uint32_t> take_stale() {
+		std::sort(m_stale.begin(), m_stale.end());
+		m_stale.erase(std::unique(m_stale.begin(), m_stale.end()), m_stale.end());
+
+		auto end = std::lower_bound(m_stale.begin(), m_stale.end(), static_cast<uint32_t>(m_owners.size()));
+		std::vector<uint32_t> stale(m_stale.begin(), end);
+
+		m_stale.clear();
+		return stale;
+	}
+
+	flecs::entity_t owner(uint32_t slot) const { return m_owners[slot]; }
+	size_t size() const { return m_owners.size(); }
+
+private:
+	std::vector<flecs::entity_t> m_owners;
+	std::vector<uint32_t> m_stale;
+};
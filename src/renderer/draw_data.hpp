@@ -0,0 +1,47 @@
+#pragma once
+
+#include <cstdint>
+
+// What's drawn, as laid out in the Entities, Meshes and PerInstance buffers (see gpu_driven_renderer_includes.glsl).
+// The CPU draw path works from copies of the same data.
+
+// Represents a renderable entity on the GPU
+struct GPUEntity {
+	uint32_t mesh_idx;		// 4 bytes
+	uint32_t material_idx;	// 4 bytes
+	uint32_t transform_idx;	// 4 bytes
+	uint32_t flags;			// 4 bytes
+
+	// Has moved lately, see ShadowDynamic. Its shadow is drawn every frame, rather than cached with the static ones.
+	static constexpr uint32_t dynamic = 1;
+};
+
+// Represents a mesh on the GPU
+struct GPUMesh {
+	uint32_t num_vertices;
+	uint32_t first_idx;
+	int32_t base_vertex;
+	float bounding_sphere;
+	float min_pixels;		// Contribution culling threshold, see contribution_min_pixels() in culling.hpp
+};
+
+// Where a mesh's entities are in the Entities buffer, which is sorted by mesh and material
+struct MeshRange {
+	uint32_t first_entity;
+	uint32_t entity_count;
+};
+
+// One per instance drawn, fetched as a per-instance vertex attribute
+struct PerInstanceData {
+	uint32_t transform_idx;
+	uint32_t material_idx;
+};
+
+// The layout glMultiDrawElementsIndirect reads
+struct RenderCommand {
+	uint32_t count;
+	uint32_t instance_count;
+	uint32_t first_index;
+	int32_t base_vertex;
+	uint32_t base_instance;
+};
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <cstdint>
+#include <cassert>
+#include <algorithm>
+#include <bit>
+
+/*
+	64 bit draw sort keys. Sorting draws by these puts them in the order they're best submitted in:
+	grouped by whatever is most expensive to change, most significant first.
+
+		pass (2) | program (6) | vertex format (4) | mesh (20) | material (16) | depth (16)
+
+	Everything from mesh up is what a command is made of (see batch()), so consecutive keys with the same
+	batch are instances of one command. Material is bindless and per instance, so it doesn't split commands,
+	it only keeps each material's instances together. Depth is last, front to back for opaque passes, so
+	within a run the nearest things are drawn first and early-Z rejects more of what's behind them.
+
+	Fields a caller doesn't vary are the same in every key, and the radix sort skips those bytes.
+
+	Blended draws don't use these: their order is what's right, not what's cheap, so they're sorted by depth
+	alone (see TransparentDrawBuilder).
+*/
+
+namespace draw_key {
+	enum class Pass : uint32_t {
+		Opaque = 0,
+	};
+
+	constexpr uint32_t depth_bits = 16;
+	constexpr uint32_t material_bits = 16;
+	constexpr uint32_t mesh_bits = 20;
+	constexpr uint32_t vertex_format_bits = 4;
+	constexpr uint32_t program_bits = 6;
+	constexpr uint32_t pass_bits = 2;
+
+	static_assert(depth_bits + material_bits + mesh_bits + vertex_format_bits + program_bits + pass_bits == 64);
+
+	constexpr uint32_t material_shift = depth_bits;
+	constexpr uint32_t mesh_shift = material_shift + material_bits;
+	constexpr uint32_t vertex_format_shift = mesh_shift + mesh_bits;
+	constexpr uint32_t program_shift = vertex_format_shift + vertex_format_bits;
+	constexpr uint32_t pass_shift = program_shift + program_bits;
+
+	constexpr uint64_t mask(uint32_t bits) { return (uint64_t(1) << bits) - 1; }
+
+	// The top 16 bits of the float. Positive floats order the same as their bits, so this keeps the order
+	// with the precision spread out logarithmically, like the depth buffer's. Behind the camera counts as 0.
+	inline uint32_t quantize_depth(float distance) {
+		return std::bit_cast<uint32_t>(std::max(distance, 0.0f)) >> (32 - depth_bits);
+	}
+
+	// Anything past the end of material is only sorted less well, but mesh has to fit, as it decides the commands
+	inline uint64_t make(Pass pass, uint32_t program, uint32_t vertex_format, uint32_t mesh, uint32_t material, uint32_t depth) {
+		assert(mesh <= mask(mesh_bits));
+
+		return (uint64_t(pass) << pass_shift)
+			| ((program & mask(program_bits)) << program_shift)
+			| ((vertex_format & mask(vertex_format_bits)) << vertex_format_shift)
+			| (uint64_t(mesh) << mesh_shift)
+			| ((material & mask(material_bits)) << material_shift)
+			| (depth & mask(depth_bits));
+	}
+
+	inline uint64_t batch(uint64_t key) { return key >> mesh_shift; }
+	inline uint32_t mesh(uint64_t key) { return static_cast<uint32_t>((key >> mesh_shift) & mask(mesh_bits)); }
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <glm.hpp>
+
+#include "camera.hpp"
+
+// Everything that's the same for every draw in a frame. Uploaded to a std140 uniform block once
+// per frame, rather than set as uniforms on each program. Must match assets/shaders/frame_constants.glsl!
+struct alignas(16) FrameConstants {
+	glm::mat4 view;
+	glm::mat4 projection;
+	glm::mat4 vp;
+	glm::mat4 inverse_vp;		// Clip space back to world space, for positions from depth
+	glm::vec4 camera_pos;		// w unused
+	glm::vec2 viewport_size;
+	float znear;
+	float zfar;
+
+	static FrameConstants from_camera(const Camera& camera, glm::vec2 viewport_size) {
+		FrameConstants constants;
+
+		constants.view = camera.view();
+		constants.projection = camera.projection();
+		constants.vp = constants.projection * constants.view;
+		constants.inverse_vp = glm::inverse(constants.vp);
+		constants.camera_pos = glm::vec4(camera.position, 1.0f);
+		constants.viewport_size = viewport_size;
+		constants.znear = camera.near_clip;
+		constants.zfar = camera.far_clip;
+
+		return constants;
+	}
+};
+
+static_assert(sizeof(FrameConstants) == 4 * 64 + 16 + 16, "FrameConstants doesn't match the std140 layout");
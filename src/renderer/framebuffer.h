@@ -8,27 +8,20 @@
 class Framebuffer {
 public:
 	Framebuffer(uint32_t width, uint32_t height) : m_width(width), m_height(height) {
-		uint32_t color_attachment = gl::create_texture(GL_TEXTURE_2D);
-		gl::texture_parameter(color_attachment, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-		gl::texture_parameter(color_attachment, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-		gl::texture_parameter(color_attachment, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
-		gl::texture_parameter(color_attachment, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
-
-		gl::bind_texture(GL_TEXTURE_2D, color_attachment);
-		gl::texture_image(GL_TEXTURE_2D, 0, gl::TextureInternalFormat::RGBA16F, { m_width, m_height }, gl::TextureFormat::RGBA, gl::TextureBaseType::Float, 0);
+		glCreateFramebuffers(1, &m_gl_id);
+		create_attachments();
+	}
 
-		uint32_t depth_attachment = gl::create_texture(GL_TEXTURE_2D);
-		gl::texture_parameter(depth_attachment, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-		gl::texture_parameter(depth_attachment, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-		gl::texture_parameter(depth_attachment, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-		gl::texture_parameter(depth_attachment, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	// Recreates the attachments if the size changed, so it's cheap to call every frame
+	void resize(uint32_t width, uint32_t height) {
+		if (width == m_width && height == m_height) return;
 
-		gl::bind_texture(GL_TEXTURE_2D, depth_attachment);
-		gl::texture_image(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT, { m_width, m_height }, GL_DEPTH_COMPONENT, gl::TextureBaseType::Float, 0);
+		m_width = width;
+		m_height = height;
 
-		glCreateFramebuffers(1, &m_gl_id);
-		glNamedFramebufferTexture(m_gl_id, GL_COLOR_ATTACHMENT0, color_attachment, 0);
-		glNamedFramebufferTexture(m_gl_id, GL_DEPTH_ATTACHMENT, depth_attachment, 0);
+		glDeleteTextures(1, &m_color_attachment);
+		glDeleteTextures(1, &m_depth_attachment);
+		create_attachments();
 	}
 
 	void bind() {
@@ -39,17 +32,56 @@ public:
 		glClearNamedFramebufferfv(m_gl_id, GL_COLOR, 0, &color[0]);
 	}
 
-	void clear_depth() {
-		float zero = 0;
-		glClearNamedFramebufferfv(m_gl_id, GL_DEPTH, 0, &zero);
+	// 1 is the far plane, for GL_LESS.
+	// Clears are masked like any other depth write, and the transparent pass leaves them off.
+	void clear_depth(float depth = 1.0f) {
+		glDepthMask(GL_TRUE);
+		glClearNamedFramebufferfv(m_gl_id, GL_DEPTH, 0, &depth);
 	}
 
 	void unbind() {
 		glBindFramebuffer(GL_FRAMEBUFFER, 0);
 	}
 
+	// Copy the colour attachment to the same place in the default framebuffer
+	void blit_to_screen() {
+		glBlitNamedFramebuffer(m_gl_id, 0, 0, 0, m_width, m_height, 0, 0, m_width, m_height, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+	}
+
+	uint32_t get_color_texture() const { return m_color_attachment; }
+	uint32_t get_depth_texture() const { return m_depth_attachment; }
+
+	uint32_t get_width() const { return m_width; }
+	uint32_t get_height() const { return m_height; }
+
 private:
+	void create_attachments() {
+		m_color_attachment = gl::create_texture(GL_TEXTURE_2D);
+		gl::texture_parameter(m_color_attachment, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		gl::texture_parameter(m_color_attachment, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		gl::texture_parameter(m_color_attachment, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
+		gl::texture_parameter(m_color_attachment, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
+
+		gl::bind_texture(GL_TEXTURE_2D, m_color_attachment);
+		gl::texture_image(GL_TEXTURE_2D, 0, gl::TextureInternalFormat::RGBA16F, { m_width, m_height }, gl::TextureFormat::RGBA, gl::TextureBaseType::Float, 0);
+
+		// Float depth, so it can be read back exactly when building the Hi-Z pyramid
+		m_depth_attachment = gl::create_texture(GL_TEXTURE_2D);
+		gl::texture_parameter(m_depth_attachment, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		gl::texture_parameter(m_depth_attachment, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		gl::texture_parameter(m_depth_attachment, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		gl::texture_parameter(m_depth_attachment, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+		gl::bind_texture(GL_TEXTURE_2D, m_depth_attachment);
+		gl::texture_image(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT32F, { m_width, m_height }, GL_DEPTH_COMPONENT, gl::TextureBaseType::Float, 0);
+
+		glNamedFramebufferTexture(m_gl_id, GL_COLOR_ATTACHMENT0, m_color_attachment, 0);
+		glNamedFramebufferTexture(m_gl_id, GL_DEPTH_ATTACHMENT, m_depth_attachment, 0);
+	}
+
 	uint32_t m_gl_id = 0;
+	uint32_t m_color_attachment = 0;
+	uint32_t m_depth_attachment = 0;
 
 	uint32_t m_width, m_height;
 };
\ No newline at end of file
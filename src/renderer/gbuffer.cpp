@@ -0,0 +1,64 @@
+#include "gbuffer.hpp"
+
+#include "util.hpp"
+
+
+GBuffer::~GBuffer() {
+	if (m_framebuffer) glDeleteFramebuffers(1, &m_framebuffer);
+	if (m_albedo_metallic) glDeleteTextures(1, &m_albedo_metallic);
+	if (m_normal_roughness) glDeleteTextures(1, &m_normal_roughness);
+}
+
+
+void GBuffer::resize(uint32_t width, uint32_t height, uint32_t depth_texture) {
+	glm::uvec2 size = { width, height };
+
+	if (!m_framebuffer) {
+		glCreateFramebuffers(1, &m_framebuffer);
+
+		const GLenum draw_buffers[] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1 };
+		glNamedFramebufferDrawBuffers(m_framebuffer, 2, draw_buffers);
+	}
+
+	bool resized = size != m_size || !m_albedo_metallic;
+
+	if (resized) {
+		// Immutable storage, so they have to be recreated rather than resized
+		if (m_albedo_metallic) {
+			glDeleteTextures(1, &m_albedo_metallic);
+			glDeleteTextures(1, &m_normal_roughness);
+		}
+
+		m_size = size;
+
+		glCreateTextures(GL_TEXTURE_2D, 1, &m_albedo_metallic);
+		glCreateTextures(GL_TEXTURE_2D, 1, &m_normal_roughness);
+
+		glTextureStorage2D(m_albedo_metallic, 1, GL_RGBA8, width, height);
+		glTextureStorage2D(m_normal_roughness, 1, GL_RGB10_A2, width, height);
+
+		// Only ever read with texelFetch
+		for (uint32_t texture : { m_albedo_metallic, m_normal_roughness }) {
+			glTextureParameteri(texture, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+			glTextureParameteri(texture, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+			glTextureParameteri(texture, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+			glTextureParameteri(texture, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		}
+
+		glNamedFramebufferTexture(m_framebuffer, GL_COLOR_ATTACHMENT0, m_albedo_metallic, 0);
+		glNamedFramebufferTexture(m_framebuffer, GL_COLOR_ATTACHMENT1, m_normal_roughness, 0);
+	}
+
+	// The framebuffer recreates its depth when it resizes too, and GL can hand out the same name again
+	if (resized || depth_texture != m_depth_texture) {
+		m_depth_texture = depth_texture;
+		glNamedFramebufferTexture(m_framebuffer, GL_DEPTH_ATTACHMENT, m_depth_texture, 0);
+	}
+
+	GL_ERROR_CHECK();
+}
+
+
+void GBuffer::bind() {
+	glBindFramebuffer(GL_FRAMEBUFFER, m_framebuffer);
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <cstdint>
+
+#include "glad/gl.h"
+#include <glm.hpp>
+
+/*
+	The G-buffer for deferred shading. The opaque pass writes each pixel's surface here rather than lighting it,
+	then assets/shaders/deferred_lighting.glsl lights every pixel once, into the framebuffer's colour.
+
+		0: RGBA8		albedo, metallic
+		1: RGB10_A2		octahedral normal, roughness
+		depth			the framebuffer's, shared, so the prepass, Hi-Z and transparent pass all work as before
+
+	8 bytes of colour a pixel, plus the depth the forward path has anyway.
+	Nothing is cleared: the lighting pass skips pixels at the far plane, and everything else was written.
+
+	Usage:
+		gbuffer.resize(width, height, framebuffer.get_depth_texture());
+		gbuffer.bind();
+		// Draw the opaque pass with gbuffer.glsl
+		glBindTextureUnit(3, gbuffer.get_albedo_metallic());	// The samplers in deferred_lighting.glsl
+		glBindTextureUnit(4, gbuffer.get_normal_roughness());
+		glBindTextureUnit(5, framebuffer.get_depth_texture());
+*/
+
+class GBuffer {
+public:
+	GBuffer() = default;
+	~GBuffer();
+
+	GBuffer(const GBuffer&) = delete;
+	GBuffer& operator=(const GBuffer&) = delete;
+
+	// Recreates the attachments if the size changed, and picks up the depth texture if it was recreated,
+	// so it's cheap to call every frame
+	void resize(uint32_t width, uint32_t height, uint32_t depth_texture);
+
+	void bind();
+
+	uint32_t get_albedo_metallic() const { return m_albedo_metallic; }
+	uint32_t get_normal_roughness() const { return m_normal_roughness; }
+	glm::uvec2 get_size() const { return m_size; }
+
+private:
+	uint32_t m_framebuffer = 0;
+	uint32_t m_albedo_metallic = 0;
+	uint32_t m_normal_roughness = 0;
+	uint32_t m_depth_texture = 0;	// Not ours
+	glm::uvec2 m_size = { 0, 0 };
+};
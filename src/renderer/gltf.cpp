@@ -100,6 +100,7 @@ uint32_t GLTF::get_material(MeshBundle& mb, size_t material_idx) {
 
         if (material.alphaMode == fastgltf::AlphaMode::Blend) {
             m.blend = true;
+            m.alpha = material.pbrData.baseColorFactor[3];
         }
 
         m_material_map[material_idx] = mb.register_material(m);
@@ -183,7 +184,8 @@ Light GLTF::get_light(size_t light_idx) {
 
     return {
         .color = glm::vec3(light.color[0], light.color[1], light.color[2]),
-        .intensity = light.intensity
+        .intensity = light.intensity,
+        .radius = light.range.has_value() ? static_cast<float>(*light.range) : 0.0f
     };
 }
 
@@ -0,0 +1,292 @@
+
+#include "gpu_heap.hpp"
+
+#include <bit>
+#include <cassert>
+
+
+static int floor_log2(size_t x) {
+	return static_cast<int>(std::bit_width(x)) - 1;
+}
+
+
+TLSFAllocator::TLSFAllocator(size_t capacity) {
+	for (auto& fl : m_bins) {
+		for (auto& bin : fl) bin = null_block;
+	}
+
+	grow(capacity);
+}
+
+
+void TLSFAllocator::mapping_insert(size_t size, int& fl, int& sl) {
+	if (size < sl_count) {
+		// Small sizes get one bin each
+		fl = 0;
+		sl = static_cast<int>(size);
+	}
+	else {
+		int log2 = floor_log2(size);
+		sl = static_cast<int>((size >> (log2 - sl_bits)) ^ sl_count);
+		fl = log2 - sl_bits + 1;
+	}
+}
+
+
+void TLSFAllocator::mapping_search(size_t size, int& fl, int& sl) {
+	// Round up to the next bin boundary, so any block in the bin we land in is big enough
+	if (size >= sl_count) {
+		size += (size_t(1) << (floor_log2(size) - sl_bits)) - 1;
+	}
+
+	mapping_insert(size, fl, sl);
+}
+
+
+uint32_t TLSFAllocator::new_block(size_t offset, size_t size) {
+	uint32_t index;
+
+	if (m_unused_blocks.size() > 0) {
+		index = m_unused_blocks.back();
+		m_unused_blocks.pop_back();
+		m_blocks[index] = Block{ offset, size };
+	}
+	else {
+		index = static_cast<uint32_t>(m_blocks.size());
+		m_blocks.push_back(Block{ offset, size });
+	}
+
+	return index;
+}
+
+
+void TLSFAllocator::release_block(uint32_t block) {
+	m_blocks[block] = Block{ 0, 0 };
+	m_unused_blocks.push_back(block);
+}
+
+
+void TLSFAllocator::insert_free(uint32_t block) {
+	int fl, sl;
+	mapping_insert(m_blocks[block].size, fl, sl);
+
+	uint32_t head = m_bins[fl][sl];
+
+	m_blocks[block].free = true;
+	m_blocks[block].prev_free = null_block;
+	m_blocks[block].next_free = head;
+
+	if (head != null_block) m_blocks[head].prev_free = block;
+
+	m_bins[fl][sl] = block;
+	m_fl_bitmap |= uint64_t(1) << fl;
+	m_sl_bitmap[fl] |= 1u << sl;
+}
+
+
+void TLSFAllocator::remove_free(uint32_t block) {
+	int fl, sl;
+	mapping_insert(m_blocks[block].size, fl, sl);
+
+	Block& b = m_blocks[block];
+
+	if (b.prev_free != null_block) m_blocks[b.prev_free].next_free = b.next_free;
+	if (b.next_free != null_block) m_blocks[b.next_free].prev_free = b.prev_free;
+
+	if (m_bins[fl][sl] == block) {
+		m_bins[fl][sl] = b.next_free;
+
+		if (b.next_free == null_block) {
+			m_sl_bitmap[fl] &= ~(1u << sl);
+			if (m_sl_bitmap[fl] == 0) m_fl_bitmap &= ~(uint64_t(1) << fl);
+		}
+	}
+
+	b.free = false;
+	b.prev_free = null_block;
+	b.next_free = null_block;
+}
+
+
+uint32_t TLSFAllocator::split(uint32_t block, size_t size) {
+	uint32_t rest = new_block(m_blocks[block].offset + size, m_blocks[block].size - size);
+
+	// new_block might have moved m_blocks, so no references until now
+	Block& b = m_blocks[block];
+	Block& r = m_blocks[rest];
+
+	r.prev_physical = block;
+	r.next_physical = b.next_physical;
+
+	if (b.next_physical != null_block) m_blocks[b.next_physical].prev_physical = rest;
+	else m_last_block = rest;
+
+	b.next_physical = rest;
+	b.size = size;
+
+	return rest;
+}
+
+
+HeapAllocation TLSFAllocator::allocate(size_t bytes, size_t alignment) {
+	size_t size = std::max<size_t>((bytes + granularity - 1) / granularity, 1);
+	size_t align = std::max<size_t>(alignment / granularity, 1);
+
+	assert(std::has_single_bit(align));
+
+	// Ask for enough that an aligned start is guaranteed to fit
+	int fl, sl;
+	mapping_search(size + align - 1, fl, sl);
+
+	if (fl >= fl_count) return {};
+
+	uint32_t sl_map = m_sl_bitmap[fl] & (~0u << sl);
+
+	if (sl_map == 0) {
+		uint64_t fl_map = fl + 1 < 64 ? m_fl_bitmap & (~uint64_t(0) << (fl + 1)) : 0;
+		if (fl_map == 0) return {};
+
+		fl = std::countr_zero(fl_map);
+		sl_map = m_sl_bitmap[fl];
+	}
+
+	sl = std::countr_zero(sl_map);
+
+	uint32_t block = m_bins[fl][sl];
+	remove_free(block);
+
+	// Give the padding before the aligned start back
+	size_t offset = m_blocks[block].offset;
+	size_t aligned = (offset + align - 1) & ~(align - 1);
+
+	if (aligned > offset) {
+		uint32_t front = block;
+		block = split(front, aligned - offset);
+		insert_free(front);
+	}
+
+	// ...and whatever is left at the end
+	if (m_blocks[block].size > size) {
+		insert_free(split(block, size));
+	}
+
+	m_used += size;
+	m_allocations++;
+
+	return { m_blocks[block].offset * granularity, size * granularity, block };
+}
+
+
+void TLSFAllocator::free(const HeapAllocation& allocation) {
+	uint32_t block = allocation.block;
+	assert(allocation && !m_blocks[block].free);
+
+	m_used -= m_blocks[block].size;
+	m_allocations--;
+
+	// Merge with the neighbours, if they are free too
+	uint32_t prev = m_blocks[block].prev_physical;
+
+	if (prev != null_block && m_blocks[prev].free) {
+		remove_free(prev);
+
+		m_blocks[prev].size += m_blocks[block].size;
+		m_blocks[prev].next_physical = m_blocks[block].next_physical;
+
+		if (m_blocks[block].next_physical != null_block) m_blocks[m_blocks[block].next_physical].prev_physical = prev;
+		if (m_last_block == block) m_last_block = prev;
+
+		release_block(block);
+		block = prev;
+	}
+
+	uint32_t next = m_blocks[block].next_physical;
+
+	if (next != null_block && m_blocks[next].free) {
+		remove_free(next);
+
+		m_blocks[block].size += m_blocks[next].size;
+		m_blocks[block].next_physical = m_blocks[next].next_physical;
+
+		if (m_blocks[next].next_physical != null_block) m_blocks[m_blocks[next].next_physical].prev_physical = block;
+		if (m_last_block == next) m_last_block = block;
+
+		release_block(next);
+	}
+
+	insert_free(block);
+}
+
+
+void TLSFAllocator::grow(size_t new_capacity) {
+	size_t capacity = new_capacity / granularity;
+	if (capacity <= m_capacity) return;
+
+	size_t extra = capacity - m_capacity;
+
+	if (m_last_block != null_block && m_blocks[m_last_block].free) {
+		// Just extend the free block at the end
+		remove_free(m_last_block);
+		m_blocks[m_last_block].size += extra;
+		insert_free(m_last_block);
+	}
+	else {
+		uint32_t block = new_block(m_capacity, extra);
+		m_blocks[block].prev_physical = m_last_block;
+
+		if (m_last_block != null_block) m_blocks[m_last_block].next_physical = block;
+		m_last_block = block;
+
+		insert_free(block);
+	}
+
+	m_capacity = capacity;
+}
+
+
+HeapStats TLSFAllocator::stats() const {
+	HeapStats stats;
+
+	stats.capacity = m_capacity * granularity;
+	stats.used = m_used * granularity;
+	stats.free = stats.capacity - stats.used;
+	stats.allocations = m_allocations;
+
+	for (int fl = 0; fl < fl_count; fl++) {
+		for (int sl = 0; sl < sl_count; sl++) {
+			for (uint32_t block = m_bins[fl][sl]; block != null_block; block = m_blocks[block].next_free) {
+				stats.free_blocks++;
+				stats.largest_free = std::max(stats.largest_free, m_blocks[block].size * granularity);
+			}
+		}
+	}
+
+	return stats;
+}
+
+
+
+HeapAllocation GPUHeap::allocate(size_t size, size_t alignment) {
+	HeapAllocation allocation = m_allocator.allocate(size, alignment);
+
+	if (!allocation) {
+		// Grow by whole pages, with enough room for the allocation even if the end is in use
+		size_t page = page_size();
+		size_t needed = m_allocator.capacity() + size + alignment;
+
+		m_allocator.grow((needed + page - 1) / page * page);
+		allocation = m_allocator.allocate(size, alignment);
+	}
+
+	return allocation;
+}
+
+
+bool GPUHeap::commit() {
+	if (m_allocator.capacity() <= reserved_size()) return false;
+
+	uint32_t old_id = get_id();
+	resize(m_allocator.capacity());
+
+	return get_id() != old_id;
+}
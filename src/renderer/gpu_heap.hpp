@@ -0,0 +1,128 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "buffer.hpp"
+
+/*
+	A TLSF (two level segregated fit) offset allocator, and a GPU buffer which uses it to hand out ranges.
+
+	Free blocks are kept in bins by size: the first level is the power of two, and the second level splits
+	each power of two into 8 linear steps. Two levels of bitmaps find a bin with a big enough block in
+	constant time, and freed blocks are merged with their free neighbours straight away.
+
+	Everything is in 16 byte granules internally, so nothing smaller than that is handed out.
+*/
+
+struct HeapAllocation {
+	size_t offset = 0;		// In bytes
+	size_t size = 0;		// In bytes, rounded up to the granularity
+	uint32_t block = UINT32_MAX;
+
+	operator bool() const { return block != UINT32_MAX; }
+};
+
+
+struct HeapStats {
+	size_t capacity = 0;
+	size_t used = 0;
+	size_t free = 0;
+	size_t largest_free = 0;
+	uint32_t allocations = 0;
+	uint32_t free_blocks = 0;
+
+	// 0 when all the free space is in one block, approaching 1 as it is split into many small ones
+	float fragmentation() const {
+		return free ? 1.0f - float(largest_free) / float(free) : 0.0f;
+	}
+};
+
+
+class TLSFAllocator {
+public:
+	static constexpr size_t granularity = 16;
+
+	TLSFAllocator(size_t capacity = 0);
+
+	// Returns an empty allocation if there's no free block big enough. alignment must be a power of two.
+	HeapAllocation allocate(size_t size, size_t alignment = granularity);
+	void free(const HeapAllocation& allocation);
+
+	// Add free space at the end
+	void grow(size_t new_capacity);
+
+	size_t capacity() const { return m_capacity * granularity; }
+	HeapStats stats() const;
+
+private:
+	static constexpr uint32_t null_block = UINT32_MAX;
+
+	static constexpr int sl_bits = 3;
+	static constexpr int sl_count = 1 << sl_bits;
+	static constexpr int fl_count = 40;
+
+	struct Block {
+		size_t offset;	// In granules
+		size_t size;
+
+		uint32_t prev_physical = null_block;
+		uint32_t next_physical = null_block;
+
+		uint32_t prev_free = null_block;
+		uint32_t next_free = null_block;
+
+		bool free = false;
+	};
+
+	// Bin that a block of this size is filed under
+	static void mapping_insert(size_t size, int& fl, int& sl);
+
+	// First bin in which every block is at least this big
+	static void mapping_search(size_t size, int& fl, int& sl);
+
+	uint32_t new_block(size_t offset, size_t size);
+	void release_block(uint32_t block);
+
+	void insert_free(uint32_t block);
+	void remove_free(uint32_t block);
+
+	// Split a free block in two, returning the second half, which is left out of the bins
+	uint32_t split(uint32_t block, size_t size);
+
+	std::vector<Block> m_blocks;
+	std::vector<uint32_t> m_unused_blocks;
+
+	uint64_t m_fl_bitmap = 0;
+	uint32_t m_sl_bitmap[fl_count] = {};
+	uint32_t m_bins[fl_count][sl_count];
+
+	size_t m_capacity = 0;			// In granules
+	size_t m_used = 0;
+	uint32_t m_allocations = 0;
+	uint32_t m_last_block = null_block;	// Highest physical block, for growing
+};
+
+
+// A Buffer whose contents are handed out as ranges by a TLSFAllocator.
+// Allocating is CPU side only, so it is safe to do from the StageGPUData systems. The GL buffer
+// catches up in page sized steps with commit(), or whenever a write lands past its end.
+class GPUHeap : public Buffer {
+public:
+	static constexpr size_t default_page_size = 16 * 1024 * 1024;
+
+	GPUHeap(BufferUsage usage = BufferUsage::STATIC, size_t page_size = default_page_size)
+		: Buffer(usage, page_size) {}
+
+	HeapAllocation allocate(size_t size, size_t alignment = TLSFAllocator::granularity);
+	void free(const HeapAllocation& allocation) { m_allocator.free(allocation); }
+
+	// Grow the GL buffer to cover everything allocated. GL, so main thread only!
+	// Returns true if the buffer was reallocated.
+	bool commit();
+
+	HeapStats stats() const { return m_allocator.stats(); }
+
+private:
+	TLSFAllocator m_allocator;
+};
@@ -0,0 +1,63 @@
+
+#include "hiz.hpp"
+
+#include <algorithm>
+#include <bit>
+
+#include "util.hpp"
+#include "assets/asset_manager.hpp"
+#include "instrumentation/instrumentor.hpp"
+
+
+HiZPyramid::~HiZPyramid() {
+	if (m_texture) glDeleteTextures(1, &m_texture);
+}
+
+
+void HiZPyramid::resize(uint32_t width, uint32_t height) {
+	glm::uvec2 size = { std::max(std::bit_floor(width), 1u), std::max(std::bit_floor(height), 1u) };
+	if (size == m_size && m_texture) return;
+
+	// Immutable storage, so it has to be recreated rather than resized
+	if (m_texture) glDeleteTextures(1, &m_texture);
+
+	m_size = size;
+	m_levels = std::bit_width(std::max(size.x, size.y));
+
+	glCreateTextures(GL_TEXTURE_2D, 1, &m_texture);
+	glTextureStorage2D(m_texture, m_levels, GL_R32F, m_size.x, m_size.y);
+
+	glTextureParameteri(m_texture, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+	glTextureParameteri(m_texture, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTextureParameteri(m_texture, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTextureParameteri(m_texture, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+}
+
+
+void HiZPyramid::build(uint32_t depth_texture, uint32_t width, uint32_t height) {
+	PROFILE_FUNC();
+
+	static Ref<Shader> reduce_shader = asset_manager.GetByPath<Shader>("assets/shaders/hiz_reduce.glsl");
+	static Shader::UniformHandle source_level = reduce_shader->uniform_handle("source_level");
+
+	resize(width, height);
+
+	reduce_shader->use();
+
+	for (uint32_t level = 0; level < m_levels; level++) {
+		// Level 0 comes from the depth buffer, the rest from the level below
+		glBindTextureUnit(0, level == 0 ? depth_texture : m_texture);
+		glBindImageTexture(0, m_texture, level, GL_FALSE, 0, GL_WRITE_ONLY, GL_R32F);
+
+		reduce_shader->set<int32_t>(source_level, level == 0 ? 0 : level - 1);
+		reduce_shader->upload_uniforms();
+
+		glm::uvec2 level_size = glm::max(m_size >> level, glm::uvec2(1));
+		glDispatchCompute((level_size.x + 7) / 8, (level_size.y + 7) / 8, 1);
+
+		// The next level, and the culling pass after that, read what was just written
+		glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+	}
+
+	GL_ERROR_CHECK();
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <cstdint>
+
+#include "glad/gl.h"
+#include <glm.hpp>
+
+#include "shader.hpp"
+
+/*
+	A hierarchical depth (Hi-Z) pyramid, for occlusion culling.
+
+	Each texel of a level holds the farthest depth of everything it covers in the level below, so if a box
+	on screen is farther than every texel it touches, at any level, nothing behind it can be seen.
+	Level 0 is the depth buffer rounded down to a power of two, so every level after it halves exactly.
+
+	Usage, once the depth to cull against has been drawn:
+		hiz.build(depth_texture, width, height);
+		glBindTextureUnit(1, hiz.get_texture());	// depth_pyramid in occlusion.glsl
+*/
+
+class HiZPyramid {
+public:
+	HiZPyramid() = default;
+	~HiZPyramid();
+
+	HiZPyramid(const HiZPyramid&) = delete;
+	HiZPyramid& operator=(const HiZPyramid&) = delete;
+
+	// Reduce depth_texture (a float depth attachment) into the pyramid, resizing it to match if needed
+	void build(uint32_t depth_texture, uint32_t width, uint32_t height);
+
+	uint32_t get_texture() const { return m_texture; }
+	glm::uvec2 get_size() const { return m_size; }
+	uint32_t get_levels() const { return m_levels; }
+
+private:
+	void resize(uint32_t width, uint32_t height);
+
+	uint32_t m_texture = 0;
+	glm::uvec2 m_size = { 0, 0 };
+	uint32_t m_levels = 0;
+};
@@ -4,7 +4,7 @@
 #include "glad/gl.h"
 
 IndexBuffer::IndexBuffer(BufferUsage usage, ShaderDataType type) 
-	: Buffer(usage), m_type(type) {
+	: GPUHeap(usage), m_type(type) {
 }
 
 IndexBuffer::~IndexBuffer() {
@@ -5,13 +5,13 @@
 
 #include "glm.hpp"
 
-#include "buffer.hpp"
+#include "gpu_heap.hpp"
 #include "types.hpp"
 
 // This file provides a basic high level abstraction for an index buffer
 // TODO: Make a generic buffer interface for all types of buffers?
 
-class IndexBuffer : public Buffer {
+class IndexBuffer : public GPUHeap {
 public:
 	IndexBuffer(BufferUsage usage=BufferUsage::STATIC, ShaderDataType sdt=ShaderDataType::U32);
 	~IndexBuffer();
@@ -1,24 +1,41 @@
 #pragma once
 
+#include <cstdint>
+
 #include <glm.hpp>
 
 struct Light {
-	// Let's think about using SSO so we don't need all this padding!
-	struct Light_STD140 {
+	// What the renderer keeps for each light, a slot per light, on the CPU only. The shaders don't read these:
+	// every frame the ones in view are compacted into VisibleLights' SoA arrays, which they do.
+	struct Packed {
 		glm::vec3 position;
-		uint8_t _p_0[4];
-		glm::vec3 color;
-		float intensity;
+		float radius_sq;
+		uint16_t radiance[4];		// color * intensity, as halfs. The fourth is padding.
 	};
-	
-	Light_STD140 STD140(glm::vec3 position) const {
-		return Light_STD140{
-			.position = position,
-			.color = color,
-			.intensity = intensity
-		};
+
+	// Lights without a radius of their own fade out to nothing where they'd add less than this
+	static constexpr float cutoff = 0.25f;
+
+	// How far a light of the given intensity reaches, squared: where intensity / d^2 falls to cutoff
+	static float radius_sq(float intensity) {
+		return intensity * (1.0f / cutoff);
+	}
+
+	// How far this light reaches, squared
+	float range_sq() const {
+		return radius > 0.0f ? radius * radius : radius_sq(intensity);
 	}
 
 	glm::vec3 color;
 	float intensity;
+	float radius = 0.0f;	// Where it fades out to nothing. 0 works it out from intensity, see radius_sq().
+};
+
+
+// A light infinitely far away, like the sun, which lights everything from the same direction.
+// The renderer uses the first one it finds, and gives it cascaded shadows (see CascadedShadowMap).
+struct DirectionalLight {
+	glm::vec3 direction;	// The way the light travels, doesn't have to be normalized
+	glm::vec3 color;
+	float intensity;
 };
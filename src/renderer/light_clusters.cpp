@@ -0,0 +1,118 @@
+#include "light_clusters.hpp"
+
+#include <chrono>
+#include <cmath>
+
+#include "instrumentation/instrumentor.hpp"
+
+
+bool ClusterGrid::update(const glm::mat4& projection, float znear, float zfar) {
+	if (!boxes.empty() && projection == m_projection && znear == m_znear && zfar == m_zfar) return false;
+
+	m_projection = projection;
+	m_znear = znear;
+	m_zfar = zfar;
+
+	float depth_range_log = std::log(zfar / znear);
+
+	constants.dims = { tiles_x, tiles_y, slices, max_lights };
+	constants.depth_scale = slices / depth_range_log;
+	constants.depth_bias = -(slices * std::log(znear)) / depth_range_log;
+
+	boxes.resize(cluster_count);
+
+	for (uint32_t z = 0; z < slices; z++) {
+		float near_depth = znear * std::pow(zfar / znear, float(z) / slices);
+		float far_depth = znear * std::pow(zfar / znear, float(z + 1) / slices);
+
+		for (uint32_t y = 0; y < tiles_y; y++) {
+			// Where the tile's edges are in view space, per unit of depth
+			float y0 = (2.0f * y / tiles_y - 1.0f) / projection[1][1];
+			float y1 = (2.0f * (y + 1) / tiles_y - 1.0f) / projection[1][1];
+
+			for (uint32_t x = 0; x < tiles_x; x++) {
+				float x0 = (2.0f * x / tiles_x - 1.0f) / projection[0][0];
+				float x1 = (2.0f * (x + 1) / tiles_x - 1.0f) / projection[0][0];
+
+				// The edges spread out with depth, so the box is as wide as whichever end is wider
+				ClusterBox& box = boxes[index(x, y, z)];
+				box.min = { std::min(x0 * near_depth, x0 * far_depth), std::min(y0 * near_depth, y0 * far_depth), -far_depth, 0.0f };
+				box.max = { std::max(x1 * near_depth, x1 * far_depth), std::max(y1 * near_depth, y1 * far_depth), -near_depth, 0.0f };
+			}
+		}
+	}
+
+	return true;
+}
+
+
+void LightClusterBinner::build(WorkerPool& pool, const ClusterGrid& grid, const glm::mat4& view, std::span<const glm::vec4> spheres) {
+	PROFILE_FUNC();
+
+	auto start = std::chrono::high_resolution_clock::now();
+
+	uint32_t light_count = static_cast<uint32_t>(spheres.size());
+
+	m_spheres.resize(light_count);
+	for (uint32_t i = 0; i < light_count; i++) m_spheres[i] = light_view_sphere(view, spheres[i]);
+
+	m_lists.resize(size_t(ClusterGrid::cluster_count) * ClusterGrid::stride);
+
+	m_workers.resize(pool.size());
+
+	for (Worker& worker : m_workers) {
+		worker.references = 0;
+		worker.max_per_cluster = 0;
+		worker.overflowed = 0;
+	}
+
+	// A slice at a time. Lights that don't reach the slice's depth range can't reach any of its clusters:
+	// the z term alone is already past their radius, and adding the others can only make it bigger.
+	// So each slice's lights are picked out first, still in order, and only those are tested per cluster.
+	constexpr uint32_t slice_size = ClusterGrid::tiles_x * ClusterGrid::tiles_y;
+
+	pool.parallel_for(ClusterGrid::slices, 1, [&](uint32_t begin, uint32_t end, uint32_t worker_idx) {
+		Worker& worker = m_workers[worker_idx];
+
+		for (uint32_t slice = begin; slice < end; slice++) {
+			const ClusterBox& slice_box = grid.boxes[ClusterGrid::index(0, 0, slice)];
+
+			worker.candidates.clear();
+
+			for (uint32_t i = 0; i < light_count; i++) {
+				float dz = axis_outside(m_spheres[i].z, slice_box.min.z, slice_box.max.z);
+				if (dz * dz <= m_spheres[i].w) worker.candidates.push_back(i);
+			}
+
+			for (uint32_t cluster = slice * slice_size; cluster < (slice + 1) * slice_size; cluster++) {
+				const ClusterBox& box = grid.boxes[cluster];
+				uint32_t* list = &m_lists[size_t(cluster) * ClusterGrid::stride];
+				uint32_t count = 0;
+
+				for (uint32_t i : worker.candidates) {
+					if (!sphere_in_cluster(m_spheres[i], box)) continue;
+
+					if (count < ClusterGrid::max_lights) list[1 + count] = i;
+					count++;
+				}
+
+				list[0] = std::min(count, ClusterGrid::max_lights);
+
+				worker.references += list[0];
+				worker.max_per_cluster = std::max(worker.max_per_cluster, count);
+				worker.overflowed += count > ClusterGrid::max_lights;
+			}
+		}
+	});
+
+	m_stats = {};
+	m_stats.lights = light_count;
+
+	for (const Worker& worker : m_workers) {
+		m_stats.references += worker.references;
+		m_stats.max_per_cluster = std::max(m_stats.max_per_cluster, worker.max_per_cluster);
+		m_stats.overflowed += worker.overflowed;
+	}
+
+	m_stats.ms = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+}
@@ -0,0 +1,133 @@
+#pragma once
+
+#include <cstdint>
+#include <span>
+#include <vector>
+#include <algorithm>
+
+#include <glm.hpp>
+
+#include "worker_pool.hpp"
+
+/*
+	Clustered light culling. The view frustum is cut into a grid of clusters: tiles across the screen, by
+	slices in depth, spaced logarithmically so each is about as deep as it is wide. Every frame each cluster
+	gets a list of the visible lights (see VisibleLights) whose radius reaches into it, and a fragment only
+	shades with its own cluster's list.
+
+	The lists are built on the GPU by assets/shaders/build_light_clusters.glsl. LightClusterBinner is the same
+	thing on the CPU, operation for operation, like culling.hpp is for culling.glsl, so it gives the same lists
+	in the same order, and the GPU's can be checked against it. The same rules apply: the GLSL is precise,
+	there are no sqrts, and matrix maths is written out by hand. The shared parts are in light_clusters.glsl.
+
+	A cluster's bounds only change with the projection, so they're worked out here by ClusterGrid, and
+	uploaded when they do. Both sides test against those same boxes.
+
+	Each cluster's list is ClusterGrid::stride uints: its count, then up to max_lights indices into the
+	visible lights, in order. Lights past max_lights are dropped.
+*/
+
+// A cluster's box in view space, w unused. Must match ClusterBox in light_clusters.glsl.
+struct alignas(16) ClusterBox {
+	glm::vec4 min;
+	glm::vec4 max;
+};
+
+// Uploaded to a std140 uniform block. Must match assets/shaders/light_clusters.glsl!
+struct alignas(16) ClusterConstants {
+	glm::uvec4 dims;		// Clusters across, up and deep, then the most lights a cluster's list holds
+	float depth_scale;		// A view depth's slice is log(depth) * depth_scale + depth_bias
+	float depth_bias;
+	uint32_t light_count;	// Visible lights
+	uint32_t enabled;		// 0 shades every fragment with every light, for comparison
+};
+
+static_assert(sizeof(ClusterConstants) == 32, "ClusterConstants doesn't match the std140 layout");
+
+
+struct ClusterGrid {
+	static constexpr uint32_t tiles_x = 16;
+	static constexpr uint32_t tiles_y = 9;
+	static constexpr uint32_t slices = 24;
+	static constexpr uint32_t cluster_count = tiles_x * tiles_y * slices;
+
+	// The count goes first, so a list is a power of two uints
+	static constexpr uint32_t max_lights = 255;
+	static constexpr uint32_t stride = max_lights + 1;
+
+	std::vector<ClusterBox> boxes;
+	ClusterConstants constants = {};
+
+	// Works out the boxes for a symmetric perspective projection, unless they're already for this one.
+	// Returns whether they changed, and need uploading.
+	bool update(const glm::mat4& projection, float znear, float zfar);
+
+	static uint32_t index(uint32_t x, uint32_t y, uint32_t z) { return x + tiles_x * (y + tiles_y * z); }
+
+private:
+	glm::mat4 m_projection = glm::mat4(0.0f);
+	float m_znear = 0.0f;
+	float m_zfar = 0.0f;
+};
+
+
+// A world space light sphere, radius squared in w, moved into view space. Must match light_view_sphere() in light_clusters.glsl.
+inline glm::vec4 light_view_sphere(const glm::mat4& view, const glm::vec4& sphere) {
+	float cx = view[0].x * sphere.x + view[1].x * sphere.y + view[2].x * sphere.z + view[3].x;
+	float cy = view[0].y * sphere.x + view[1].y * sphere.y + view[2].y * sphere.z + view[3].y;
+	float cz = view[0].z * sphere.x + view[1].z * sphere.y + view[2].z * sphere.z + view[3].z;
+
+	return { cx, cy, cz, sphere.w };
+}
+
+
+// How far c is outside [lo, hi], 0 inside
+inline float axis_outside(float c, float lo, float hi) {
+	return std::max(std::max(lo - c, 0.0f), c - hi);
+}
+
+
+// Does a view space sphere reach into a cluster's box? Must match sphere_in_cluster() in light_clusters.glsl.
+inline bool sphere_in_cluster(const glm::vec4& sphere, const ClusterBox& box) {
+	float dx = axis_outside(sphere.x, box.min.x, box.max.x);
+	float dy = axis_outside(sphere.y, box.min.y, box.max.y);
+	float dz = axis_outside(sphere.z, box.min.z, box.max.z);
+
+	float distance_sq = dx * dx + dy * dy + dz * dz;
+	return distance_sq <= sphere.w;
+}
+
+
+class LightClusterBinner {
+public:
+	struct Stats {
+		uint32_t lights = 0;
+		uint32_t references = 0;		// Entries across every list
+		uint32_t max_per_cluster = 0;	// Before dropping any
+		uint32_t overflowed = 0;		// Clusters with more than max_lights
+		double ms = 0;
+	};
+
+	// view is the camera's, which the grid's boxes are in front of. spheres are VisibleLights::spheres().
+	void build(WorkerPool& pool, const ClusterGrid& grid, const glm::mat4& view, std::span<const glm::vec4> spheres);
+
+	// Laid out like the GPU's, ClusterGrid::stride uints per cluster
+	std::span<const uint32_t> lists() const { return m_lists; }
+
+	const Stats& stats() const { return m_stats; }
+
+private:
+	struct Worker {
+		uint32_t references = 0;
+		uint32_t max_per_cluster = 0;
+		uint32_t overflowed = 0;
+		std::vector<uint32_t> candidates;	// The current slice's lights
+	};
+
+	std::vector<Worker> m_workers;
+
+	std::vector<glm::vec4> m_spheres;	// Each light's light_view_sphere()
+	std::vector<uint32_t> m_lists;
+
+	Stats m_stats;
+};
@@ -10,7 +10,7 @@ struct Material {
 #pragma pack(push, 1)
 	struct MaterialSTD140 {
 		glm::vec3 diffuse_color;			// 12 bytes	
-		float _padding;						// 4 bytes padding
+		float alpha;						// 4 bytes
 		glm::vec2 metallic_roughness;		// 8 bytes
 		uint64_t diffuse_texture;			// 8 bytes
 		uint64_t normal_texture;			// 8 bytes
@@ -24,6 +24,7 @@ struct Material {
 	MaterialSTD140 std140() const {
 		return { 
 			.diffuse_color=diffuse_color, 
+			.alpha=alpha,
 			.metallic_roughness=metallic_roughness, 
 			.diffuse_texture=diffuse_texture, 
 			.normal_texture=normal_map, 
@@ -39,5 +40,6 @@ struct Material {
 	uint64_t metalic_roughness_texture;
 
 	bool blend = false;
+	float alpha = 1.0f;		// Only used when blending
 
 };
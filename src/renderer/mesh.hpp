@@ -11,6 +11,7 @@
 #include "vertex_buffer.hpp"
 #include "index_buffer.hpp"
 #include "shader.hpp"
+#include "draw_data.hpp"
 
 
 // To be used only for e.g. primitve generation!
@@ -72,16 +73,6 @@ private:
 };
 
 
-struct RenderCommand {
-	uint32_t count;
-	uint32_t instance_count;
-	uint32_t first_index;
-	int32_t base_vertex;
-	uint32_t base_instance;
-};
-
-
-
 Ref<Mesh> construct_quad_mesh(glm::vec3 a, glm::vec3 b, glm::vec3 c, glm::vec3 d);
 Ref<Mesh> construct_cube_mesh(float size);
 Ref<Mesh> construct_cube_sphere(float size, int subdivisions);
@@ -0,0 +1,117 @@
+#pragma once
+
+#include <cstdint>
+#include <cassert>
+#include <array>
+#include <vector>
+#include <algorithm>
+
+#include "worker_pool.hpp"
+
+/*
+	Sorts keys ascending, with a value carried along with each, by LSD radix sort: 8 bits a pass, lowest first.
+	Stable, so each pass keeps the order the passes before it put things in.
+
+	Each pass is split across a WorkerPool: the keys are cut into one chunk per worker, each chunk counts its digits,
+	a prefix sum over (digit, chunk) says where every chunk's keys with each digit go, and each chunk scatters its own.
+	The chunks are the same for the count and the scatter, so no two workers ever write to the same place.
+
+	A pass where every key has the same digit wouldn't move anything, so it's skipped. Keys that only use
+	their low bits cost fewer passes.
+
+	The scratch space is kept between sorts and swapped with the caller's vectors, so a steady size doesn't allocate.
+*/
+
+template <typename Key, typename Value>
+class RadixSort {
+public:
+	static constexpr uint32_t digit_bits = 8;
+	static constexpr uint32_t digits = 1u << digit_bits;
+	static constexpr uint32_t max_passes = sizeof(Key) * 8 / digit_bits;
+
+	// Below this many keys a chunk isn't worth handing to another worker
+	static constexpr uint32_t min_chunk = 16 * 1024;
+
+	void sort(WorkerPool& pool, std::vector<Key>& keys, std::vector<Value>& values) {
+		assert(keys.size() == values.size());
+
+		uint32_t count = static_cast<uint32_t>(keys.size());
+		m_passes = 0;
+
+		if (count < 2) return;
+
+		uint32_t chunk_count = std::clamp<uint32_t>(count / min_chunk, 1, pool.size());
+		uint32_t chunk_size = (count + chunk_count - 1) / chunk_count;
+
+		m_counts.resize(chunk_count);
+		m_keys.resize(count);
+		m_values.resize(count);
+
+		for (uint32_t pass = 0; pass < max_passes; pass++) {
+			uint32_t shift = pass * digit_bits;
+
+			pool.parallel_for(chunk_count, 1, [&](uint32_t begin, uint32_t end, uint32_t) {
+				for (uint32_t chunk = begin; chunk < end; chunk++) {
+					Counts& counts = m_counts[chunk];
+					counts.fill(0);
+
+					uint32_t last = std::min(count, (chunk + 1) * chunk_size);
+					for (uint32_t i = chunk * chunk_size; i < last; i++) counts[digit(keys[i], shift)]++;
+				}
+			});
+
+			// Where each chunk's keys with each digit start. All of one digit before the next,
+			// and within a digit, chunk by chunk, which keeps it stable.
+			uint32_t offset = 0;
+			bool one_digit = false;
+
+			for (uint32_t d = 0; d < digits; d++) {
+				uint32_t digit_start = offset;
+
+				for (Counts& counts : m_counts) {
+					uint32_t digit_count = counts[d];
+					counts[d] = offset;
+					offset += digit_count;
+				}
+
+				if (offset - digit_start == count) one_digit = true;
+			}
+
+			if (one_digit) continue;
+
+			pool.parallel_for(chunk_count, 1, [&](uint32_t begin, uint32_t end, uint32_t) {
+				for (uint32_t chunk = begin; chunk < end; chunk++) {
+					Counts& next = m_counts[chunk];
+
+					uint32_t last = std::min(count, (chunk + 1) * chunk_size);
+
+					for (uint32_t i = chunk * chunk_size; i < last; i++) {
+						uint32_t to = next[digit(keys[i], shift)]++;
+						m_keys[to] = keys[i];
+						m_values[to] = values[i];
+					}
+				}
+			});
+
+			keys.swap(m_keys);
+			values.swap(m_values);
+			m_passes++;
+		}
+	}
+
+	// How many passes the last sort actually did
+	uint32_t passes() const { return m_passes; }
+
+private:
+	using Counts = std::array<uint32_t, digits>;
+
+	static uint32_t digit(Key key, uint32_t shift) {
+		return static_cast<uint32_t>(key >> shift) & (digits - 1);
+	}
+
+	std::vector<Counts> m_counts;	// Per chunk
+	std::vector<Key> m_keys;
+	std::vector<Value> m_values;
+
+	uint32_t m_passes = 0;
+};
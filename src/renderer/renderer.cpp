@@ -15,12 +15,26 @@
 const char* glsl_version = "#version 460";
 
 
+#ifdef DEBUG
+// Errors and warnings straight from the driver, with no glGetError calls needed.
+// The context is synchronous, so a breakpoint here lands on the offending call.
+void GLAD_API_PTR gl_debug_message(GLenum source, GLenum type, GLuint id, GLenum severity, GLsizei length, const GLchar* message, const void* user_param) {
+	if (severity == GL_DEBUG_SEVERITY_NOTIFICATION) return;
+
+	fprintf(stderr, "GL %s (%u): %s\n", type == GL_DEBUG_TYPE_ERROR ? "Error" : "Debug", id, message);
+}
+#endif
+
+
+#ifdef GL_CALL_STATS
+// glad's debug wrappers call these around every GL call, which is all we need to count them
+void gl_pre_call(const char* name, GLADapiproc apiproc, int len_args, ...) {
+	Instrumentor::get().count(name);
+}
+
 void gl_post_call(void* ret, const char* name, GLADapiproc apiproc, int len_args, ...) {
-	uint32_t error = glad_glGetError();
-	if (error != GL_NO_ERROR) {
-		fprintf(stderr, "GL Error in %s: (%u) %s\n", name, error, gl_error_name(error).c_str());
-	}
 }
+#endif
 
 // Initialize OpenGL and shit
 void Renderer::initialize() {
@@ -28,7 +42,20 @@ void Renderer::initialize() {
 
 
 	gladLoadGL(glfwGetProcAddress);
+
+#ifdef GL_CALL_STATS
+	gladSetGLPreCallback(gl_pre_call);
 	gladSetGLPostCallback(gl_post_call);
+#else
+	// Point every GL function straight at the driver, rather than through glad's debug wrappers
+	gladUninstallGLDebug();
+#endif
+
+#ifdef DEBUG
+	glEnable(GL_DEBUG_OUTPUT);
+	glEnable(GL_DEBUG_OUTPUT_SYNCHRONOUS);
+	glDebugMessageCallback(gl_debug_message, nullptr);
+#endif
 
 	glEnable(GL_DEPTH_TEST);
 	glEnable(GL_MULTISAMPLE);
@@ -137,6 +164,10 @@ Window::Window(int width, int height, std::string title) {
 	//glfwWindowHint(GLFW_SAMPLES, 4);
 	glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
 
+#ifdef DEBUG
+	glfwWindowHint(GLFW_OPENGL_DEBUG_CONTEXT, GLFW_TRUE);
+#endif
+
 
 	platform_window = glfwCreateWindow(width, height, title.c_str(), nullptr, nullptr);
 
@@ -37,6 +37,9 @@ struct GLFWwindow;
 #include <string>
 #include <initializer_list>
 #include <functional>
+#include <span>
+#include <bit>
+#include <array>
 
 #include <glm.hpp>
 #include "flecs.h"
@@ -44,6 +47,8 @@ struct GLFWwindow;
 #include "types.hpp"
 #include "util.hpp"
 #include "ecs_componets.hpp"
+#include "spawn.hpp"
+#include "systems.hpp"
 
 #include "assets/asset_manager.hpp"
 #include "vertex_buffer.hpp"
@@ -54,6 +59,23 @@ struct GLFWwindow;
 #include "camera.hpp"
 #include "light.hpp"
 #include "framebuffer.h"
+#include "ring_buffer.hpp"
+#include "bounds.hpp"
+#include "bvh.hpp"
+#include "dense_slots.hpp"
+#include "sorted_slots.hpp"
+#include "binding_table.hpp"
+#include "frame_constants.hpp"
+#include "command_list.hpp"
+#include "culling.hpp"
+#include "draw_data.hpp"
+#include "cpu_draw_builder.hpp"
+#include "transparent_draw_builder.hpp"
+#include "hiz.hpp"
+#include "gbuffer.hpp"
+#include "shadows.hpp"
+#include "light_clusters.hpp"
+#include "visible_lights.hpp"
 
 #include "meshoptimizer.h"
 
@@ -102,82 +124,145 @@ private:
 // This is a tag structure to specify that a mesh is GPU Resident.
 // We will use it for materials, lights and models
 struct GPUResident {
+	static constexpr uint32_t invalid = UINT32_MAX;	// Handled, but has no slot
+
 	uint32_t addr; // This is probably an offset into a buffer, but usage depends on the object
 };
 
 struct Dirty {}; // Tag struct for dirty bois
 
+// The leaf in the scene BVH that holds this entity's bounds
+struct BVHProxy {
+	BVH::NodeID node;
+};
 
+// For entities that have moved lately. Their shadows are drawn every frame, everything else's are cached
+// (see CascadedShadowMap). Removed again once they've been still for MeshBundle::shadow_settle_frames.
+struct ShadowDynamic {
+	uint64_t moved_frame;	// MeshBundle::m_upload_frame when it last moved
+};
 
-// A buffer that keeps data in sync between the GPU and the ECS
-template <typename Entity_Type, typename GPU_Type>
-class ECSGPUBuffer : public Buffer {
-public:
-	// TODO: Investigate STATIC vs STREAM for this kind of data
-	ECSGPUBuffer(std::function<GPU_Type(const flecs::entity&, const Entity_Type&)> convert) : Buffer(BufferUsage::STATIC), m_convert(convert) {
-		m_non_resident_query = ecs.query_builder<const WorldTransform, const Entity_Type>()
-			.term<GPUResident, Entity_Type>().not_()
-			.build();
 
-		m_dirty_query = ecs.query_builder<const WorldTransform, const Entity_Type, const flecs::pair<GPUResident, Entity_Type>>().term<Dirty, Entity_Type>().build();
 
-		// Any changes to GPU resident lights should cause them to be marked dirty
-		m_observer = ecs.observer<const WorldTransform, const Entity_Type>().term<GPUResident, Entity_Type>().event(flecs::OnSet).each(
+// A packed copy of one component of every entity that has it, kept in sync with the ECS for the renderer
+// to read on the CPU. The elements are kept dense, in DenseSlots, so they can be read as a single span.
+template <typename Entity_Type, typename Packed_Type>
+class ECSPackedArray {
+public:
+	ECSPackedArray(std::function<Packed_Type(const flecs::entity&, const Entity_Type&)> convert) : m_convert(convert) {
+		// Any changes to resident values should cause them to be marked dirty
+		m_observers.push_back(ecs.observer<const WorldTransform, const Entity_Type>().term<GPUResident, Entity_Type>().event(flecs::OnSet).each(
 			[](flecs::entity e, const TransformComponent&, const Entity_Type&) {
 				e.add<Dirty, Entity_Type>();
-			});
+			}));
+
+		// Destroyed entities give their slot back, and the last element moves into it
+		m_observers.push_back(ecs.observer<const flecs::pair<GPUResident, Entity_Type>>().event(flecs::OnRemove).each(
+			[this](flecs::entity e, const GPUResident& resident) {
+				uint32_t slot = resident.addr / sizeof(Packed_Type);
+
+				if (flecs::entity_t moved = m_slots.remove(slot)) {
+					flecs::entity(ecs, moved).get_mut<GPUResident, Entity_Type>()->addr = resident.addr;
+				}
+			}));
+
+		// Removing the component on its own takes the entity out of the array too
+		m_observers.push_back(ecs.observer<const Entity_Type>().term<GPUResident, Entity_Type>().event(flecs::OnRemove).each(
+			[](flecs::entity e, const Entity_Type&) {
+				e.remove<GPUResident, Entity_Type>();
+			}));
 	}
 
-	~ECSGPUBuffer() {
-		m_observer.destruct();
+	~ECSPackedArray() {
+		for (auto& observer : m_observers) observer.destruct();
+		if (m_resident_system) m_resident_system.destruct();
+		if (m_dirty_system) m_dirty_system.destruct();
 	}
 
-	// Update the buffer!
-	void update() {
-		ecs.defer_begin();
-		m_non_resident_query.each([&](flecs::entity e, const TransformComponent& transform, const Entity_Type& value) {
-			// TODO: Check for locality etc. and don't make resident all lights all the time
-			//			(or do, lights are small maybe??)
-			//			(or don't, cache locality is worse with many lights???)
-			uint32_t addr = static_cast<uint32_t>(push_back(m_convert(e, value)));
-			e.set<GPUResident, Entity_Type>({ addr });
-		});
-		ecs.defer_end();
+	// Register the systems which stage changes for this array. Nothing changes in it until apply().
+	void register_systems(const Phases& phases) {
+		m_staged_updates.resize(ecs.get_stage_count());
 
+		// Handing out addresses has to happen in order, so this runs on a single thread
+		m_resident_system = ecs.system<const WorldTransform, const Entity_Type>()
+			.kind(phases.stage_gpu_data)
+			.term<GPUResident, Entity_Type>().not_()
+			.write<GPUResident, Entity_Type>()
+			.each([this](flecs::entity e, const TransformComponent& transform, const Entity_Type& value) {
+				uint32_t addr = static_cast<uint32_t>(m_slots.add(e.id()) * sizeof(Packed_Type));
+				e.set<GPUResident, Entity_Type>({ addr });
+			});
 
-		ecs.defer_begin();
-		m_dirty_query.each([&](flecs::entity e, const TransformComponent& transform, const Entity_Type& value, const GPUResident& resident) {
-			glm::vec3 world_pos = glm::vec3(transform[3][0], transform[3][1], transform[3][2]);
-			set_subdata(m_convert(e, value), resident.addr);
+		m_dirty_system = ecs.system<const WorldTransform, const Entity_Type, const flecs::pair<GPUResident, Entity_Type>>()
+			.kind(phases.stage_gpu_data)
+			.term<Dirty, Entity_Type>()
+			.multi_threaded()
+			.each([this](flecs::iter& it, size_t i, const TransformComponent& transform, const Entity_Type& value, const GPUResident& resident) {
+				flecs::entity e = it.entity(i);
+				m_staged_updates[it].push_back({ static_cast<uint32_t>(resident.addr / sizeof(Packed_Type)), m_convert(e, value) });
+				e.remove<Dirty, Entity_Type>();
+			});
+	}
 
-			e.remove<Dirty, Entity_Type>();
-		});
-		ecs.defer_end();
+	// Apply everything staged since the last call. Main thread only, as the stages are merged here.
+	void apply() {
+		m_values.resize(m_slots.size());
+
+		for (auto& updates : m_staged_updates) {
+			for (auto& [idx, value] : updates) {
+				if (idx < m_values.size()) m_values[idx] = value;
+			}
+			updates.clear();
+		}
+
+		// New and moved slots go last, so they win over any update staged before the move
+		for (uint32_t slot : m_slots.take_stale()) {
+			flecs::entity owner(ecs, m_slots.owner(slot));
+			if (const Entity_Type* value = owner.get<Entity_Type>()) {
+				m_values[slot] = m_convert(owner, *value);
+			}
+		}
 	}
 
+	std::span<const Packed_Type> values() const { return m_values; }
+
 
 	uint32_t get_address(flecs::entity e) {
-		return e.has<GPUResident, Entity_Type>() ? e.get<GPUResident, Entity_Type>()->addr : 0;
+		return e.has<GPUResident, Entity_Type>() ? e.get<GPUResident, Entity_Type>()->addr : GPUResident::invalid;
 	}
 
 	uint32_t get_index(flecs::entity e) {
-		return get_address(e) / sizeof(GPU_Type);
+		uint32_t addr = get_address(e);
+		return addr == GPUResident::invalid ? addr : addr / sizeof(Packed_Type);
 	}
 
+	size_t count() const { return m_slots.size(); }
+
 
 private:
-	std::function<GPU_Type(const flecs::entity&, const Entity_Type&)> m_convert; // convert to GPU Type
-	flecs::query<const WorldTransform, const Entity_Type> m_non_resident_query;
-	flecs::query<const WorldTransform, const Entity_Type, const flecs::pair<GPUResident, Entity_Type>> m_dirty_query;
-	flecs::observer m_observer;
+	std::function<Packed_Type(const flecs::entity&, const Entity_Type&)> m_convert;
+
+	DenseSlots m_slots;
+	std::vector<Packed_Type> m_values;
+	PerStage<std::vector<std::pair<uint32_t, Packed_Type>>> m_staged_updates;	// (index, value)
+
+	std::vector<flecs::observer> m_observers;
+	flecs::system m_resident_system;
+	flecs::system m_dirty_system;
 };
 
 
 
-inline Light::Light_STD140 light_convert(const flecs::entity& e, const Light& light) {
+inline Light::Packed light_convert(const flecs::entity& e, const Light& light) {
 	TransformComponent transform = *e.get<WorldTransform>();
 	glm::vec3 world_pos = glm::vec3(transform[3][0], transform[3][1], transform[3][2]);
-	return light.STD140(world_pos);
+	glm::vec3 radiance = light.color * light.intensity;
+
+	return Light::Packed{
+		.position = world_pos,
+		.radius_sq = light.range_sq(),
+		.radiance = { meshopt_quantizeHalf(radiance.r), meshopt_quantizeHalf(radiance.g), meshopt_quantizeHalf(radiance.b), 0 }
+	};
 }
 
 inline glm::mat4 transform_convert(const flecs::entity& e, const TransformComponent& transform) {
@@ -186,12 +271,22 @@ inline glm::mat4 transform_convert(const flecs::entity& e, const TransformCompon
 
 
 
+// Where draws are built. GPU is the compute culling pipeline, CPU is CPUDrawBuilder.
+enum class RenderBackend {
+	GPU,
+	CPU
+};
+
+
 // This represents a number of meshes in a single vertex buffer.
 // TODO: Think about a more appropriate name? (maybe renderer lol)
 // Limitations: All meshes must have the same vertex specification!!!
 // Maybe template this by vertex spec somehow?
 class MeshBundle {
 public:
+	// Frames something has to be still before its shadow is cached again, see ShadowDynamic
+	static constexpr uint64_t shadow_settle_frames = 60;
+
 	struct Entry {
 		uint32_t num_vertices;
 		uint32_t first_idx;
@@ -201,30 +296,15 @@ public:
 
 		float bounding_sphere;
 		uint32_t idx;
-	};
 
-#pragma pack(push, 1)
-	struct PerInstanceData {
-		uint32_t transform_idx;
-		uint32_t material_idx;
-	};
+		// Where the geometry lives in the vertex and index heaps
+		HeapAllocation vertex_allocation;
+		HeapAllocation index_allocation;
 
-	// Represents a renderable entity on the GPU
-	struct GPUEntity {
-		uint32_t mesh_idx;		// 4 bytes
-		uint32_t material_idx;	// 4 bytes
-		uint32_t transform_idx;	// 4 bytes
-		uint32_t padding;		// 4 bytes
-	};
-
-	// Represents a mesh on the GPU
-	struct GPUMesh {
-		uint32_t num_vertices;
-		uint32_t first_idx;
-		int32_t base_vertex;
-		float bounding_sphere;
+		float min_pixels = 0.0f;	// See set_min_pixels()
 	};
 
+#pragma pack(push, 1)
 	struct Vertex {
 		glm::vec3 position;
 		glm::vec3 normal;
@@ -246,17 +326,18 @@ public:
 		glm::vec2 uv;
 		uint16_t tan[3];
 	};
-#pragma pack(pop)
 
-	struct alignas(16) GPUCullData {
-		float frustum[4];
-		float znear, zfar;
+	// All depth only passes need. The fourth half is padding, so every vertex is fetched from one aligned 8 bytes.
+	struct PositionVertex {
+		uint16_t position[4]; // halfs
 	};
+#pragma pack(pop)
 
 	MeshBundle()
-		: m_vertex_array(), m_vertex_buffer(m_vertex_array), m_per_idx_buffer(m_vertex_array, 1),
-		m_command_buffer(BufferUsage::STREAM), m_draw_query(), m_main_shader(asset_manager.GetByPath<Shader>("assets/shaders/no_debug_options.glsl")), material_buffer(BufferUsage::STATIC),
-		lights_buffer(light_convert), m_transform_buffer(BufferUsage::STREAM), m_render_intermediate_buffer(BufferUsage::STREAM), m_framebuffer(1920, 1080)
+		: m_vertex_array(), m_vertex_buffer(m_vertex_array), m_per_idx_buffer(m_vertex_array, 1, 0), m_position_array(), m_position_buffer(m_position_array),
+		m_command_buffer(BufferUsage::STREAM), m_main_shader(asset_manager.GetByPath<Shader>("assets/shaders/no_debug_options.glsl")), material_buffer(BufferUsage::STATIC, 1024 * 1024),
+		m_lights(light_convert), m_transform_buffer(BufferUsage::STREAM, 16 * 1024 * 1024), m_entity_buffer(BufferUsage::STATIC, 4 * 1024 * 1024),
+		m_render_intermediate_buffer(BufferUsage::STREAM), m_framebuffer(1920, 1080)
 	{
 		m_vertex_buffer.set_layout({
 			{"position", ShaderDataType::F16, 3 },
@@ -268,28 +349,133 @@ public:
 		m_per_idx_buffer.set_layout({ { "ModelIDX", ShaderDataType::U32 }, {"MaterialIDX", ShaderDataType::U32} }, 4);
 		m_per_idx_buffer.set_per_instance(true);
 
-		m_non_resident_transform_query = ecs.query_builder<const WorldTransform>().term<Model>().term<GPUResident, WorldTransform>().not_().build();
-		m_dirty_transform_query = ecs.query_builder<const WorldTransform, const flecs::pair<GPUResident, WorldTransform>>().term<Dirty, WorldTransform>().build();
+		// Depth only passes draw from their own vertex array, with the positions at binding 0 and the same per instance data at 1
+		m_position_buffer.set_layout({ {"position", ShaderDataType::F16, 4} });
+		m_per_idx_buffer.attach(m_position_array, 1);
+
+		material_buffer.enable_shadow();
+		m_mesh_buffer.enable_shadow();
+
+		// Entities are moved around to keep them sorted, and the shadow is where they're moved from.
+		// It's also what the CPU draw path reads.
+		m_entity_buffer.enable_shadow();
+
+		m_bindings.add_storage("RenderData", &m_render_intermediate_buffer);
+		m_bindings.add_storage("Entities", &m_entity_buffer);
+		m_bindings.add_storage("Meshes", &m_mesh_buffer);
+		m_bindings.add_storage("MeshRanges", &m_mesh_range_buffer);
+		m_bindings.add_storage("RenderCommands", &m_command_buffer);
+		m_bindings.add_storage("PerInstance", &m_per_idx_buffer);
+		m_bindings.add_storage("Transforms", &m_transform_buffer);
+		m_bindings.add_storage("LightSpheres", &m_light_sphere_buffer);
+		m_bindings.add_storage("LightRadiance", &m_light_radiance_buffer);
+		m_bindings.add_storage("Materials", &material_buffer);
+		m_bindings.add_storage("Cull", &m_cull_data_buffer);
+		m_bindings.add_storage("VisibleEntities", &m_visible_entity_buffer);
+		m_bindings.add_storage("Visibility", &m_visibility_buffer);
+		m_bindings.add_storage("ClusterBounds", &m_cluster_bounds_buffer);
+		m_bindings.add_storage("ClusterLights", &m_cluster_lights_buffer);
+
+		m_bindings.add_uniform("FrameConstants", &m_frame_constants_buffer);
+		m_bindings.add_uniform("ShadowConstants", &m_shadow_constants_buffer);
+		m_bindings.add_uniform("ClusterConstants", &m_cluster_constants_buffer);
+
+		for (auto& shader : { m_entity_count_shader, m_build_render_command_shader, m_generate_per_instance_data_shader, m_main_shader, m_z_prepass_shader, m_shadow_depth_shader, m_build_light_clusters_shader, m_gbuffer_shader, m_deferred_lighting_shader }) {
+			m_bindings.add_program(shader);
+		}
 
-		m_draw_query = ecs.query_builder<const flecs::pair<GPUResident, WorldTransform>, const Model>()
-			.build();
-
-		m_non_resident_entity_query = ecs.query_builder<const flecs::pair<GPUResident, WorldTransform>, const Model>()
-			.term<GPUResident>().not_()
-			.build();
+		m_entity_count_num_entities = m_entity_count_shader->uniform_handle("num_entities");
+		m_entity_count_phase = m_entity_count_shader->uniform_handle("phase");
+		m_entity_count_cull_index = m_entity_count_shader->uniform_handle("cull_index");
+		m_shadow_depth_cascade = m_shadow_depth_shader->uniform_handle("cascade");
+		m_build_render_command_num_models = m_build_render_command_shader->uniform_handle("num_models");
+		m_build_render_command_pass_index = m_build_render_command_shader->uniform_handle("pass_index");
+		m_build_render_command_compact = m_build_render_command_shader->uniform_handle("compact");
+		m_build_render_command_num_entity_groups = m_build_render_command_shader->uniform_handle("num_entity_groups");
+		m_build_render_command_entity_group_size = m_build_render_command_shader->uniform_handle("entity_group_size");
 
 
-		ecs.observer<const WorldTransform>().term<const flecs::pair<GPUResident, WorldTransform>>().event(flecs::OnSet).each(
+		suspend_during_bulk_spawn(ecs.observer<const WorldTransform>().term<const flecs::pair<GPUResident, WorldTransform>>().event(flecs::OnSet).each(
 			[](flecs::entity e, const WorldTransform& wt) {
 				e.add<Dirty, WorldTransform>();
-		});
+		}));
+
+		// Destroying an entity (or removing its model) takes it out of the BVH
+		m_observers.push_back(ecs.observer<const BVHProxy>().event(flecs::OnRemove).each(
+			[this](flecs::entity e, const BVHProxy& proxy) {
+				m_bvh.remove(proxy.node);
+		}));
+
+		// Freed transform slots are filled from the end, and whoever moved has to be told,
+		// along with the GPUEntity pointing at the transform. One that's still pending picks it up when it's placed.
+		m_observers.push_back(ecs.observer<const flecs::pair<GPUResident, WorldTransform>>().event(flecs::OnRemove).each(
+			[this](flecs::entity e, const GPUResident& resident) {
+				// While its transform is still in the slot. The entity's own OnRemove might not have run yet.
+				const GPUResident* own = e.get<GPUResident>();
+				if (own && own->addr != GPUResident::invalid && !SortedSlots::is_pending(own->addr)) uncache_shadow(own->addr);
+
+				flecs::entity moved(ecs, m_transform_slots.remove(resident.addr));
+				if (!moved) return;
+
+				moved.get_mut<GPUResident, WorldTransform>()->addr = resident.addr;
+
+				// The CPU copy moves with it, so it keeps saying where the shadow cache has the entity until the slot is refilled
+				uint32_t last = static_cast<uint32_t>(m_transform_slots.size());
+				if (last < m_cpu_transforms.size()) m_cpu_transforms[resident.addr] = m_cpu_transforms[last];
+
+				const GPUResident* entity = moved.get<GPUResident>();
+				if (entity && entity->addr != GPUResident::invalid && !SortedSlots::is_pending(entity->addr)) {
+					GPUEntity gpu_entity = m_entity_buffer.shadow<GPUEntity>()[entity->addr];
+					gpu_entity.transform_idx = resident.addr;
+					m_entity_buffer.set_subdata(gpu_entity, entity->addr * sizeof(GPUEntity));
+				}
+		}));
+
+		// Whoever fills the hole is told when the removal is applied, in flush_uploads()
+		m_observers.push_back(ecs.observer<const GPUResident>().event(flecs::OnRemove).each(
+			[this](flecs::entity e, const GPUResident& resident) {
+				if (resident.addr != GPUResident::invalid && !SortedSlots::is_pending(resident.addr)) uncache_shadow(resident.addr);
+				if (resident.addr != GPUResident::invalid) m_entity_slots.remove(resident.addr);
+		}));
+
+		// A new model can mean a different mesh, or a material that moves it in or out of the blended set,
+		// so the entity goes through residency again
+		suspend_during_bulk_spawn(m_observers.emplace_back(ecs.observer<const Model>().term<const GPUResident>().event(flecs::OnSet).each(
+			[](flecs::entity e, const Model&) {
+				e.remove<GPUResident>();
+				e.remove<BVHProxy>();
+		})));
+
+		// Without a model there's nothing left to draw
+		m_observers.push_back(ecs.observer<const Model>().term<const GPUResident>().event(flecs::OnRemove).each(
+			[](flecs::entity e, const Model&) {
+				e.remove<GPUResident>();
+				e.remove<GPUResident, WorldTransform>();
+				e.remove<BVHProxy>();
+		}));
+
+		// Core in 4.6. Without it, every mesh gets a command, empty or not, and they're all drawn.
+		m_indirect_count_supported = GLAD_GL_VERSION_4_6 != 0;
+		m_indirect_count_enabled = m_indirect_count_supported;
+
+		glCreateQueries(GL_PRIMITIVES_GENERATED, static_cast<GLsizei>(m_triangle_queries.size()), m_triangle_queries.data());
+		glCreateQueries(GL_TIME_ELAPSED, static_cast<GLsizei>(m_opaque_queries.size()), m_opaque_queries.data());
 
 		Material def = { glm::vec3(0.8f) };
 		register_material(def);
 
 	}
 
-	~MeshBundle() {}
+	~MeshBundle() {
+		for (auto& observer : m_observers) observer.destruct();
+		for (auto& system : m_systems) system.destruct();
+		if (m_bvh_insert_query) m_bvh_insert_query.destruct();
+		if (m_bvh_refit_query) m_bvh_refit_query.destruct();
+		if (m_sun_query) m_sun_query.destruct();
+
+		glDeleteQueries(static_cast<GLsizei>(m_triangle_queries.size()), m_triangle_queries.data());
+		glDeleteQueries(static_cast<GLsizei>(m_opaque_queries.size()), m_opaque_queries.data());
+	}
 
 
 	MaterialHandle register_material(const Material& m) {
@@ -300,6 +486,69 @@ public:
 
 
 
+	// Reserve a contiguous run of transform slots, and upload them with a single call.
+	// Returns the index of the first slot.
+	// The slots have no owners until set_bulk_owners() is called.
+	uint32_t make_transforms_resident(std::span<const TransformComponent> transforms) {
+		uint32_t first_idx = m_transform_slots.add_uploaded(transforms.size());
+		m_transform_buffer.set_subdata(transforms.data(), first_idx * sizeof(glm::mat4), transforms.size_bytes());
+
+		m_cpu_transforms.resize(m_transform_slots.size());
+		for (size_t i = 0; i < transforms.size(); i++) m_cpu_transforms[first_idx + i] = transforms[i].transform;
+
+		return first_idx;
+	}
+
+
+	// Place GPUEntity slots for a batch of models, in their meshes' ranges, and write them.
+	// The slots for each mesh end up together, so they're uploaded in a few runs rather than one by one.
+	// transforms holds each entity's resident transform, and the entity residency is written to out.
+	void make_entities_resident(std::span<const Model> models, std::span<const GPUResident> transforms, std::span<GPUResident> out) {
+		std::vector<GPUEntity> gpu_entities;
+		std::vector<uint32_t> out_idx;
+		gpu_entities.reserve(models.size());
+		out_idx.reserve(models.size());
+
+		uint32_t first_pending = 0;
+		AABB bounds;
+
+		for (size_t i = 0; i < models.size(); i++) {
+			GPUEntity gpu_entity = make_gpu_entity(models[i], transforms[i]);
+			bounds = AABB::merge(bounds, resident_bounds(gpu_entity));
+			uint32_t pending = m_entity_slots.add(entity_key(gpu_entity), 0);
+
+			if (gpu_entities.empty()) first_pending = pending;
+
+			gpu_entities.push_back(gpu_entity);
+			out_idx.push_back(static_cast<uint32_t>(i));
+		}
+
+		apply_entity_slots([&](uint32_t slot, uint32_t pending) {
+			// Anything queued by MakeEntitiesResident before this batch
+			if (gpu_entities.empty() || pending < first_pending) {
+				place_entity(slot);
+				return;
+			}
+
+			uint32_t idx = pending - first_pending;
+			m_entity_buffer.set_subdata(gpu_entities[idx], slot * sizeof(GPUEntity));
+			out[out_idx[idx]] = { slot };
+		});
+
+		// They're all static, so the batch goes into the shadow cache
+		if (!gpu_entities.empty()) m_shadows.invalidate(bounds);
+	}
+
+
+	// Record which entities own the slots handed out by make_transforms_resident() and make_entities_resident()
+	void set_bulk_owners(std::span<const GPUResident> transforms, std::span<const GPUResident> entities, std::span<const flecs::entity_t> owners) {
+		for (size_t i = 0; i < owners.size(); i++) {
+			m_transform_slots.set_owner(transforms[i].addr, owners[i]);
+			if (entities[i].addr != GPUResident::invalid) m_entity_slots.set_owner(entities[i].addr, owners[i]);
+		}
+	}
+
+
 	MeshHandle add_entry(Ref<Mesh> m) {
 		uint32_t index = static_cast<uint32_t>(m_entries.size());
 
@@ -309,9 +558,6 @@ public:
 		glm::vec3 min = {}, max = {}; // AABB
 		float bounding_sphere = 0;
 
-		// Now add the indices to the index buffer
-		m_index_buffer.extend(m->indices);
-
 		std::vector<Vertex> vertices;
 		for (uint32_t i = 0; i < vertex_count; i++) {
 			auto& vertex = m->vertices[i];
@@ -394,293 +640,571 @@ public:
 		}
 
 
-		m_entries.push_back(Entry{ index_count, cumulative_idx_count, cumulative_vertex_count, min, max, bounding_sphere, index });
+		// The geometry is suballocated from the vertex and index heaps, so remove_entry() can give the space back.
+		// base_vertex is in whole vertices, so vertex allocations are aligned to the vertex size.
+		static_assert(std::has_single_bit(sizeof(QuantizedVertex2)));
 
-		GPUMesh gpu_mesh = { .num_vertices=index_count, .first_idx=cumulative_idx_count, .base_vertex=cumulative_vertex_count, .bounding_sphere=bounding_sphere };
-		m_mesh_buffer.push_back(gpu_mesh);
+		HeapAllocation vertex_allocation = m_vertex_buffer.allocate(vertex_count * sizeof(QuantizedVertex2), sizeof(QuantizedVertex2));
+		HeapAllocation index_allocation = m_index_buffer.allocate(index_count * sizeof(uint32_t), sizeof(uint32_t));
 
-		cumulative_idx_count += index_count;
-		cumulative_vertex_count += vertex_count;
+		m_vertex_buffer.set_subdata(quantized_vertices.data(), vertex_allocation.offset, vertex_count * sizeof(QuantizedVertex2));
+		m_index_buffer.set_subdata(m->indices.data(), index_allocation.offset / sizeof(uint32_t), index_count);
 
-		m_vertex_buffer.extend(quantized_vertices);
+		uint32_t first_idx = static_cast<uint32_t>(index_allocation.offset / sizeof(uint32_t));
+		int32_t base_vertex = static_cast<int32_t>(vertex_allocation.offset / sizeof(QuantizedVertex2));
+
+		// The position stream and position index buffer mirror the vertex and index heaps, vertex for vertex and index for index,
+		// so depth only passes use the same draw commands, base_vertex, first_idx and all.
+		std::vector<PositionVertex> positions(vertex_count);
+
+		for (int i = 0; i < vertex_count; i++) {
+			positions[i] = { quantized_vertices[i].position[0], quantized_vertices[i].position[1], quantized_vertices[i].position[2], 0 };
+		}
+
+		// Vertices which are only split for their normals, uvs or tangents are merged, so they're transformed once.
+		// Only exact matches, so the depth comes out the same as in the main pass.
+		std::vector<uint32_t> position_indices(index_count);
+		meshopt_generateShadowIndexBuffer(position_indices.data(), m->indices.data(), index_count, positions.data(), vertex_count, 3 * sizeof(uint16_t), sizeof(PositionVertex));
+
+		m_position_buffer.set_subdata(positions.data(), base_vertex * sizeof(PositionVertex), vertex_count * sizeof(PositionVertex));
+		m_position_index_buffer.set_subdata(position_indices.data(), index_allocation.offset, index_count * sizeof(uint32_t));
+
+		m_entries.push_back(Entry{ index_count, first_idx, base_vertex, min, max, bounding_sphere, index, vertex_allocation, index_allocation });
+
+		GPUMesh gpu_mesh = { .num_vertices=index_count, .first_idx=first_idx, .base_vertex=base_vertex, .bounding_sphere=bounding_sphere, .min_pixels=0.0f };
+		m_mesh_buffer.push_back(gpu_mesh);
+		m_mesh_ranges_dirty = true;
 
 		return index;
 	}
 
-	template <uint32_t num_shaders, uint32_t num_buffers>
-	inline void setup_shaders(std::array<Ref<Shader>, num_shaders> shaders, std::array<std::string, num_buffers> buffer_names, std::array<Buffer*, num_buffers> buffers) {
-		PROFILE_FUNC();
-		// Binds all the buffers and uniforms for shaders
-		// TODO: figure out what to do if these buffer ids change!
 
-		uint32_t binding_location = 0;
+	// Free a mesh's geometry, so the heap space can be reused by meshes added later.
+	// The handle stays valid, but anything still using it draws nothing.
+	void remove_entry(MeshHandle handle) {
+		Entry& entry = m_entries[handle];
+		if (!entry.vertex_allocation) return;
 
-		for (uint32_t i = 0; i < num_buffers; i++) {
-			buffers[i]->bind(GL_SHADER_STORAGE_BUFFER, i);
+		m_vertex_buffer.free(entry.vertex_allocation);
+		m_index_buffer.free(entry.index_allocation);
 
-			for (uint32_t j = 0; j < num_shaders; j++) {
-				uint32_t binding_index = glGetProgramResourceIndex(shaders[j]->get_id(), GL_SHADER_STORAGE_BLOCK, buffer_names[i].c_str());
-				
-				if (binding_index != GL_INVALID_INDEX) {
-					glShaderStorageBlockBinding(shaders[j]->get_id(), binding_index, i);
-				}
-			}
-		}
+		entry.num_vertices = 0;
+		entry.vertex_allocation = {};
+		entry.index_allocation = {};
+
+		// Whatever used it was cached in the static shadows
+		m_shadows.invalidate();
 
+		GPUMesh gpu_mesh = { .num_vertices = 0, .first_idx = entry.first_idx, .base_vertex = entry.base_vertex, .bounding_sphere = entry.bounding_sphere, .min_pixels = entry.min_pixels };
+		m_mesh_buffer.set_subdata(gpu_mesh, handle * sizeof(GPUMesh));
 	}
 
 
-	inline void render(const Camera& camera) {
-		// TODO:
-		//	* Use a UBO for frame constants like camera parameters
+	// The smallest a mesh is drawn, as the number of pixels its bounding sphere covers across.
+	// 0 uses the global threshold from Renderer Stats, and negative always draws it, however small.
+	void set_min_pixels(MeshHandle handle, float min_pixels) {
+		Entry& entry = m_entries[handle];
+		entry.min_pixels = min_pixels;
+
+		GPUMesh gpu_mesh = m_mesh_buffer.shadow<GPUMesh>()[handle];
+		gpu_mesh.min_pixels = min_pixels;
+		m_mesh_buffer.set_subdata(gpu_mesh, handle * sizeof(GPUMesh));
+	}
+
+	// Register the systems which keep the GPU copies of transforms, entities and lights in sync,
+	// and the system which renders the scene from camera.
+	void register_systems(const Phases& phases, const Camera& camera) {
+		m_staged_transform_updates.resize(ecs.get_stage_count());
+		m_staged_dynamic.resize(ecs.get_stage_count());
+
+		m_sun_query = ecs.query<const DirectionalLight>();
+
+		// Nothing culls with the BVH any more, so it isn't kept up to date every frame. See update_bvh().
+		m_bvh_insert_query = ecs.query_builder<const WorldTransform, const Model>()
+			.term<BVHProxy>().not_()
+			.build();
 
+		m_bvh_refit_query = ecs.query<const WorldTransform, const Model, const BVHProxy>();
+
+		// Handing out slots has to happen in order, so residency runs on a single thread.
+		m_systems.push_back(ecs.system<const WorldTransform>("MakeTransformsResident")
+			.kind(phases.stage_gpu_data)
+			.term<Model>()
+			.term<GPUResident, WorldTransform>().not_()
+			.write<GPUResident, WorldTransform>()
+			.each([this](flecs::entity e, const TransformComponent& transform) {
+				// The transform itself is read from the entity when the slot is flushed
+				e.set<GPUResident, WorldTransform>({ m_transform_slots.add(e.id()) });
+			}));
+
+		// Every entity owns its slot, so dirty transforms can be staged from any thread
+		m_systems.push_back(ecs.system<const WorldTransform, const flecs::pair<GPUResident, WorldTransform>, ShadowDynamic*>("StageDirtyTransforms")
+			.kind(phases.stage_gpu_data)
+			.term<Dirty, WorldTransform>()
+			.multi_threaded()
+			.each([this](flecs::iter& it, size_t i, const TransformComponent& transform, const GPUResident& gr, ShadowDynamic* dynamic) {
+				flecs::entity e = it.entity(i);
+				m_staged_transform_updates[it].push_back({ gr.addr, transform.transform });
+				e.remove<Dirty, WorldTransform>();
+
+				// When it starts moving, its shadow stops being cached
+				if (dynamic) {
+					dynamic->moved_frame = m_upload_frame;
+				}
+				else {
+					e.set<ShadowDynamic>({ m_upload_frame });
+					m_staged_dynamic[it].push_back(e.id());
+				}
+			}));
+
+		// After StageDirtyTransforms, so anything that moved this frame has already said so
+		m_systems.push_back(ecs.system<const ShadowDynamic>("SettleShadowDynamic")
+			.kind(phases.stage_gpu_data)
+			.each([this](flecs::entity e, const ShadowDynamic& dynamic) {
+				if (m_upload_frame - dynamic.moved_frame < shadow_settle_frames) return;
+
+				e.remove<ShadowDynamic>();
+				m_staged_static.push_back(e.id());
+			}));
+
+		m_systems.push_back(ecs.system<const flecs::pair<GPUResident, WorldTransform>, const Model>("MakeEntitiesResident")
+			.kind(phases.stage_gpu_data)
+			.term<GPUResident>().not_()
+			.write<GPUResident>()
+			.each([this](flecs::entity e, const GPUResident& transform, const Model& model) {
+				// Pending until flush_uploads() sorts it in
+				e.set<GPUResident>({ m_entity_slots.add(entity_key(make_gpu_entity(model, transform)), e.id()) });
+			}));
+
+		m_lights.register_systems(phases);
+
+		// GL submission. This isn't multi_threaded, so it always runs on the main thread.
+		m_systems.push_back(ecs.system("RenderScene")
+			.kind(phases.render)
+			.iter([this, &camera](flecs::iter& it) {
+				flush_uploads();
+				render(camera);
+			}));
+	}
+
+
+	// Upload everything staged by the StageGPUData systems. GL, so main thread only!
+	// Staged data is written into this frame's region of the upload ring, and then copied
+	// out with one call per buffer, rather than one per element.
+	void flush_uploads() {
 		PROFILE_FUNC();
 
-		//m_framebuffer.bind();
+		m_upload_ring.next_frame();
+		Buffer::next_frame_stats();
 
-		m_framebuffer.clear_color({ .5f, .6f, .7f, 1.f });
-		m_framebuffer.clear_depth();
-		
+		// Materials and meshes are registered one at a time, so they are shadowed and go up together here.
+		// Anything reallocated along the way is bound again by m_bindings when rendering.
+		// Lights stay on the CPU, the ones in view are uploaded by build_light_clusters().
+		m_lights.apply();
+		material_buffer.flush();
+		m_mesh_buffer.flush();
 
-		auto shader_update = [&]() {
-			setup_shaders<5, 8>({ m_entity_count_shader, m_build_render_command_shader, m_generate_per_instance_data_shader, m_main_shader, m_z_prepass_shader },
-				{ "RenderData", "Entities", "Meshes", "RenderCommands", "PerInstance", "Transforms", "Lights", "Materials" },
-				{ &m_render_intermediate_buffer,&m_entity_buffer,&m_mesh_buffer,&m_command_buffer,&m_per_idx_buffer,&m_transform_buffer,&lights_buffer,&material_buffer });
-		};
+		m_vertex_buffer.commit();
+		m_index_buffer.commit();
 
+		m_transform_buffer.set_size(m_transform_slots.size() * sizeof(glm::mat4));
 
-		static int renderer = 0;
-		const glm::mat4 vp = camera.projection() * camera.view();
+		// Sort in this frame's new entities, and close up after the removed ones
+		apply_entity_slots([this](uint32_t slot, uint32_t pending) { place_entity(slot); });
 
-		lights_buffer.update();
+		// Entities that just started moving are flagged, so the shadow passes leave them out of the static cache,
+		// and ones that have settled go back into it. Either way the cascades they're in are out of date,
+		// and resident_bounds() is still where they were last frame. Anything still pending was flagged when it was placed, above.
+		auto set_shadow_dynamic = [this](flecs::entity_t id, bool dynamic) {
+			flecs::entity e(ecs, id);
+			const GPUResident* resident = e.is_alive() ? e.get<GPUResident>() : nullptr;
+			if (!resident || resident->addr == GPUResident::invalid || SortedSlots::is_pending(resident->addr)) return;
 
-		size_t non_resident_transforms = m_non_resident_transform_query.count();
+			GPUEntity gpu_entity = m_entity_buffer.shadow<GPUEntity>()[resident->addr];
+			m_shadows.invalidate(resident_bounds(gpu_entity));
 
-		if (non_resident_transforms > 0) {
-			puts(std::format("Making {} non resident transforms resident", non_resident_transforms).c_str());
+			gpu_entity.flags = dynamic ? gpu_entity.flags | GPUEntity::dynamic : gpu_entity.flags & ~GPUEntity::dynamic;
+			m_entity_buffer.set_subdata(gpu_entity, resident->addr * sizeof(GPUEntity));
+		};
+
+		for (auto& entities : m_staged_dynamic) {
+			for (flecs::entity_t id : entities) set_shadow_dynamic(id, true);
+			entities.clear();
+		}
 
-			ecs.defer_begin();
-			m_non_resident_transform_query.each([&](flecs::entity e, const TransformComponent& transform) {
-				size_t addr = m_transform_buffer.push_back(transform.transform);
-				uint32_t idx = static_cast<uint32_t>(addr / sizeof(glm::mat4));
-				e.set<GPUResident, WorldTransform>({ idx });
-				});
-			ecs.defer_end();
+		for (flecs::entity_t id : m_staged_static) set_shadow_dynamic(id, false);
+		m_staged_static.clear();
 
-			// chance that buffer re-allocated
-			// todo: actually update only when required!
-			shader_update();
+		m_upload_frame++;
+
+		if (m_mesh_ranges_dirty) {
+			upload_mesh_ranges();
 		}
 
-		size_t dirty_transforms = m_dirty_transform_query.count();
+		m_entity_buffer.flush();
 
-		if (dirty_transforms > 0) {
-			puts(std::format("Updaing {} dirty transforms", dirty_transforms).c_str());
+		// Updates staged by StageDirtyTransforms use the slot the entity had at the time.
+		// Anything that has since been moved is stale, and re-uploaded afterwards, so it wins.
+		// The CPU draw path's copies get the same updates, in the same order. Before the upload, which clears them.
+		m_cpu_transforms.resize(m_transform_slots.size());
 
-			ecs.defer_begin();
-			m_dirty_transform_query.each([&](flecs::entity e, const TransformComponent& transform, const GPUResident& gr) {
-				m_transform_buffer.set_subdata<glm::mat4>(transform.transform, gr.addr * sizeof(glm::mat4));
-				e.remove<Dirty, WorldTransform>();
-			});
-			ecs.defer_end();
+		for (auto& updates : m_staged_transform_updates) {
+			for (const auto& [slot, transform] : updates) {
+				if (slot < m_cpu_transforms.size()) m_cpu_transforms[slot] = transform;
+			}
+		}
 
-			// chance that buffer re-allocated
-			// todo: actually update only when required!
-			shader_update();
+		scatter_upload<glm::mat4>(m_upload_ring, m_transform_buffer, m_staged_transform_updates);
+
+		std::vector<std::pair<uint32_t, glm::mat4>> stale_transforms;
+
+		for (uint32_t slot : m_transform_slots.take_stale()) {
+			flecs::entity owner(ecs, m_transform_slots.owner(slot));
+			stale_transforms.push_back({ slot, owner.get<WorldTransform>()->transform });
 		}
 
-		size_t non_resident_entities = m_non_resident_entity_query.count();
+		m_stale_transform_count = static_cast<uint32_t>(stale_transforms.size());
 
-		if (non_resident_entities > 0) {
-			puts(std::format("Making {} non resident entities resident", non_resident_entities).c_str());
+		scatter_upload<glm::mat4>(m_upload_ring, m_transform_buffer, std::span(&stale_transforms, 1));
 
-			ecs.defer_begin();
-			m_non_resident_entity_query.each([&](flecs::entity e, const GPUResident& transform, const Model& model) {
-				const auto& [mesh_handle, material_handle] = model.mesh;
-				auto& mesh = m_entries[mesh_handle];
-				auto& material = m_materials[material_handle];
-				uint32_t idx = 0;
+		for (const auto& [slot, transform] : stale_transforms) m_cpu_transforms[slot] = transform;
+	}
 
-				if (!material.blend) {
-					size_t address = m_entity_buffer.push_back(GPUEntity{
-						.mesh_idx = mesh.idx,
-						.material_idx = material_handle,
-						.transform_idx = static_cast<uint32_t>(transform.addr),
-						.padding = 12345
-						});
 
-					idx = static_cast<uint32_t>(address / sizeof(GPUEntity));
-				}
-				e.set<GPUResident>({ idx });
-				});
-			ecs.defer_end();
+	// Apply the queued entity adds and removes. place(slot, pending) writes each new entity.
+	// Moved entities take their GPUEntity with them, and their owners are told where they went.
+	template <typename Place>
+	void apply_entity_slots(Place&& place) {
+		bool changed = m_entity_slots.apply(place, [this](uint32_t from, uint32_t to) {
+			GPUEntity gpu_entity = m_entity_buffer.shadow<GPUEntity>()[from];
+			m_entity_buffer.set_subdata(gpu_entity, to * sizeof(GPUEntity));
 
-			// chance that buffer re-allocated
-			// todo: actually update only when required!
-			shader_update();
-		}
+			flecs::entity owner(ecs, m_entity_slots.owner(to));
+			if (owner) owner.get_mut<GPUResident>()->addr = to;
+		});
 
-		
+		m_entity_buffer.set_size(m_entity_slots.size() * sizeof(GPUEntity));
+		m_mesh_ranges_dirty |= changed;
+	}
 
-		if (renderer == 0) {
-			// Prepare frustum culling data. This is basically lifted from https://github.com/zeux/niagara/blob/master/src/niagara.cpp
-			// TODO: Actually work through how this all works
-			//			I assume it somehow takes advantage of the symmetry of the frustum??
-			// Probably watching the stream will give the answer
-			static auto normalize_plane = [](glm::vec4 plane) {return plane / glm::length(glm::vec3(plane)); };
-			static Buffer cull_data_buffer;
+	// Write a new entity queued by MakeEntitiesResident, from its components, and tell it where it is
+	void place_entity(uint32_t slot) {
+		flecs::entity owner(ecs, m_entity_slots.owner(slot));
+		owner.get_mut<GPUResident>()->addr = slot;
 
-			glm::mat4 projection_transpose = glm::transpose(camera.projection());
-			glm::vec4 frustum_x = normalize_plane(projection_transpose[3] + projection_transpose[0]);
-			glm::vec4 frustum_y = normalize_plane(projection_transpose[3] + projection_transpose[1]);
+		uint32_t flags = owner.has<ShadowDynamic>() ? GPUEntity::dynamic : 0;
+		m_entity_buffer.set_subdata(make_gpu_entity(*owner.get<Model>(), *owner.get<GPUResident, WorldTransform>(), flags), slot * sizeof(GPUEntity));
 
-			GPUCullData cd;
-			cd.frustum[0] = frustum_x.x;
-			cd.frustum[1] = frustum_x.z;
-			cd.frustum[2] = frustum_y.x;
-			cd.frustum[3] = frustum_y.z;
-			cd.znear = camera.near_clip;
-			cd.zfar = camera.far_clip;
+		// A static one goes straight into the shadow cache
+		if (!flags) m_shadows.invalidate(world_bounds(*owner.get<Model>(), *owner.get<WorldTransform>()));
+	}
 
-			cull_data_buffer.set_data(&cd, sizeof(cd));
+	// Where each mesh's entities are, for build_render_command. Meshes without any get an empty range.
+	void upload_mesh_ranges() {
+		std::vector<MeshRange> mesh_ranges(m_entries.size(), MeshRange{ 0, 0 });
 
-			setup_shaders<5, 9>({ m_entity_count_shader, m_build_render_command_shader, m_generate_per_instance_data_shader, m_main_shader, m_z_prepass_shader },
-				{ "RenderData", "Entities", "Meshes", "RenderCommands", "PerInstance", "Transforms", "Lights", "Materials", "Cull"},
-				{ &m_render_intermediate_buffer,&m_entity_buffer,&m_mesh_buffer,&m_command_buffer,&m_per_idx_buffer,&m_transform_buffer,&lights_buffer,&material_buffer, &cull_data_buffer });
+		for (const SortedSlots::Range& range : m_entity_slots.ranges()) {
+			if (range.key & transparent_key_bit) break;
 
-			uint32_t draw_count = m_draw_query.count();
+			MeshRange& mesh_range = mesh_ranges[range.key >> 32];
+			if (mesh_range.entity_count == 0) mesh_range.first_entity = range.first;
+			mesh_range.entity_count += range.count;
+		}
 
+		m_mesh_range_buffer.set_data(mesh_ranges.data(), mesh_ranges.size() * sizeof(MeshRange));
+		m_mesh_ranges_dirty = false;
+	}
 
-			m_command_buffer.resize(sizeof(RenderCommand) * m_entries.size());
-			m_per_idx_buffer.resize(sizeof(PerInstanceData) * draw_count);
 
-			m_render_intermediate_buffer.resize((m_entries.size() * 2 + 1) * sizeof(uint32_t));
-			constexpr uint32_t zero = 0;
-			glClearNamedBufferData(m_render_intermediate_buffer.get_id(), GL_R32UI, GL_RED, GL_UNSIGNED_INT, &zero);
+	inline void render(const Camera& camera) {
+		PROFILE_FUNC();
 
+		draw(camera);
+		show_stats();
+	}
 
 
-			m_entity_count_shader->uniforms["num_entities"].set<uint32_t>(draw_count);
-			m_entity_count_shader->use();
+	// Culls and draws everything into the framebuffer, then copies it to the screen
+	inline void draw(const Camera& camera) {
+		PROFILE_FUNC();
 
-			glDispatchCompute((draw_count + 32) / 32, 1, 1);
-			glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+		glm::ivec4 viewport;
+		glGetIntegerv(GL_VIEWPORT, &viewport[0]);
 
-			m_build_render_command_shader->uniforms["num_models"].set<uint32_t>(m_entries.size());
-			m_build_render_command_shader->use();
+		// Drawn offscreen, so the depth can be read back for Hi-Z, then copied to the screen
+		m_framebuffer.resize(viewport.z, viewport.w);
 
-			glDispatchCompute((m_entries.size() + 32) / 32, 1, 1);
-			glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+		// Everything that's the same for every draw goes up once, and is shared by all the programs
+		FrameConstants frame_constants = FrameConstants::from_camera(camera, glm::vec2(viewport.z, viewport.w));
+		m_frame_constants_buffer.set_data(&frame_constants, sizeof(frame_constants));
 
-			m_generate_per_instance_data_shader->uniforms["num_entities"].set<uint32_t>(draw_count);
-			m_generate_per_instance_data_shader->use();
+		CullData cull_data = CullData::from_projection(camera.projection(), camera.near_clip, camera.far_clip, static_cast<float>(viewport.w), m_min_pixels);
+		cull_data.view = frame_constants.view;
 
-			glDispatchCompute((draw_count + 32) / 32, 1, 1);
-			glMemoryBarrier(GL_ALL_BARRIER_BITS);
+		// The camera is culled against the first CullData, and each shadow cascade against one after it
+		std::array<CullData, 1 + CascadedShadowMap::max_cascades> cull_views = { cull_data };
 
+		std::optional<DirectionalLight> sun = find_sun();
+		bool shadows = m_shadows_enabled && sun.has_value();
 
+		ShadowConstants shadow_constants = {};
 
+		if (shadows) {
+			m_shadows.update(camera, sun->direction);
+			for (uint32_t c = 0; c < m_shadows.cascade_count(); c++) cull_views[1 + c] = m_shadows.cull_data(c);
 
+			shadow_constants = m_shadows.constants(sun->color * sun->intensity);
+		}
+		else if (sun) {
+			shadow_constants.light_direction = glm::vec4(-glm::normalize(sun->direction), 0.0f);
+			shadow_constants.light_color = glm::vec4(sun->color * sun->intensity, 1.0f);
+		}
 
+		m_shadow_constants_buffer.set_data(&shadow_constants, sizeof(shadow_constants));
 
-			// DO Z Prepass
+		uint32_t draw_count = opaque_entity_count();
+		uint32_t mesh_count = static_cast<uint32_t>(m_entries.size());
 
-			
+		// generate_per_instance_data runs a workgroup per entity_count workgroup
+		uint32_t entity_group_size = m_entity_count_shader->get_work_group_size().x;
+		uint32_t entity_groups = m_entity_count_shader->groups_for(draw_count);
+		assert(m_generate_per_instance_data_shader->get_work_group_size().x == entity_group_size);
 
+		// The shadows are culled on the GPU whichever backend draws the rest
+		if (m_backend == RenderBackend::GPU || shadows) {
+			m_cull_data_buffer.set_data(cull_views.data(), sizeof(cull_views));
 
-			//glColorMask(0, 0, 0, 0);
-			//glDepthMask(1);
+			// The early and late passes each get a run of commands, late after early
+			m_command_buffer.resize(sizeof(RenderCommand) * mesh_count * 2);
+			m_per_idx_buffer.resize(sizeof(PerInstanceData) * draw_count);
+			m_visible_entity_buffer.resize(sizeof(uint32_t) * entity_groups * entity_group_size);
+			m_visibility_buffer.resize(sizeof(uint32_t) * draw_count);
 
-			m_vertex_array.bind();
-			m_command_buffer.bind(GL_DRAW_INDIRECT_BUFFER);
-			m_vertex_buffer.bind(0);
-			m_per_idx_buffer.bind(1);
-			m_index_buffer.bind();
+			// Every group's visible count, then the total. The passes write everything before reading it,
+			// so this only needs zeroing when it's reallocated.
+			size_t render_data_size = sizeof(CullCounters) + (entity_groups + 1) * sizeof(uint32_t);
 
-			glDepthFunc(GL_LESS);
+			if (m_render_intermediate_buffer.reserved_size() < render_data_size) {
+				m_render_intermediate_buffer.resize(render_data_size);
 
-			if (m_z_prepass_enabled) {
-				m_z_prepass_shader->uniforms["vp"].set<glm::mat4>(vp);
-				m_z_prepass_shader->use();
+				constexpr uint32_t zero = 0;
+				glClearNamedBufferData(m_render_intermediate_buffer.get_id(), GL_R32UI, GL_RED, GL_UNSIGNED_INT, &zero);
+			}
+		}
 
-				glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, 0, m_entries.size(), 0);
+		// After the resizes above, which might have reallocated something
+		m_bindings.bind();
+
+		// Cull and pack each workgroup's visible entities, then in a single workgroup scan the group counts into
+		// where they go, and look up each mesh's instances from its entity range, then place the visible entities.
+		// With the entities sorted by mesh, that's all in order, with no atomics anywhere.
+		// Each pass (early and late, or just the one) has mesh_count commands' worth of room, and its own draw count.
+		// cull_index picks which of cull_views it's culled against.
+		auto record_cull = [&](CullPhase phase, uint32_t pass, uint32_t cull_index) {
+			m_gl_commands.use_program(*m_entity_count_shader);
+			m_gl_commands.set_uniform<uint32_t>(m_entity_count_num_entities, draw_count);
+			m_gl_commands.set_uniform<uint32_t>(m_entity_count_phase, static_cast<uint32_t>(phase));
+			m_gl_commands.set_uniform<uint32_t>(m_entity_count_cull_index, cull_index);
+			m_gl_commands.dispatch(entity_groups);
+			m_gl_commands.memory_barrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+			m_gl_commands.use_program(*m_build_render_command_shader);
+			m_gl_commands.set_uniform<uint32_t>(m_build_render_command_num_models, mesh_count);
+			m_gl_commands.set_uniform<uint32_t>(m_build_render_command_pass_index, pass);
+			m_gl_commands.set_uniform<uint32_t>(m_build_render_command_compact, m_indirect_count_enabled);
+			m_gl_commands.set_uniform<uint32_t>(m_build_render_command_num_entity_groups, entity_groups);
+			m_gl_commands.set_uniform<uint32_t>(m_build_render_command_entity_group_size, entity_group_size);
+			m_gl_commands.dispatch(1);
+			m_gl_commands.memory_barrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_COMMAND_BARRIER_BIT);
+
+			m_gl_commands.use_program(*m_generate_per_instance_data_shader);
+			m_gl_commands.dispatch(entity_groups);
+			m_gl_commands.memory_barrier(GL_ALL_BARRIER_BITS);
+
+			m_gl_commands.indirect_buffer(m_command_buffer.get_id());
+			m_gl_commands.parameter_buffer(m_render_intermediate_buffer.get_id());
+		};
 
-				glDepthFunc(GL_EQUAL);
+		// Depth only passes fetch just the positions, a quarter of the bytes of a full vertex
+		auto bind_geometry = [&](bool depth_only) {
+			if (depth_only && m_position_stream_enabled) {
+				m_gl_commands.bind_vertex_array(m_position_array);
+				m_gl_commands.vertex_buffer(0, m_position_buffer.get_id(), 0, m_position_buffer.get_stride());
+				m_gl_commands.element_buffer(m_position_indices_enabled ? m_position_index_buffer.get_id() : m_index_buffer.get_id());
+			}
+			else {
+				m_gl_commands.bind_vertex_array(m_vertex_array);
+				m_gl_commands.vertex_buffer(0, m_vertex_buffer.get_id(), 0, m_vertex_buffer.get_stride());
+				m_gl_commands.element_buffer(m_index_buffer.get_id());
 			}
 
+			m_gl_commands.vertex_buffer(1, m_per_idx_buffer.get_id(), 0, m_per_idx_buffer.get_stride());
+		};
 
-			m_main_shader->uniforms["vp"].set<glm::mat4>(vp);
-			m_main_shader->uniforms["camera_pos"].set<glm::vec3>(camera.position);
-			m_main_shader->use();
+		auto record_draw = [&](Shader& shader, GLenum depth_func, uint32_t pass, bool depth_only) {
+			bind_geometry(depth_only);
 
-			
+			m_gl_commands.use_program(shader);
+			m_gl_commands.depth_func(depth_func);
 
-			glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, 0, m_entries.size(), 0);
+			size_t offset = pass * mesh_count * sizeof(RenderCommand);
 
+			if (m_indirect_count_enabled) {
+				m_gl_commands.draw_elements_indirect_count(offset, offsetof(CullCounters, draw_counts) + pass * sizeof(uint32_t), mesh_count);
+			}
+			else {
+				m_gl_commands.draw_elements_indirect(offset, mesh_count);
+			}
+		};
 
+		if (shadows) {
+			draw_shadows(record_cull, record_draw);
+			glViewport(viewport.x, viewport.y, viewport.z, viewport.w);
 		}
-		else {
-			std::vector<RenderCommand> command_list;
-			std::vector<PerInstanceData> per_instance_data; // interleave mvp, model etc..
 
+		build_light_clusters(camera, cull_data);
 
-			m_rendered_tri_count = 0;
+		glBindTextureUnit(2, m_shadows.get_texture());
+
+		m_framebuffer.bind();
 
-			lights_buffer.update();
-			//transform_buffer.update();
+		m_framebuffer.clear_color({ .5f, .6f, .7f, 1.f });
+		m_framebuffer.clear_depth();
 
-			m_main_shader->uniforms["vp"].set<glm::mat4>(vp);
-			m_main_shader->uniforms["camera_pos"].set<glm::vec3>(camera.position);
-			m_main_shader->use();
+		// Deferred, the opaque pass writes surfaces into the G-buffer, which shares the framebuffer's depth,
+		// and shade_deferred() lights them into the framebuffer afterwards
+		bool deferred = m_deferred_enabled;
+		Shader& opaque_shader = deferred ? *m_gbuffer_shader : *m_main_shader;
 
+		if (deferred) {
+			m_gbuffer.resize(m_framebuffer.get_width(), m_framebuffer.get_height(), m_framebuffer.get_depth_texture());
+			m_gbuffer.bind();
+		}
 
-			m_main_shader->bind_ssbo("Materials", 0, material_buffer);
-			//lights_buffer.bind(m_main_shader, "Lights", 1);
-			m_main_shader->bind_ssbo("Transforms", 2, m_transform_buffer);
+		// The whole opaque pass on the GPU, culling and lighting included, to compare forward against deferred.
+		// Read back a few frames later like the triangle count.
+		uint32_t opaque_query = m_opaque_queries[m_opaque_frame_index++ % m_opaque_queries.size()];
+		if (m_opaque_frame_index > m_opaque_queries.size()) glGetQueryObjectui64v(opaque_query, GL_QUERY_RESULT_NO_WAIT, &m_opaque_gpu_ns);
 
+		glBeginQuery(GL_TIME_ELAPSED, opaque_query);
 
-			uint32_t i = 0; // For instance count
+		if (m_backend == RenderBackend::GPU) {
+			// The query from a few frames ago should be done by now. If it isn't, the count just stays as it was.
+			uint32_t triangle_query = m_triangle_queries[m_frame_index++ % m_triangle_queries.size()];
+			if (m_frame_index > m_triangle_queries.size()) glGetQueryObjectui64v(triangle_query, GL_QUERY_RESULT_NO_WAIT, &m_rendered_tri_count);
 
-			uint32_t base_instance = 0;
+			// The contribution culled count comes back the same way, copied into a slot per frame in flight
+			uint32_t stats_slot = static_cast<uint32_t>((m_frame_index - 1) % m_triangle_queries.size());
+			if (m_frame_index > m_triangle_queries.size()) {
+				glGetNamedBufferSubData(m_cull_stats_readback_buffer.get_id(), stats_slot * sizeof(uint32_t), sizeof(uint32_t), &m_contribution_culled_count);
+			}
 
-			m_draw_query.each([&](flecs::entity e, const GPUResident& transform, const Model& model) {
-				const auto& [mesh_handle, material_handle] = model.mesh;
-				auto& mesh = m_entries[mesh_handle];
-				auto& material = m_materials[material_handle];
+			constexpr uint32_t zero = 0;
+			glClearNamedBufferSubData(m_render_intermediate_buffer.get_id(), GL_R32UI, offsetof(CullCounters, contribution_culled), sizeof(uint32_t), GL_RED, GL_UNSIGNED_INT, &zero);
 
-				if (!material.blend) {
-					//glm::mat4 mvp = (glm::mat4)transform * vp;
 
-					command_list.push_back({
-						mesh.num_vertices,
-						1,
-						mesh.first_idx,
-						mesh.base_vertex,
-						i++
-					});
+			auto record_prepass = [&](uint32_t pass) {
+				record_draw(*m_z_prepass_shader, GL_LESS, pass, true);
+			};
 
-					per_instance_data.push_back({ static_cast<uint32_t>(transform.addr), material_handle });
-					m_rendered_tri_count += mesh.num_vertices / 3;
+			// Only the main pass is counted, the prepass draws the same triangles again
+			auto record_main = [&](GLenum depth_func, uint32_t first_pass, uint32_t last_pass) {
+				m_gl_commands.begin_query(GL_PRIMITIVES_GENERATED, triangle_query);
+				for (uint32_t pass = first_pass; pass <= last_pass; pass++) record_draw(opaque_shader, depth_func, pass, false);
+				m_gl_commands.end_query(GL_PRIMITIVES_GENERATED);
+			};
 
+			m_gl_commands.clear();
+
+			if (!m_occlusion_culling_enabled) {
+				record_cull(CullPhase::All, 0, 0);
+
+				if (m_z_prepass_enabled) {
+					record_prepass(0);
+					record_main(GL_EQUAL, 0, 0);
+				}
+				else {
+					record_main(GL_LESS, 0, 0);
 				}
-				});
 
+				m_gl_commands.execute(m_gl_state);
+			}
+			else {
+				// Early: whatever was visible last frame, which is most of what's visible this frame
+				record_cull(CullPhase::Early, 0, 0);
 
-			m_command_buffer.set_data(command_list);
-			m_per_idx_buffer.set_data(per_instance_data);
+				// Without a prepass, the main pass is split in two, and the query spans both
+				if (m_z_prepass_enabled) {
+					record_prepass(0);
+				}
+				else {
+					m_gl_commands.begin_query(GL_PRIMITIVES_GENERATED, triangle_query);
+					record_draw(opaque_shader, GL_LESS, 0, false);
+				}
 
-			m_vertex_array.bind();
-			m_command_buffer.bind(GL_DRAW_INDIRECT_BUFFER);
-			m_vertex_buffer.bind(0);
-			m_per_idx_buffer.bind(1);
-			m_index_buffer.bind();
+				m_gl_commands.execute(m_gl_state);
+				m_gl_commands.clear();
+
+				m_hiz.build(m_framebuffer.get_depth_texture(), m_framebuffer.get_width(), m_framebuffer.get_height());
+				glBindTextureUnit(1, m_hiz.get_texture());
+
+				// Late: everything else that isn't hidden behind the early pass's depth
+				record_cull(CullPhase::Late, 1, 0);
+
+				if (m_z_prepass_enabled) {
+					record_prepass(1);
+					record_main(GL_EQUAL, 0, 1);
+				}
+				else {
+					record_draw(opaque_shader, GL_LESS, 1, false);
+					m_gl_commands.end_query(GL_PRIMITIVES_GENERATED);
+				}
 
-			glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, 0, static_cast<int32_t>(command_list.size()), 0);
+				m_gl_commands.execute(m_gl_state);
+			}
+
+			m_cull_stats_readback_buffer.copy_subdata(m_render_intermediate_buffer.get_id(), offsetof(CullCounters, contribution_culled), stats_slot * sizeof(uint32_t), sizeof(uint32_t));
 		}
+		else {
+			m_cpu_draws.build(m_workers, cull_data, frame_constants.view, m_entity_buffer.shadow<GPUEntity>().first(opaque_entity_count()), m_cpu_transforms, m_mesh_buffer.shadow<GPUMesh>());
+
+			m_rendered_tri_count = 0;
+			for (const RenderCommand& command : m_cpu_draws.commands()) m_rendered_tri_count += uint64_t(command.count / 3) * command.instance_count;
 
-		//m_framebuffer.unbind();
+			m_contribution_culled_count = m_cpu_draws.stats().contribution_culled;
 
+			// Written into the upload ring rather than the STREAM buffers, which the GPU might still be reading from
+			RingBuffer::Allocation commands = m_upload_ring.push(m_cpu_draws.commands());
+			RingBuffer::Allocation instances = m_upload_ring.push(m_cpu_draws.instances());
+
+			m_gl_commands.clear();
+
+			m_gl_commands.use_program(opaque_shader);
+			m_gl_commands.bind_vertex_array(m_vertex_array);
+			m_gl_commands.vertex_buffer(0, m_vertex_buffer.get_id(), 0, m_vertex_buffer.get_stride());
+			m_gl_commands.vertex_buffer(1, instances.buffer, instances.offset, m_per_idx_buffer.get_stride());
+			m_gl_commands.element_buffer(m_index_buffer.get_id());
+			m_gl_commands.indirect_buffer(commands.buffer);
+
+			m_gl_commands.draw_elements_indirect(commands.offset, static_cast<uint32_t>(m_cpu_draws.commands().size()));
+
+			m_gl_commands.execute(m_gl_state);
+		}
 
+		if (deferred) shade_deferred();
+
+		glEndQuery(GL_TIME_ELAPSED);
+
+		draw_transparent(cull_data, frame_constants.view);
+
+		m_gl_call_stats = m_gl_state.take_stats();
+
+		m_framebuffer.blit_to_screen();
+		m_framebuffer.unbind();
+	}
+
+
+	inline void show_stats() {
 		static bool show_shader_config = true;
 
 		if (ImGui::Begin("Renderer Stats")) {
@@ -691,14 +1215,83 @@ public:
 			glGetIntegerv(GL_GPU_MEMORY_INFO_DEDICATED_VIDMEM_NVX, &total_memory);
 			glGetIntegerv(GL_GPU_MEMORY_INFO_CURRENT_AVAILABLE_VIDMEM_NVX, &available_memory);
 
-			ImGui::SliderInt("Renderer", &renderer, 0, 1);
+			int backend = static_cast<int>(m_backend);
+			ImGui::RadioButton("GPU driven", &backend, static_cast<int>(RenderBackend::GPU));
+			ImGui::SameLine();
+			ImGui::RadioButton("CPU", &backend, static_cast<int>(RenderBackend::CPU));
+			m_backend = static_cast<RenderBackend>(backend);
+
+			if (m_backend == RenderBackend::CPU) {
+				const CPUDrawBuilder::Stats& cpu_stats = m_cpu_draws.stats();
+				ImGui::LabelText("CPU culling:", "%u / %u visible, %u commands, %.3f ms on %u threads",
+					cpu_stats.visible, cpu_stats.tested, cpu_stats.commands, cpu_stats.ms, m_workers.size());
+				ImGui::LabelText("CPU key sort:", "%.3f ms, %u passes", cpu_stats.sort_ms, cpu_stats.sort_passes);
+			}
 
 
+			const TransparentDrawBuilder::Stats& transparent_stats = m_transparent_draws.stats();
+			ImGui::LabelText("Transparent:", "%u / %u visible, %u commands, %.3f ms (sort %.3f ms, %u passes)",
+				transparent_stats.visible, transparent_stats.tested, transparent_stats.commands, transparent_stats.ms, transparent_stats.sort_ms, transparent_stats.sort_passes);
+
 			ImGui::LabelText("Number of triangles: ", "%llu", m_rendered_tri_count);
+			ImGui::LabelText("Contribution culled: ", "%u", m_contribution_culled_count);
+			ImGui::LabelText("BVH leaves / height: ", "%zu / %d (as of the last pick)", m_bvh.leaf_count(), m_bvh.height());
+			ImGui::LabelText("Entity ranges: ", "%zu (mesh, material) runs", m_entity_slots.ranges().size());
 			//ImGui::LabelText("Number of  commands: ", "%llu", command_list.size());
 			ImGui::LabelText("Available video mem:", "%d / %d MB", available_memory / 1024, total_memory / 1024);
 
+			const RingBuffer::Stats& ring_stats = m_upload_ring.stats();
+			ImGui::LabelText("Upload ring:", "%zu KB in %u allocations (%zu KB / frame)", ring_stats.bytes / 1024, ring_stats.allocations, m_upload_ring.frame_size() / 1024);
+			ImGui::LabelText("Upload ring waits:", "%u (%.3f ms)", ring_stats.waits, ring_stats.wait_ms);
+			ImGui::LabelText("Stale transforms:", "%u slots refilled", m_stale_transform_count);
+
+			const BufferUploadStats& upload_stats = Buffer::upload_stats();
+			ImGui::LabelText("Buffer uploads:", "%u calls, %zu KB", upload_stats.calls, upload_stats.bytes / 1024);
+			ImGui::LabelText("Dirty ranges:", "%u -> %u merged", upload_stats.dirty_ranges, upload_stats.merged_ranges);
+			ImGui::LabelText("Binding calls:", "%u", m_bindings.last_bind_calls());
+			ImGui::LabelText("GL calls:", "%u issued, %u elided", m_gl_call_stats.issued, m_gl_call_stats.elided);
+
+			auto show_heap = [](const char* label, const HeapStats& stats) {
+				ImGui::LabelText(label, "%zu / %zu KB, %u free blocks, %.1f%% fragmented",
+					stats.used / 1024, stats.capacity / 1024, stats.free_blocks, stats.fragmentation() * 100.0f);
+			};
+
+			show_heap("Vertex heap:", m_vertex_buffer.stats());
+			show_heap("Index heap:", m_index_buffer.stats());
+			ImGui::LabelText("Position stream:", "%zu KB, %zu KB of indices", m_position_buffer.size() / 1024, m_position_index_buffer.size() / 1024);
+
+			ImGui::SliderFloat("Min Pixel Size", &m_min_pixels, 0.0f, 8.0f);
 			ImGui::Checkbox("Z Prepass", &m_z_prepass_enabled);
+			ImGui::Checkbox("Position Only Prepass", &m_position_stream_enabled);
+			if (m_position_stream_enabled) ImGui::Checkbox("Position Only Indices", &m_position_indices_enabled);
+			ImGui::Checkbox("Occlusion Culling", &m_occlusion_culling_enabled);
+
+			ImGui::Checkbox("Sun Shadows", &m_shadows_enabled);
+
+			if (m_shadows_enabled) {
+				CascadedShadowMap::Settings& shadow_settings = m_shadows.settings();
+				const CascadedShadowMap::Stats& shadow_stats = m_shadows.stats();
+
+				int cascades = static_cast<int>(shadow_settings.cascade_count);
+				if (ImGui::SliderInt("Shadow Cascades", &cascades, 1, CascadedShadowMap::max_cascades)) shadow_settings.cascade_count = cascades;
+
+				ImGui::SliderFloat("Shadow Distance", &shadow_settings.distance, 10.0f, 1000.0f);
+				ImGui::Checkbox("Cache Static Shadows", &shadow_settings.cache_static);
+
+				ImGui::LabelText("Shadow cascades (GPU):", "%.3f / %.3f / %.3f / %.3f ms",
+					shadow_stats.gpu_ms[0], shadow_stats.gpu_ms[1], shadow_stats.gpu_ms[2], shadow_stats.gpu_ms[3]);
+				ImGui::LabelText("Static shadow redraws:", "%u this frame, %llu total", shadow_stats.static_draws, shadow_stats.total_static_draws);
+			}
+
+			const VisibleLights::Stats& light_stats = m_visible_lights.stats();
+			ImGui::LabelText("Visible lights:", "%u / %u (%.3f ms)", light_stats.visible, light_stats.tested, light_stats.ms);
+			ImGui::Checkbox("Clustered Lighting", &m_clustered_lighting_enabled);
+			ImGui::LabelText("Light clusters:", "%u x %u x %u, up to %u lights each", ClusterGrid::tiles_x, ClusterGrid::tiles_y, ClusterGrid::slices, ClusterGrid::max_lights);
+
+			ImGui::Checkbox("Deferred Shading", &m_deferred_enabled);
+			ImGui::LabelText("Opaque pass (GPU):", "%.3f ms", m_opaque_gpu_ns / 1e6);
+
+			if (m_indirect_count_supported) ImGui::Checkbox("Indirect Draw Count", &m_indirect_count_enabled);
 
 			if (ImGui::Button("Show Shader Config")) {
 				show_shader_config = true;
@@ -717,21 +1310,309 @@ public:
 		return m_rendered_tri_count;
 	}
 
+	// The GPU path's triangle count for the last frame drawn, waiting for its query if need be.
+	// get_rendered_tri_count() is a few frames behind, but never stalls.
+	uint64_t read_rendered_tri_count() const {
+		if (m_frame_index == 0) return 0;
+
+		uint64_t count = 0;
+		glGetQueryObjectui64v(m_triangle_queries[(m_frame_index - 1) % m_triangle_queries.size()], GL_QUERY_RESULT, &count);
+		return count;
+	}
+
+	void set_occlusion_culling(bool enabled) {
+		m_occlusion_culling_enabled = enabled;
+	}
+
+	bool get_occlusion_culling() const {
+		return m_occlusion_culling_enabled;
+	}
+
+	size_t get_resident_entity_count() const {
+		return m_entity_slots.size();
+	}
+
+	size_t get_resident_transform_count() const {
+		return m_transform_slots.size();
+	}
+
 
 
 	Entry get_entry(uint32_t index) {
 		return m_entries[index];
 	}
 
+
+	// Find the closest entity along the ray, testing against each mesh's bounds in its local space.
+	// Returns an empty entity if nothing was hit.
+	flecs::entity pick(const Ray& ray, float max_t = FLT_MAX) {
+		update_bvh();
+
+		uint64_t hit_id = 0;
+		float hit_t = max_t;
+
+		auto hit_test = [this](uint64_t id, const Ray& ray, float t_bounds) {
+			flecs::entity e(ecs, id);
+			const Entry& entry = m_entries[e.get<Model>()->mesh.first];
+
+			// The direction isn't normalized after the transform, so t is still measured in world space
+			glm::mat4 inverse = glm::inverse(e.get<WorldTransform>()->transform);
+			glm::vec3 origin = inverse * glm::vec4(ray.origin, 1);
+			glm::vec3 direction = inverse * glm::vec4(ray.direction, 0);
+
+			return Ray::intersect(origin, 1.0f / direction, { entry.aabb_min, entry.aabb_max }, FLT_MAX);
+		};
+
+		if (!m_bvh.raycast(ray, max_t, hit_test, hit_id, hit_t)) return flecs::entity();
+		return flecs::entity(ecs, hit_id);
+	}
+
+
+	void set_backend(RenderBackend backend) { m_backend = backend; }
+	RenderBackend get_backend() const { return m_backend; }
+
+	void set_deferred(bool deferred) { m_deferred_enabled = deferred; }
+	bool get_deferred() const { return m_deferred_enabled; }
+
+	// The last frame's opaque pass GPU time, waiting for it, rather than the one from a few frames ago the stats show
+	double read_opaque_gpu_ms() {
+		if (m_opaque_frame_index == 0) return 0.0;
+
+		uint32_t query = m_opaque_queries[(m_opaque_frame_index - 1) % m_opaque_queries.size()];
+
+		uint64_t elapsed = 0;
+		glGetQueryObjectui64v(query, GL_QUERY_RESULT, &elapsed);
+		return elapsed / 1e6;
+	}
+
+	const CPUDrawBuilder::Stats& get_cpu_draw_stats() const { return m_cpu_draws.stats(); }
+	const TransparentDrawBuilder::Stats& get_transparent_draw_stats() const { return m_transparent_draws.stats(); }
+
+	// The lights in view last frame, which are what the clusters were built from
+	const VisibleLights& get_visible_lights() const { return m_visible_lights; }
+	const ClusterGrid& get_cluster_grid() const { return m_cluster_grid; }
+
+	// The last frame's light lists, laid out like LightClusterBinner::lists(). Waits for the GPU.
+	std::vector<uint32_t> read_light_clusters() const {
+		std::vector<uint32_t> lists(size_t(ClusterGrid::cluster_count) * ClusterGrid::stride);
+		glGetNamedBufferSubData(m_cluster_lights_buffer.get_id(), 0, lists.size() * sizeof(uint32_t), lists.data());
+		return lists;
+	}
+
+
+	// Bring the scene BVH up to date: insert entities that aren't in it yet, and refit every leaf.
+	// Refitting a leaf that is still inside its fattened bounds doesn't touch the tree, so this is one pass
+	// over the entities. Only picking uses the BVH, so it's done then, rather than paying for it every frame.
+	// Main thread only, outside of the systems.
+	void update_bvh() {
+		PROFILE_FUNC();
+
+		ecs.defer_begin();
+		m_bvh_insert_query.each([this](flecs::entity e, const TransformComponent& transform, const Model& model) {
+			e.set<BVHProxy>({ m_bvh.insert(world_bounds(model, transform), e.id()) });
+		});
+		ecs.defer_end();
+
+		m_bvh_refit_query.each([this](const TransformComponent& transform, const Model& model, const BVHProxy& proxy) {
+			m_bvh.move(proxy.node, world_bounds(model, transform));
+		});
+	}
+
+	// The scene BVH, as of the last update_bvh(). Only valid to query from the main thread, outside of the systems.
+	const BVH& get_bvh() const {
+		return m_bvh;
+	}
+
 private:
+	AABB world_bounds(const Model& model, const TransformComponent& transform) const {
+		const Entry& entry = m_entries[model.mesh.first];
+		return AABB::transform({ entry.aabb_min, entry.aabb_max }, transform.transform);
+	}
+
+	// Where a resident entity was as of the last flush_uploads(), which is where the shadow cache has it if it's static
+	AABB resident_bounds(const GPUEntity& gpu_entity) const {
+		const Entry& entry = m_entries[gpu_entity.mesh_idx];
+		return AABB::transform({ entry.aabb_min, entry.aabb_max }, m_cpu_transforms[gpu_entity.transform_idx]);
+	}
+
+	// A placed entity is going, so if it's in the shadow cache, the cascades it's in have to be redrawn without it
+	void uncache_shadow(uint32_t slot) {
+		const GPUEntity& gpu_entity = m_entity_buffer.shadow<GPUEntity>()[slot];
+		if (!(gpu_entity.flags & GPUEntity::dynamic)) m_shadows.invalidate(resident_bounds(gpu_entity));
+	}
+
+	GPUEntity make_gpu_entity(const Model& model, const GPUResident& transform, uint32_t flags = 0) {
+		const auto& [mesh_handle, material_handle] = model.mesh;
+
+		return GPUEntity{
+			.mesh_idx = m_entries[mesh_handle].idx,
+			.material_idx = material_handle,
+			.transform_idx = transform.addr,
+			.flags = flags
+		};
+	}
+
+	// Blended entities are sorted after every opaque one, so the opaque ones are a prefix of the Entities buffer
+	static constexpr SortedSlots::Key transparent_key_bit = 1ull << 63;
+
+	// Entities are kept sorted by this, so each mesh's are together, and within that each material's
+	SortedSlots::Key entity_key(const GPUEntity& entity) const {
+		SortedSlots::Key key = (static_cast<uint64_t>(entity.mesh_idx) << 32) | entity.material_idx;
+		return m_materials[entity.material_idx].blend ? key | transparent_key_bit : key;
+	}
+
+	// Where the blended entities start, as of the last apply
+	uint32_t opaque_entity_count() const {
+		const std::vector<SortedSlots::Range>& ranges = m_entity_slots.ranges();
+		auto it = std::lower_bound(ranges.begin(), ranges.end(), transparent_key_bit, [](const SortedSlots::Range& range, SortedSlots::Key key) { return range.key < key; });
+
+		return it == ranges.end() ? static_cast<uint32_t>(m_entity_slots.size()) : it->first;
+	}
+
+	// The first DirectionalLight that points somewhere, if there is one
+	std::optional<DirectionalLight> find_sun() {
+		std::optional<DirectionalLight> sun;
+		m_sun_query.each([&](const DirectionalLight& light) { if (!sun && light.direction != glm::vec3(0)) sun = light; });
+		return sun;
+	}
+
+	// Each cascade is culled by the same passes as the camera, against its own CullData, and drawn from the position stream.
+	// Static casters are only drawn when the cascade's cache is out of date, dynamic ones every frame.
+	// Leaves the viewport and framebuffer set to the shadow map's.
+	template <typename RecordCull, typename RecordDraw>
+	void draw_shadows(RecordCull&& record_cull, RecordDraw&& record_draw) {
+		PROFILE_SCOPE("Shadows");
+
+		bool cached = m_shadows.settings().cache_static;
+
+		for (uint32_t c = 0; c < m_shadows.cascade_count(); c++) {
+			PROFILE_SCOPE(std::format("Shadow cascade {}", c));
+
+			auto record_cascade = [&](CullPhase phase) {
+				m_gl_commands.clear();
+
+				record_cull(phase, 0, 1 + c);
+
+				m_gl_commands.use_program(*m_shadow_depth_shader);
+				m_gl_commands.set_uniform<uint32_t>(m_shadow_depth_cascade, c);
+				record_draw(*m_shadow_depth_shader, GL_LESS, 0, true);
+
+				m_gl_commands.execute(m_gl_state);
+			};
+
+			m_shadows.begin_cascade(c);
+
+			if (m_shadows.needs_static(c)) {
+				m_shadows.bind_static(c);
+				record_cascade(CullPhase::ShadowStatic);
+			}
+
+			m_shadows.bind_dynamic(c);
+			record_cascade(cached ? CullPhase::ShadowDynamic : CullPhase::Shadow);
+
+			m_shadows.end_cascade(c);
+		}
+	}
+
+	// Compacts the lights in view, then builds every cluster's list of the ones reaching into it, for the main shader.
+	// The boxes only go up when the projection changes.
+	// With clustering off, the lists aren't built, and the main shader loops over every visible light instead.
+	void build_light_clusters(const Camera& camera, const CullData& cull_data) {
+		PROFILE_FUNC();
+
+		m_visible_lights.build(m_workers, cull_data, cull_data.view, m_lights.values());
+
+		std::span<const glm::vec4> spheres = m_visible_lights.spheres();
+		std::span<const VisibleLights::Radiance> radiance = m_visible_lights.radiance();
+		m_light_sphere_buffer.set_data(spheres.data(), spheres.size_bytes());
+		m_light_radiance_buffer.set_data(radiance.data(), radiance.size_bytes());
+
+		if (m_cluster_grid.update(camera.projection(), camera.near_clip, camera.far_clip)) {
+			m_cluster_bounds_buffer.set_data(m_cluster_grid.boxes.data(), m_cluster_grid.boxes.size() * sizeof(ClusterBox));
+		}
+
+		ClusterConstants constants = m_cluster_grid.constants;
+		constants.light_count = static_cast<uint32_t>(spheres.size());
+		constants.enabled = m_clustered_lighting_enabled;
+		m_cluster_constants_buffer.set_data(&constants, sizeof(constants));
+		m_cluster_lights_buffer.resize(size_t(ClusterGrid::cluster_count) * ClusterGrid::stride * sizeof(uint32_t));
+
+		// After the uploads above, which might have reallocated something, whether or not the clusters are built.
+		// The main shader reads the constants either way.
+		m_bindings.bind();
+
+		if (!m_clustered_lighting_enabled) return;
+
+		m_gl_commands.clear();
+		m_gl_commands.use_program(*m_build_light_clusters_shader);
+		m_gl_commands.dispatch(m_build_light_clusters_shader->groups_for(ClusterGrid::cluster_count));
+		m_gl_commands.memory_barrier(GL_SHADER_STORAGE_BARRIER_BIT);
+		m_gl_commands.execute(m_gl_state);
+	}
+
+	// Lights the G-buffer into the framebuffer's colour, a pixel at a time, with the same cluster lists as the forward pass.
+	// Leaves the framebuffer bound for the transparent pass, which blends over the result.
+	void shade_deferred() {
+		PROFILE_FUNC();
+
+		glBindTextureUnit(3, m_gbuffer.get_albedo_metallic());
+		glBindTextureUnit(4, m_gbuffer.get_normal_roughness());
+		glBindTextureUnit(5, m_framebuffer.get_depth_texture());
+		glBindImageTexture(0, m_framebuffer.get_color_texture(), 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA16F);
+
+		m_framebuffer.bind();
+
+		glm::uvec2 size = m_gbuffer.get_size();
+		glm::uvec3 group_size = m_deferred_lighting_shader->get_work_group_size();
+
+		m_gl_commands.clear();
+		m_gl_commands.use_program(*m_deferred_lighting_shader);
+		m_gl_commands.dispatch((size.x + group_size.x - 1) / group_size.x, (size.y + group_size.y - 1) / group_size.y);
+
+		// The transparent pass blends over it, and the blit copies it
+		m_gl_commands.memory_barrier(GL_FRAMEBUFFER_BARRIER_BIT);
+		m_gl_commands.execute(m_gl_state);
+	}
+
+	// Blended entities go over everything else, back to front, without writing depth.
+	// Whichever backend drew the rest, these are culled and sorted on the CPU (see TransparentDrawBuilder).
+	void draw_transparent(const CullData& cull_data, const glm::mat4& view) {
+		PROFILE_FUNC();
+
+		uint32_t opaque_count = opaque_entity_count();
+		std::span<const GPUEntity> entities = m_entity_buffer.shadow<GPUEntity>();
+
+		m_transparent_draws.build(m_workers, cull_data, view, entities.subspan(opaque_count), m_cpu_transforms, m_mesh_buffer.shadow<GPUMesh>());
+		if (m_transparent_draws.commands().empty()) return;
+
+		m_bindings.bind();
+
+		RingBuffer::Allocation commands = m_upload_ring.push(m_transparent_draws.commands());
+		RingBuffer::Allocation instances = m_upload_ring.push(m_transparent_draws.instances());
+
+		m_gl_commands.clear();
+
+		m_gl_commands.use_program(*m_main_shader);
+		m_gl_commands.depth_func(GL_LESS);
+		m_gl_commands.depth_mask(false);
+		m_gl_commands.blend(true);
+
+		m_gl_commands.bind_vertex_array(m_vertex_array);
+		m_gl_commands.vertex_buffer(0, m_vertex_buffer.get_id(), 0, m_vertex_buffer.get_stride());
+		m_gl_commands.vertex_buffer(1, instances.buffer, instances.offset, m_per_idx_buffer.get_stride());
+		m_gl_commands.element_buffer(m_index_buffer.get_id());
+		m_gl_commands.indirect_buffer(commands.buffer);
+
+		m_gl_commands.draw_elements_indirect(commands.offset, static_cast<uint32_t>(m_transparent_draws.commands().size()));
+
+		m_gl_commands.execute(m_gl_state);
+	}
+
 	uint32_t m_mesh_count = 0;
 	uint32_t m_material_count = 0;
 
 	uint64_t m_rendered_tri_count = 0;
 
-	uint32_t cumulative_idx_count = 0; // the cumulative idx count until now
-	int32_t cumulative_vertex_count = 0; // the cumulative vertex count
-
 	std::vector<Entry> m_entries = {};
 	std::vector<Material> m_materials = {};
 	
@@ -740,6 +1621,11 @@ private:
 	VertexBuffer m_vertex_buffer;
 	VertexBuffer m_per_idx_buffer;
 
+	// Depth only passes draw from these. Laid out like m_vertex_buffer and m_index_buffer, see add_entry().
+	VertexArray m_position_array;
+	VertexBuffer m_position_buffer;
+	Buffer m_position_index_buffer;
+
 	Buffer m_per_instance_ssb;
 	Buffer m_command_buffer;
 	Buffer material_buffer;
@@ -750,30 +1636,126 @@ private:
 
 	Buffer m_mesh_buffer;
 	Buffer m_entity_buffer;
+	Buffer m_mesh_range_buffer;		// Where each mesh's entities are in m_entity_buffer
+	bool m_mesh_ranges_dirty = true;
+
+	Buffer m_cull_data_buffer;
+	Buffer m_visible_entity_buffer;	// Packed by the entity count pass, a block per workgroup, so the per instance pass only runs over what's visible
+	Buffer m_visibility_buffer;		// Per entity, whether the late pass saw it last frame. Resizing keeps the contents.
+	Buffer m_frame_constants_buffer{ BufferUsage::STREAM };
+	Buffer m_shadow_constants_buffer{ BufferUsage::STREAM };
 
 	Framebuffer m_framebuffer;
+	HiZPyramid m_hiz;
+
+	// Opaque surfaces, when shading deferred
+	GBuffer m_gbuffer;
+	bool m_deferred_enabled = false;
+
+	// The sun's, drawn with the GPU culling passes
+	CascadedShadowMap m_shadows;
+	bool m_shadows_enabled = true;
+	flecs::query<const DirectionalLight> m_sun_query;
+
+	// The lights in view, compacted on the CPU every frame, and each cluster's lights, built from them on the GPU
+	VisibleLights m_visible_lights;
+	Buffer m_light_sphere_buffer{ BufferUsage::STREAM };
+	Buffer m_light_radiance_buffer{ BufferUsage::STREAM };
+	ClusterGrid m_cluster_grid;
+	Buffer m_cluster_bounds_buffer;
+	Buffer m_cluster_lights_buffer;
+	Buffer m_cluster_constants_buffer{ BufferUsage::STREAM };
+	bool m_clustered_lighting_enabled = true;
 
 	IndexBuffer m_index_buffer;
 
-	flecs::query<const flecs::pair<GPUResident, WorldTransform>, const Model> m_draw_query;
-	flecs::query<const WorldTransform> m_non_resident_transform_query;
-	flecs::query<const WorldTransform, const flecs::pair<GPUResident, WorldTransform>> m_dirty_transform_query;
 
+	std::vector<flecs::system> m_systems;
+
+	BVH m_bvh;
+	flecs::query<const WorldTransform, const Model> m_bvh_insert_query;
+	flecs::query<const WorldTransform, const Model, const BVHProxy> m_bvh_refit_query;
+
+	std::vector<flecs::observer> m_observers;
 
-	flecs::query<const flecs::pair<GPUResident, WorldTransform>, const Model> m_non_resident_entity_query;
-	//flecs::query<const WorldTransform, const flecs::pair<GPUResident, WorldTransform>> m_dirty_transform_query;
+	// Which entity owns each slot of the Transforms and Entities buffers
+	DenseSlots m_transform_slots;
+	SortedSlots m_entity_slots;
+
+	// Filled by the StageGPUData systems, and uploaded by flush_uploads()
+	PerStage<std::vector<std::pair<uint32_t, glm::mat4>>> m_staged_transform_updates;
+	PerStage<std::vector<flecs::entity_t>> m_staged_dynamic;	// Entities that started moving, see ShadowDynamic
+	std::vector<flecs::entity_t> m_staged_static;				// And ones that stopped
+	uint64_t m_upload_frame = 0;								// flush_uploads() calls so far, to tell how long things have been still
+
+	// Per-frame upload space for the above, and for the CPU draw path's commands
+	RingBuffer m_upload_ring;
+
+	RenderBackend m_backend = RenderBackend::GPU;
+
+	// The CPU backend works from its own copy of the Transforms buffer, updated alongside it, and the Entities buffer's shadow
+	std::vector<glm::mat4> m_cpu_transforms;
+	CPUDrawBuilder m_cpu_draws;
+
+	// Blended entities, drawn after everything else by either backend
+	TransparentDrawBuilder m_transparent_draws;
+	WorkerPool m_workers;
+
+	// Slots filled by a swap remove, re-uploaded by the last flush_uploads()
+	uint32_t m_stale_transform_count = 0;
 
 	bool m_z_prepass_enabled = true;
+	bool m_position_stream_enabled = true;
+	bool m_position_indices_enabled = true;
+	bool m_occlusion_culling_enabled = true;
+	bool m_indirect_count_supported = false;
+	bool m_indirect_count_enabled = false;
+
+	// Triangles drawn by the GPU path, read back a few frames later so nothing waits on them
+	std::array<uint32_t, 4> m_triangle_queries = {};
+	uint64_t m_frame_index = 0;
+
+	// The opaque pass's GPU time, either backend, the same way
+	std::array<uint32_t, 4> m_opaque_queries = {};
+	uint64_t m_opaque_frame_index = 0;
+	uint64_t m_opaque_gpu_ns = 0;
 
+	// Anything whose bounding sphere is smaller than this across on screen isn't drawn, unless its mesh says otherwise
+	float m_min_pixels = 1.0f;
+	uint32_t m_contribution_culled_count = 0;
+	Buffer m_cull_stats_readback_buffer;
 
-	ECSGPUBuffer<Light, Light::Light_STD140> lights_buffer; 
-	//ECSGPUBuffer<WorldTransform, glm::mat4> transform_buffer;
+
+	// Every light, in slot order, on the CPU. Only the visible ones go to the GPU.
+	ECSPackedArray<Light, Light::Packed> m_lights;
 
 	Ref<Shader> m_main_shader;
 
 	Ref<Shader> m_z_prepass_shader = asset_manager.GetByPath<Shader>("assets/shaders/z_prepass.glsl");
+	Ref<Shader> m_shadow_depth_shader = asset_manager.GetByPath<Shader>("assets/shaders/shadow_depth.glsl");
+	Ref<Shader> m_build_light_clusters_shader = asset_manager.GetByPath<Shader>("assets/shaders/build_light_clusters.glsl");
+	Ref<Shader> m_gbuffer_shader = asset_manager.GetByPath<Shader>("assets/shaders/gbuffer.glsl");
+	Ref<Shader> m_deferred_lighting_shader = asset_manager.GetByPath<Shader>("assets/shaders/deferred_lighting.glsl");
 
 	Ref<Shader> m_entity_count_shader = asset_manager.GetByPath<Shader>("assets/shaders/entity_count.glsl");
 	Ref<Shader> m_build_render_command_shader = asset_manager.GetByPath<Shader>("assets/shaders/build_render_command.glsl");
 	Ref<Shader> m_generate_per_instance_data_shader = asset_manager.GetByPath<Shader>("assets/shaders/generate_per_instance_data.glsl");
+
+	Shader::UniformHandle m_entity_count_num_entities;
+	Shader::UniformHandle m_entity_count_phase;
+	Shader::UniformHandle m_entity_count_cull_index;
+	Shader::UniformHandle m_shadow_depth_cascade;
+	Shader::UniformHandle m_build_render_command_num_models;
+	Shader::UniformHandle m_build_render_command_pass_index;
+	Shader::UniformHandle m_build_render_command_compact;
+	Shader::UniformHandle m_build_render_command_num_entity_groups;
+	Shader::UniformHandle m_build_render_command_entity_group_size;
+
+	// Which buffer each block name in the shaders above is bound to
+	BindingTable m_bindings;
+
+	// Rebuilt every frame
+	CommandList m_gl_commands;
+	GLStateCache m_gl_state;
+	GLCallStats m_gl_call_stats;
 };
\ No newline at end of file
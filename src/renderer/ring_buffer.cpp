@@ -0,0 +1,144 @@
+
+#include "ring_buffer.hpp"
+
+#include <chrono>
+#include <iostream>
+
+#include "shader.hpp"
+#include "binding_table.hpp"
+#include "assets/asset_manager.hpp"
+#include "instrumentation/instrumentor.hpp"
+
+
+RingBuffer::RingBuffer(size_t frame_size, uint32_t frames_in_flight)
+	: m_frames_in_flight(frames_in_flight), m_fences(frames_in_flight, nullptr) {
+
+	GLint alignment = 0;
+	glGetIntegerv(GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT, &alignment);
+	m_storage_alignment = std::max<size_t>(alignment, 16);
+
+	create(frame_size);
+}
+
+
+RingBuffer::~RingBuffer() {
+	for (GLsync fence : m_fences) {
+		if (fence) glDeleteSync(fence);
+	}
+
+	for (uint32_t buffer : m_retired) glDeleteBuffers(1, &buffer);
+
+	// Deleting a buffer unmaps it
+	glDeleteBuffers(1, &m_gl_id);
+}
+
+
+void RingBuffer::create(size_t frame_size) {
+	m_frame_size = frame_size;
+
+	constexpr GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+
+	glCreateBuffers(1, &m_gl_id);
+	glNamedBufferStorage(m_gl_id, m_frame_size * m_frames_in_flight, nullptr, flags);
+	m_mapped = static_cast<uint8_t*>(glMapNamedBufferRange(m_gl_id, 0, m_frame_size * m_frames_in_flight, flags));
+
+	std::cerr << "Allocated Ring Buffer " << m_gl_id << ": " << m_frames_in_flight << " x " << m_frame_size << "\n";
+
+	GL_ERROR_CHECK();
+}
+
+
+void RingBuffer::next_frame() {
+	PROFILE_FUNC();
+
+	// Everything written to the current region has been submitted by now
+	m_fences[m_frame] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+
+	m_frame = (m_frame + 1) % m_frames_in_flight;
+	m_head = 0;
+
+	m_last_stats = m_stats;
+	m_stats = {};
+
+	// GL holds on to deleted buffers until the commands using them are done, so this is safe
+	for (uint32_t buffer : m_retired) glDeleteBuffers(1, &buffer);
+	m_retired.clear();
+
+	GLsync& fence = m_fences[m_frame];
+	if (!fence) return;
+
+	GLenum result = glClientWaitSync(fence, 0, 0);
+
+	if (result == GL_TIMEOUT_EXPIRED) {
+		auto start = std::chrono::high_resolution_clock::now();
+
+		// Flush, so we don't wait on a fence that was never submitted
+		do {
+			result = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1'000'000);
+		} while (result == GL_TIMEOUT_EXPIRED);
+
+		m_stats.waits++;
+		m_stats.wait_ms += std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+	}
+
+	glDeleteSync(fence);
+	fence = nullptr;
+}
+
+
+RingBuffer::Allocation RingBuffer::allocate(size_t size, size_t alignment) {
+	size_t offset = (m_head + alignment - 1) & ~(alignment - 1);
+
+	if (offset + size > m_frame_size) {
+		// Out of space. Move to a bigger buffer, and keep the old one alive until the next frame,
+		// as allocations made earlier this frame may not have been consumed yet.
+		size_t new_size = m_frame_size * 2;
+		while (new_size < size) new_size *= 2;
+
+		std::cerr << "Growing Ring Buffer " << m_gl_id << ": " << m_frame_size << " -> " << new_size << "\n";
+
+		m_retired.push_back(m_gl_id);
+
+		// The old fences belong to the old buffer, nothing in the new one is in use yet
+		for (GLsync& fence : m_fences) {
+			if (fence) glDeleteSync(fence);
+			fence = nullptr;
+		}
+
+		create(new_size);
+		offset = 0;
+	}
+
+	m_head = offset + size;
+
+	m_stats.bytes += size;
+	m_stats.allocations++;
+
+	size_t global_offset = m_frame * m_frame_size + offset;
+	return { m_mapped + global_offset, m_gl_id, global_offset, size };
+}
+
+
+
+void scatter_upload(const RingBuffer::Allocation& records, Buffer& dst, uint32_t count, uint32_t element_size) {
+	if (count == 0) return;
+
+	static Ref<Shader> scatter_shader = asset_manager.GetByPath<Shader>("assets/shaders/scatter_upload.glsl");
+	static Shader::UniformHandle num_records = scatter_shader->uniform_handle("num_records");
+	static Shader::UniformHandle element_words = scatter_shader->uniform_handle("element_words");
+
+	// Outside the binding table's points, so its blocks are still bound afterwards
+	glBindBufferRange(GL_SHADER_STORAGE_BUFFER, BindingTable::reserved_storage_begin, records.buffer, records.offset, records.size);
+	dst.bind(GL_SHADER_STORAGE_BUFFER, BindingTable::reserved_storage_begin + 1);
+
+	scatter_shader->set<uint32_t>(num_records, count);
+	scatter_shader->set<uint32_t>(element_words, element_size / sizeof(uint32_t));
+	scatter_shader->use();
+
+	glDispatchCompute((count + 63) / 64, 1, 1);
+
+	// The destination is read as storage by the culling passes, and as a vertex / indirect source
+	glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT | GL_COMMAND_BARRIER_BIT);
+
+	GL_ERROR_CHECK();
+}
@@ -0,0 +1,139 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <span>
+#include <vector>
+
+#include "glad/gl.h"
+
+#include "util.hpp"
+#include "buffer.hpp"
+
+/*
+	A persistently mapped ring of per-frame upload space.
+
+	The storage is immutable (glNamedBufferStorage), and mapped once, coherently, so the CPU can write
+	straight into memory the GPU reads from. It is split into one region per frame in flight, and a fence
+	is placed after each frame's commands. A region is only handed out again once its fence has passed,
+	so nothing the GPU might still be reading is ever overwritten.
+
+	Usage, once per frame:
+		ring.next_frame();
+		auto a = ring.allocate(bytes);	// write into a.data
+		// ... then copy from, or bind a range of, a.buffer at a.offset
+
+	If a frame needs more space than a region has, the ring grows into a new buffer. Allocations made
+	before that stay valid until the next frame, since they carry the buffer they live in.
+*/
+
+class RingBuffer {
+public:
+	struct Allocation {
+		void* data = nullptr;
+		uint32_t buffer = 0;
+		size_t offset = 0;
+		size_t size = 0;
+
+		template <typename T>
+		T* as() { return static_cast<T*>(data); }
+
+		operator bool() const { return data != nullptr; }
+	};
+
+	struct Stats {
+		size_t bytes = 0;			// Bytes allocated this frame
+		uint32_t allocations = 0;
+		uint32_t waits = 0;			// Frames where the region's fence hadn't passed yet
+		double wait_ms = 0;
+	};
+
+	RingBuffer(size_t frame_size = 4 * 1024 * 1024, uint32_t frames_in_flight = 3);
+	~RingBuffer();
+
+	RingBuffer(const RingBuffer&) = delete;
+	RingBuffer& operator=(const RingBuffer&) = delete;
+
+	// Fence the frame just submitted, and move on to the next region, waiting for the GPU if it's still in use.
+	// Call this once per frame, before any allocations.
+	void next_frame();
+
+	// Grab size bytes in the current frame's region. Alignment must be a power of two.
+	Allocation allocate(size_t size, size_t alignment = 16);
+
+	// Allocate with the alignment required to bind the range as an SSBO
+	Allocation allocate_storage(size_t size) {
+		return allocate(size, m_storage_alignment);
+	}
+
+	// Allocate and copy in a span of data
+	template <typename T>
+	Allocation push(std::span<const T> data, size_t alignment = 16) {
+		Allocation a = allocate(data.size_bytes(), alignment);
+		memcpy(a.data, data.data(), data.size_bytes());
+		return a;
+	}
+
+	template <typename T>
+	Allocation push(const std::vector<T>& data, size_t alignment = 16) {
+		return push(std::span<const T>(data), alignment);
+	}
+
+	const Stats& stats() const { return m_last_stats; }
+	size_t frame_size() const { return m_frame_size; }
+
+private:
+	void create(size_t frame_size);
+
+	uint32_t m_gl_id = 0;
+	uint8_t* m_mapped = nullptr;
+
+	size_t m_frame_size;
+	uint32_t m_frames_in_flight;
+
+	uint32_t m_frame = 0;		// Region currently being written
+	size_t m_head = 0;			// Offset into the current region
+
+	std::vector<GLsync> m_fences;
+	std::vector<uint32_t> m_retired;	// Buffers replaced by growing, deleted next frame
+
+	size_t m_storage_alignment = 256;
+
+	Stats m_stats;
+	Stats m_last_stats;
+};
+
+
+// Copy count elements of element_size bytes into dst, at the offsets given by a record per element.
+// The source is a ring allocation of records laid out as { uint32_t dst_index; uint8_t element[element_size]; }
+// Done with a compute shader, so a frame's worth of scattered updates is a single dispatch.
+void scatter_upload(const RingBuffer::Allocation& records, Buffer& dst, uint32_t count, uint32_t element_size);
+
+
+// Scatter a frame's staged (index, element) updates into dst with a single dispatch, and clear them.
+// stages is a range of ranges of std::pair<uint32_t, T>, such as a PerStage<std::vector<...>>.
+template <typename T, typename Stages>
+void scatter_upload(RingBuffer& ring, Buffer& dst, Stages&& stages) {
+	static_assert(sizeof(T) % sizeof(uint32_t) == 0, "Scattered elements must be a whole number of uints");
+
+	size_t count = 0;
+	for (auto& updates : stages) count += updates.size();
+
+	if (count == 0) return;
+
+	constexpr size_t record_size = sizeof(uint32_t) + sizeof(T);
+	RingBuffer::Allocation records = ring.allocate_storage(count * record_size);
+	uint8_t* out = records.as<uint8_t>();
+
+	for (auto& updates : stages) {
+		for (auto& [idx, value] : updates) {
+			uint32_t dst_idx = static_cast<uint32_t>(idx);
+			memcpy(out, &dst_idx, sizeof(uint32_t));
+			memcpy(out + sizeof(uint32_t), &value, sizeof(T));
+			out += record_size;
+		}
+		updates.clear();
+	}
+
+	scatter_upload(records, dst, static_cast<uint32_t>(count), sizeof(T));
+}
@@ -362,6 +362,15 @@ void Shader::load_from_string(const char* src) {
 
 	if (_linked) linked = true;
 
+	if (linked && compute_shader) {
+		glm::ivec3 size;
+		glGetProgramiv(gl_id, GL_COMPUTE_WORK_GROUP_SIZE, &size[0]);
+		work_group_size = size;
+	}
+	else {
+		work_group_size = { 0, 0, 0 };
+	}
+
 	if (!linked) {
 		int32_t log_length = 0;
 		glGetProgramiv(gl_id, GL_INFO_LOG_LENGTH, &log_length);
@@ -421,6 +430,30 @@ void Shader::introspect() {
 	}*/
 
 
+	// Look the block indices up now, so binding buffers doesn't need any string lookups
+	auto find_blocks = [this](GLenum interface, std::map<std::string, uint32_t>& blocks) {
+		blocks.clear();
+
+		int num_blocks = 0;
+		glGetProgramInterfaceiv(gl_id, interface, GL_ACTIVE_RESOURCES, &num_blocks);
+
+		int max_name_length = 0;
+		glGetProgramInterfaceiv(gl_id, interface, GL_MAX_NAME_LENGTH, &max_name_length);
+
+		std::vector<char> name(max_name_length + 1);
+
+		for (uint32_t i = 0; i < static_cast<uint32_t>(num_blocks); i++) {
+			glGetProgramResourceName(gl_id, interface, i, static_cast<int32_t>(name.size()), nullptr, name.data());
+			blocks[name.data()] = i;
+		}
+	};
+
+	find_blocks(GL_SHADER_STORAGE_BLOCK, storage_blocks);
+	find_blocks(GL_UNIFORM_BLOCK, uniform_blocks);
+
+	generation++;
+
+
 	int num_active_uniforms = 0;
 	//glGetProgramiv(gl_id, GL_ACTIVE_UNIFORMS, &num_active_uniforms);
 	glGetProgramInterfaceiv(gl_id, GL_UNIFORM, GL_ACTIVE_RESOURCES, &num_active_uniforms);
@@ -505,10 +538,27 @@ void Shader::introspect() {
 		uniforms[u.name] = u;
 
 	}
+
+	// The map won't change until the next link, so point everything at its entries now
+	active_uniforms.clear();
+	for (auto& [name, uniform] : uniforms) active_uniforms.push_back(&uniform);
+
+	for (size_t i = 0; i < handle_names.size(); i++) {
+		handle_uniforms[i] = resolve_uniform(handle_names[i]);
+	}
 }
 
 void Shader::use() {
+	reload_if_needed();
 
+	glUseProgram(gl_id);
+	GL_ERROR_CHECK();
+
+	upload_uniforms();
+}
+
+
+void Shader::reload_if_needed() {
 	if (should_reload) {
 		ranges.clear();
 		steps.clear();
@@ -519,16 +569,18 @@ void Shader::use() {
 		load_from_file(path.c_str());
 		should_reload = false;
 	}
+}
 
-	glUseProgram(gl_id);
-	GL_ERROR_CHECK();
 
+void Shader::upload_uniforms() {
 	uint32_t samplers_active = 0;
 
 
-	// This should probably not be done this way, but it's how we're doing it for now 😂
-	for (auto& [name, uniform] : uniforms) {
-		if (uniform.changed) {
+	// Only upload what's been set since the last time, without going through the map
+	for (Uniform* u : active_uniforms) {
+		Uniform& uniform = *u;
+
+		if (uniform.dirty) {
 			switch (uniform.type) {
 				// Let's do another macro thing here to save a lot of chars
 #define UNIFORM_TYPE(shader_type, gl_func) case ShaderDataType::shader_type: gl_func(uniform.location, 1, (GetCPrimitiveType(ShaderDataType::shader_type)*)&uniform.get<GetCType(ShaderDataType::shader_type)>()); break;
@@ -560,14 +612,18 @@ void Shader::use() {
 
 			}
 
+#ifdef DEBUG
 			auto error = glGetError();
 
 			if (error != GL_NO_ERROR) {
-				fprintf(stderr, "GL ERROR %d on Uniform %s\n", error, name.c_str());
+				fprintf(stderr, "GL ERROR %d on Uniform %s\n", error, uniform.name.c_str());
 			}
+#endif
 
 			GL_ERROR_CHECK();
 
+			uniform.dirty = false;
+
 		}
 	}
 
@@ -605,7 +661,7 @@ void Shader::show_imgui() {
 
 				switch (uniform.type) {
 
-#define RenderControl(DataType, ImGuiFunc, ...) case ShaderDataType::DataType: if(ImGui::ImGuiFunc(name.c_str(), (GetCPrimitiveType(ShaderDataType::DataType)*)&uniform.get<GetCType(ShaderDataType::DataType)>(), __VA_ARGS__)) uniform.changed = true; break;										
+#define RenderControl(DataType, ImGuiFunc, ...) case ShaderDataType::DataType: if(ImGui::ImGuiFunc(name.c_str(), (GetCPrimitiveType(ShaderDataType::DataType)*)&uniform.get<GetCType(ShaderDataType::DataType)>(), __VA_ARGS__)) { uniform.changed = true; uniform.dirty = true; } break;										
 					RenderControl(F32, DragFloat, step, min, max);
 					RenderControl(Vec2, DragFloat2, step, min, max);
 					RenderControl(Vec3, DragFloat3, step, min, max);
@@ -616,7 +672,8 @@ void Shader::show_imgui() {
 
 				case ShaderDataType::Bool:
 					if (ImGui::Checkbox(name.c_str(), (bool*)&uniform.get<uint32_t>())) {
-						uniform.changed = true; 
+						uniform.changed = true;
+						uniform.dirty = true;
 					}
 					break;
 
@@ -627,6 +684,7 @@ void Shader::show_imgui() {
 				if (ImGui::Button("Reset")) {
 					uniform._data.m4 = uniform._default.m4;
 					uniform.changed = false;
+					uniform.dirty = true;
 				}
 				
 
@@ -639,15 +697,52 @@ void Shader::show_imgui() {
 
 
 void Shader::bind_ssbo(std::string name, size_t storage_block_location, Buffer& buffer) {
-	uint32_t storage_block_index = glGetProgramResourceIndex(get_id(), GL_SHADER_STORAGE_BLOCK, name.c_str());
+	uint32_t block_index = storage_block_index(name);
+	if (block_index == GL_INVALID_INDEX) return;
+
 	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, storage_block_location, buffer.get_id());
-	glShaderStorageBlockBinding(get_id(), storage_block_index, storage_block_location);
+	glShaderStorageBlockBinding(get_id(), block_index, storage_block_location);
+
+}
+
+
+Shader::UniformHandle Shader::uniform_handle(const std::string& name) {
+	for (size_t i = 0; i < handle_names.size(); i++) {
+		if (handle_names[i] == name) return static_cast<UniformHandle>(i);
+	}
+
+	handle_names.push_back(name);
+	handle_uniforms.push_back(resolve_uniform(name));
 
+	return static_cast<UniformHandle>(handle_names.size() - 1);
+}
+
+
+Uniform* Shader::resolve_uniform(const std::string& name) {
+	auto it = uniforms.find(name);
+	return it != uniforms.end() ? &it->second : &missing_uniform;
+}
+
+
+uint32_t Shader::storage_block_index(const std::string& name) const {
+	auto it = storage_blocks.find(name);
+	return it != storage_blocks.end() ? it->second : GL_INVALID_INDEX;
+}
+
+
+uint32_t Shader::uniform_block_index(const std::string& name) const {
+	auto it = uniform_blocks.find(name);
+	return it != uniform_blocks.end() ? it->second : GL_INVALID_INDEX;
 }
 
 
 void Shader::unload() {
 	uniforms.clear();
+	active_uniforms.clear();
+	for (auto& uniform : handle_uniforms) uniform = &missing_uniform;
+
+	storage_blocks.clear();
+	uniform_blocks.clear();
 	glDeleteProgram(gl_id);
 	gl_id = 0;
 }
\ No newline at end of file
@@ -38,7 +38,8 @@ struct Uniform {
 
 	float step = 0.01f;
 
-	bool changed = false;
+	bool changed = false;	// Differs from the default, so it's kept across reloads
+	bool dirty = false;		// Needs uploading the next time the program is used
 
 	template <typename t>
 	auto& get() {
@@ -89,7 +90,7 @@ struct Uniform {
 #undef UniformGetter
 
 
-#define UniformSetter(ct, dt, m) template<> void set<ct>(ct val) { if(_data.m != val) { changed = true; _data.m = val; } }template<> void set_default<ct>(ct val) { _default.m = val; }
+#define UniformSetter(ct, dt, m) template<> void set<ct>(ct val) { if(_data.m != val) { changed = true; dirty = true; _data.m = val; } }template<> void set_default<ct>(ct val) { _default.m = val; }
 	UniformSetter(float, F32, f);
 	UniformSetter(double, F64, d);
 
@@ -158,6 +159,11 @@ public:
 
 	void use();
 
+	// use() is these two with a glUseProgram in between. Split up so the program can be left bound
+	// if it already is, see GLStateCache. upload_uniforms() needs the program to be bound.
+	void reload_if_needed();
+	void upload_uniforms();
+
 	// Show an imgui window to allow us to edit any uniforms.
 	// TODO: Possibly don't directly use imgui here, 
 	//		 or at least have some wrappers and helper functions
@@ -167,8 +173,32 @@ public:
 
 	void bind_ssbo(std::string name, size_t index, Buffer& buffer);
 
+	// Resolve a uniform by name once, and set it through the handle after that without any lookups.
+	// Handles stay valid across hot reloads. Uniforms the program doesn't have can still be set, it just does nothing.
+	using UniformHandle = uint32_t;
+	UniformHandle uniform_handle(const std::string& name);
+
+	template <typename T>
+	void set(UniformHandle handle, T val) {
+		handle_uniforms[handle]->set<T>(val);
+	}
+
+	// Block indices are looked up once per link, rather than by name every time they're bound.
+	// GL_INVALID_INDEX if the program doesn't use the block.
+	uint32_t storage_block_index(const std::string& name) const;
+	uint32_t uniform_block_index(const std::string& name) const;
+
 	inline uint32_t get_id() { return gl_id; }
 
+	// Bumped every time the program is linked, hot reloads included
+	inline uint32_t get_generation() const { return generation; }
+
+	// From the compute shader's local_size, so dispatches don't have to repeat it. Zero for anything else.
+	inline glm::uvec3 get_work_group_size() const { return work_group_size; }
+
+	// Enough workgroups to cover count invocations in x
+	inline uint32_t groups_for(uint32_t count) const { return (count + work_group_size.x - 1) / work_group_size.x; }
+
 	std::map<std::string, Uniform> uniforms;
 private:
 	
@@ -184,6 +214,19 @@ private:
 	bool imgui_window_open = true;
 
 	uint32_t gl_id = 0;
+	uint32_t generation = 0;
+	glm::uvec3 work_group_size = { 0, 0, 0 };
+
+	Uniform* resolve_uniform(const std::string& name);
+
+	// Pointers into uniforms, which are re-resolved every link
+	std::vector<Uniform*> active_uniforms = {};
+	std::vector<std::string> handle_names = {};
+	std::vector<Uniform*> handle_uniforms = {};
+	Uniform missing_uniform;
+
+	std::map<std::string, uint32_t> storage_blocks = {};
+	std::map<std::string, uint32_t> uniform_blocks = {};
 
 	std::map<std::string, std::pair<float, float>> ranges = {};
 	std::map<std::string, float> steps = {};
@@ -0,0 +1,249 @@
+#include "shadows.hpp"
+
+#include <cmath>
+#include <algorithm>
+
+#include "gtc/matrix_transform.hpp"
+
+#include "util.hpp"
+#include "instrumentation/instrumentor.hpp"
+
+
+CascadedShadowMap::~CascadedShadowMap() {
+	if (m_map) glDeleteTextures(1, &m_map);
+	if (m_cache) glDeleteTextures(1, &m_cache);
+
+	glDeleteFramebuffers(max_cascades, m_map_framebuffers.data());
+	glDeleteFramebuffers(max_cascades, m_cache_framebuffers.data());
+
+	if (m_timer_queries[0][0]) {
+		for (auto& queries : m_timer_queries) glDeleteQueries(max_cascades, queries.data());
+	}
+}
+
+
+void CascadedShadowMap::create_textures() {
+	if (m_resolution == m_settings.resolution && m_map) return;
+
+	// Immutable storage, so they have to be recreated rather than resized
+	if (m_map) {
+		glDeleteTextures(1, &m_map);
+		glDeleteTextures(1, &m_cache);
+		glDeleteFramebuffers(max_cascades, m_map_framebuffers.data());
+		glDeleteFramebuffers(max_cascades, m_cache_framebuffers.data());
+	}
+
+	m_resolution = m_settings.resolution;
+
+	glCreateTextures(GL_TEXTURE_2D_ARRAY, 1, &m_map);
+	glCreateTextures(GL_TEXTURE_2D_ARRAY, 1, &m_cache);
+
+	for (uint32_t texture : { m_map, m_cache }) {
+		glTextureStorage3D(texture, 1, GL_DEPTH_COMPONENT32F, m_resolution, m_resolution, max_cascades);
+	}
+
+	// Sampled with hardware PCF. Past the edge is lit.
+	const float border[4] = { 1.0f, 1.0f, 1.0f, 1.0f };
+
+	glTextureParameteri(m_map, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTextureParameteri(m_map, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTextureParameteri(m_map, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
+	glTextureParameteri(m_map, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
+	glTextureParameterfv(m_map, GL_TEXTURE_BORDER_COLOR, border);
+	glTextureParameteri(m_map, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+	glTextureParameteri(m_map, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+
+	glCreateFramebuffers(max_cascades, m_map_framebuffers.data());
+	glCreateFramebuffers(max_cascades, m_cache_framebuffers.data());
+
+	for (uint32_t c = 0; c < max_cascades; c++) {
+		for (auto [framebuffer, texture] : { std::pair{ m_map_framebuffers[c], m_map }, std::pair{ m_cache_framebuffers[c], m_cache } }) {
+			glNamedFramebufferTextureLayer(framebuffer, GL_DEPTH_ATTACHMENT, texture, 0, c);
+			glNamedFramebufferDrawBuffer(framebuffer, GL_NONE);
+			glNamedFramebufferReadBuffer(framebuffer, GL_NONE);
+		}
+	}
+
+	if (!m_timer_queries[0][0]) {
+		for (auto& queries : m_timer_queries) glCreateQueries(GL_TIME_ELAPSED, max_cascades, queries.data());
+	}
+
+	invalidate();
+}
+
+
+void CascadedShadowMap::invalidate() {
+	for (Cascade& cascade : m_cascades) cascade.static_dirty = true;
+}
+
+
+// Tested against where the cascades were put by the last update(). If one moves in the next, it's redrawn anyway.
+void CascadedShadowMap::invalidate(const AABB& bounds) {
+	for (uint32_t c = 0; c < m_settings.cascade_count; c++) {
+		Cascade& cascade = m_cascades[c];
+		if (cascade.static_dirty) continue;
+
+		// The same box cull_data() culls against, looking down -z from the near side
+		AABB box = { glm::vec3(-cascade.half_extent, -cascade.half_extent, -cascade.depth), glm::vec3(cascade.half_extent, cascade.half_extent, 0.0f) };
+
+		if (AABB::transform(bounds, cascade.view).overlaps(box)) cascade.static_dirty = true;
+	}
+}
+
+
+void CascadedShadowMap::update(const Camera& camera, glm::vec3 light_direction) {
+	PROFILE_FUNC();
+
+	m_settings.cascade_count = std::clamp<uint32_t>(m_settings.cascade_count, 1, max_cascades);
+	m_settings.move_threshold = std::min(m_settings.move_threshold, m_settings.resolution / 4);
+
+	if (m_settings != m_last_settings) invalidate();
+	m_last_settings = m_settings;
+
+	create_textures();
+
+	m_timer_slot = static_cast<uint32_t>(m_frame_index++ % frames_in_flight);
+
+	m_stats.static_draws = 0;
+
+	glm::vec3 direction = glm::normalize(light_direction);
+	if (direction != m_light_direction) invalidate();
+	m_light_direction = direction;
+
+	// Any up will do, as long as it isn't along the light
+	glm::vec3 up = std::abs(direction.y) > 0.99f ? glm::vec3(1, 0, 0) : glm::vec3(0, 1, 0);
+	glm::mat4 rotation = glm::lookAt(glm::vec3(0), direction, up);
+
+	glm::vec3 camera_position = rotation * glm::vec4(camera.position, 1.0f);
+
+	float znear = camera.near_clip;
+	float zfar = std::min(m_settings.distance, camera.far_clip);
+	uint32_t count = m_settings.cascade_count;
+
+	for (uint32_t c = 0; c < count; c++) {
+		Cascade& cascade = m_cascades[c];
+
+		// Practical split scheme, between even and logarithmic (GPU Gems 3, ch. 10)
+		float p = float(c + 1) / count;
+		float log_split = znear * std::pow(zfar / znear, p);
+		float even_split = znear + (zfar - znear) * p;
+		float radius = glm::mix(even_split, log_split, m_settings.split_lambda);
+
+		// The radius takes up all but move_threshold texels either side
+		float margin = static_cast<float>(m_settings.move_threshold);
+		float texel_size = 2.0f * radius / (m_resolution - 2.0f * margin);
+
+		// On the texel grid, so drawing the same thing from a new origin lands on the same texels
+		glm::vec3 target = glm::floor(camera_position / texel_size + 0.5f) * texel_size;
+		glm::vec3 moved = glm::abs(target - cascade.origin);
+
+		if (texel_size != cascade.texel_size || std::max(std::max(moved.x, moved.y), moved.z) > margin * texel_size) {
+			cascade.origin = target;
+			cascade.static_dirty = true;
+		}
+
+		cascade.radius = radius;
+		cascade.texel_size = texel_size;
+		cascade.half_extent = texel_size * m_resolution * 0.5f;
+		cascade.depth = 2.0f * cascade.half_extent + m_settings.caster_distance;
+
+		// Looking down the light from the near side of the box, which is caster_distance past the cascade towards the light
+		glm::vec3 eye = { cascade.origin.x, cascade.origin.y, cascade.origin.z + cascade.half_extent + m_settings.caster_distance };
+		cascade.view = glm::translate(glm::mat4(1.0f), -eye) * rotation;
+		cascade.projection = glm::ortho(-cascade.half_extent, cascade.half_extent, -cascade.half_extent, cascade.half_extent, 0.0f, cascade.depth);
+	}
+}
+
+
+CullData CascadedShadowMap::cull_data(uint32_t c) const {
+	const Cascade& cascade = m_cascades[c];
+	return CullData::orthographic(cascade.view, cascade.half_extent, cascade.half_extent, 0.0f, cascade.depth);
+}
+
+
+ShadowConstants CascadedShadowMap::constants(glm::vec3 color) const {
+	ShadowConstants constants = {};
+
+	for (uint32_t c = 0; c < m_settings.cascade_count; c++) {
+		constants.cascade_vp[c] = m_cascades[c].projection * m_cascades[c].view;
+		constants.cascade_radius[c] = m_cascades[c].radius;
+		constants.cascade_texel_size[c] = m_cascades[c].texel_size;
+	}
+
+	constants.light_direction = glm::vec4(-m_light_direction, 0.0f);
+	constants.light_color = glm::vec4(color, 1.0f);
+	constants.cascade_count = m_settings.cascade_count;
+
+	return constants;
+}
+
+
+void CascadedShadowMap::begin_cascade(uint32_t c) {
+	read_timer(c);
+
+	glBeginQuery(GL_TIME_ELAPSED, m_timer_queries[m_timer_slot][c]);
+	m_timer_issued[m_timer_slot][c] = true;
+
+	glViewport(0, 0, m_resolution, m_resolution);
+
+	// Casters between the light and the near side are flattened onto it, rather than clipped
+	glEnable(GL_DEPTH_CLAMP);
+	glEnable(GL_POLYGON_OFFSET_FILL);
+	glPolygonOffset(m_settings.slope_bias, m_settings.constant_bias);
+}
+
+
+void CascadedShadowMap::end_cascade(uint32_t c) {
+	glDisable(GL_DEPTH_CLAMP);
+	glDisable(GL_POLYGON_OFFSET_FILL);
+
+	glEndQuery(GL_TIME_ELAPSED);
+}
+
+
+void CascadedShadowMap::bind_static(uint32_t c) {
+	const float far = 1.0f;
+
+	glBindFramebuffer(GL_FRAMEBUFFER, m_cache_framebuffers[c]);
+	glDepthMask(GL_TRUE);
+	glClearNamedFramebufferfv(m_cache_framebuffers[c], GL_DEPTH, 0, &far);
+
+	m_cascades[c].static_dirty = false;
+	m_stats.static_draws++;
+	m_stats.total_static_draws++;
+}
+
+
+void CascadedShadowMap::bind_dynamic(uint32_t c) {
+	if (m_settings.cache_static) {
+		glCopyImageSubData(m_cache, GL_TEXTURE_2D_ARRAY, 0, 0, 0, c, m_map, GL_TEXTURE_2D_ARRAY, 0, 0, 0, c, m_resolution, m_resolution, 1);
+	}
+	else {
+		const float far = 1.0f;
+		glDepthMask(GL_TRUE);
+		glClearNamedFramebufferfv(m_map_framebuffers[c], GL_DEPTH, 0, &far);
+	}
+
+	glBindFramebuffer(GL_FRAMEBUFFER, m_map_framebuffers[c]);
+}
+
+
+// The query was last used frames_in_flight frames ago, so it should be done by now. If it isn't, the time stays as it was.
+// Recorded under whatever the Instrumentor is timing, which should be the cascade's CPU time.
+void CascadedShadowMap::read_timer(uint32_t c) {
+	uint32_t query = m_timer_queries[m_timer_slot][c];
+	if (!m_timer_issued[m_timer_slot][c]) return;
+
+	GLint available = 0;
+	glGetQueryObjectiv(query, GL_QUERY_RESULT_AVAILABLE, &available);
+
+	if (available) {
+		uint64_t elapsed = 0;
+		glGetQueryObjectui64v(query, GL_QUERY_RESULT, &elapsed);
+
+		m_stats.gpu_ms[c] = elapsed / 1e6;
+		Instrumentor::get().record("GPU", static_cast<double>(elapsed));
+	}
+
+	m_timer_issued[m_timer_slot][c] = false;
+}
@@ -0,0 +1,172 @@
+#pragma once
+
+#include <cstdint>
+#include <array>
+
+#include "glad/gl.h"
+#include <glm.hpp>
+
+#include "camera.hpp"
+#include "culling.hpp"
+#include "bounds.hpp"
+
+/*
+	Cascaded shadow maps for a directional light, one layer of a depth array texture per cascade.
+
+	Each cascade is an orthographic box down the light, covering everything within its radius of the camera.
+	They're centred on the camera rather than fitted to the frustum, so turning the camera doesn't move them.
+	Each box is snapped to its own texels, and is move_threshold texels bigger all round than it needs to be,
+	so it only moves once the camera has gone that far from where it was put. Until then, everything
+	that isn't moving stays exactly where it was in the map.
+
+	That's what lets the static casters be cached. Each cascade's static casters are drawn into its layer of
+	the cache, and every frame that layer is copied into the shadow map, and only the dynamic casters are
+	drawn over it. The cache is redrawn when its cascade moves, the light turns, or invalidate() is called
+	because the static casters changed. When only some of them did, invalidate(bounds) leaves the cascades
+	they're nowhere near alone.
+
+	What's drawn is up to the caller, who culls each cascade with cull_data(). Usage:
+		shadows.update(camera, light_direction);
+
+		for (uint32_t c = 0; c < shadows.cascade_count(); c++) {
+			shadows.begin_cascade(c);
+
+			if (shadows.needs_static(c)) {
+				shadows.bind_static(c);
+				// Draw the static casters
+			}
+
+			shadows.bind_dynamic(c);
+			// Draw the dynamic casters, or every caster if caching is off
+
+			shadows.end_cascade(c);
+		}
+
+		// Then put the viewport back
+		glBindTextureUnit(2, shadows.get_texture());	// shadow_map in shadows.glsl
+*/
+
+// The sun and its cascades, as the shaders see them. Uploaded to a std140 uniform block once per frame.
+// Must match assets/shaders/shadows.glsl!
+struct alignas(16) ShadowConstants {
+	static constexpr uint32_t max_cascades = 4;
+
+	glm::mat4 cascade_vp[max_cascades];	// World space to each cascade's clip space
+	glm::vec4 cascade_radius;			// How far from the camera each cascade covers
+	glm::vec4 cascade_texel_size;		// In world space, for the normal offset
+	glm::vec4 light_direction;			// Towards the light, w unused
+	glm::vec4 light_color;				// Times intensity. Black without a sun.
+	uint32_t cascade_count;				// 0 when shadows are off, and everything is lit
+};
+
+static_assert(sizeof(ShadowConstants) == 4 * 64 + 4 * 16 + 16, "ShadowConstants doesn't match the std140 layout");
+
+
+class CascadedShadowMap {
+public:
+	static constexpr uint32_t max_cascades = ShadowConstants::max_cascades;
+
+	struct Settings {
+		uint32_t resolution = 2048;
+		uint32_t cascade_count = 4;
+		float distance = 150.0f;		// How far from the camera the last cascade reaches
+		float split_lambda = 0.75f;		// 0 splits the distance evenly, 1 logarithmically
+		float caster_distance = 100.0f;	// How far towards the light, past the far side of a cascade, casters are still drawn
+		uint32_t move_threshold = 32;	// Texels the camera can move before a cascade follows it
+		bool cache_static = true;
+
+		// glPolygonOffset, while drawing
+		float slope_bias = 2.0f;
+		float constant_bias = 1.0f;
+
+		bool operator==(const Settings&) const = default;
+	};
+
+	struct Cascade {
+		glm::mat4 view;				// The light's rotation, moved to the centre of the near side of the box
+		glm::mat4 projection;
+		float radius = 0.0f;
+		float half_extent = 0.0f;	// Half the width of the box, radius plus the margin
+		float texel_size = 0.0f;
+		float depth = 0.0f;			// From the near side of the box to the far side
+
+		glm::vec3 origin = {};		// Where it was put, in the light's rotated space, on a texel
+		bool static_dirty = true;
+	};
+
+	struct Stats {
+		uint32_t static_draws = 0;		// Cascades whose static casters were drawn this frame
+		uint64_t total_static_draws = 0;
+		std::array<double, max_cascades> gpu_ms = {};	// From a few frames ago
+	};
+
+	CascadedShadowMap() = default;
+	~CascadedShadowMap();
+
+	CascadedShadowMap(const CascadedShadowMap&) = delete;
+	CascadedShadowMap& operator=(const CascadedShadowMap&) = delete;
+
+	// Fit the cascades around the camera, and work out which have to redraw their static casters.
+	// light_direction is the way the light travels.
+	void update(const Camera& camera, glm::vec3 light_direction);
+
+	// The static casters changed, so every cascade's cache is out of date
+	void invalidate();
+
+	// Static casters in bounds, a world space box, came, went or moved. Only the cascades whose boxes overlap it are redrawn.
+	void invalidate(const AABB& bounds);
+
+	uint32_t cascade_count() const { return m_settings.cascade_count; }
+	const Cascade& cascade(uint32_t c) const { return m_cascades[c]; }
+
+	// Frustum culling for cascade c
+	CullData cull_data(uint32_t c) const;
+
+	// For the uniform block. color is already times intensity.
+	ShadowConstants constants(glm::vec3 color) const;
+
+	bool needs_static(uint32_t c) const { return m_settings.cache_static && m_cascades[c].static_dirty; }
+
+	// Drawing cascade c. Sets the viewport, and the depth clamp and bias casters are drawn with.
+	// Its GPU time is timed, and recorded with the Instrumentor a few frames later, by begin_cascade().
+	void begin_cascade(uint32_t c);
+	void end_cascade(uint32_t c);
+
+	// Clears c's layer of the cache, and draws into it
+	void bind_static(uint32_t c);
+
+	// Starts c's layer of the shadow map from the cache, or cleared if caching is off, and draws into it
+	void bind_dynamic(uint32_t c);
+
+	uint32_t get_texture() const { return m_map; }
+	uint32_t get_resolution() const { return m_resolution; }
+
+	Settings& settings() { return m_settings; }
+	const Stats& stats() const { return m_stats; }
+
+private:
+	void create_textures();
+	void read_timer(uint32_t c);
+
+	Settings m_settings;
+	Settings m_last_settings;
+
+	std::array<Cascade, max_cascades> m_cascades = {};
+	glm::vec3 m_light_direction = {};
+
+	// Depth array textures, a layer per cascade, and a framebuffer per layer of each
+	uint32_t m_map = 0;
+	uint32_t m_cache = 0;
+	std::array<uint32_t, max_cascades> m_map_framebuffers = {};
+	std::array<uint32_t, max_cascades> m_cache_framebuffers = {};
+	uint32_t m_resolution = 0;
+
+	// GPU time per cascade, read back a few frames later so nothing waits on them
+	static constexpr uint32_t frames_in_flight = 4;
+	std::array<std::array<uint32_t, max_cascades>, frames_in_flight> m_timer_queries = {};
+	std::array<std::array<bool, max_cascades>, frames_in_flight> m_timer_issued = {};
+	uint64_t m_frame_index = 0;
+	uint32_t m_timer_slot = 0;	// This frame's
+
+	Stats m_stats;
+};
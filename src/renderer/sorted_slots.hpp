@@ -0,0 +1,199 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include <algorithm>
+
+#include "flecs.h"
+
+// Keeps a GPU array dense, and sorted by key, while entities come and go.
+// All the slots with the same key form one range, and the ranges are in key order. Within a range the order is arbitrary.
+//
+// Adds and removes are queued, and applied together by apply(). Removals are filled from the end of their own range,
+// then every range after a change shifts by however many slots were added or removed before it. A range only has to
+// move as many slots as it shifts by (from one end to the other), not all of them, so a change costs at most one move
+// per range after it, however many slots there are.
+//
+// Until then, an added slot is a pending handle (is_pending()), which can be removed again but not written to.
+// apply() reports every slot which was placed or moved, so the caller can move the data and tell the owners.
+class SortedSlots {
+public:
+	using Key = uint64_t;
+
+	static constexpr uint32_t pending_bit = 0x80000000u;
+
+	struct Range {
+		Key key;
+		uint32_t first;
+		uint32_t count;
+	};
+
+	static bool is_pending(uint32_t slot) { return (slot & pending_bit) != 0; }
+
+	// Queue a slot for owner, in key's range. Returns a pending handle, which apply() swaps for a slot.
+	// owner can be 0 for slots whose owner isn't known yet (see set_owner()).
+	uint32_t add(Key key, flecs::entity_t owner) {
+		m_adds.push_back({ key, owner });
+		return pending_bit | static_cast<uint32_t>(m_adds.size() - 1);
+	}
+
+	// Queue a slot (or a pending handle) for removal
+	void remove(uint32_t slot) {
+		if (is_pending(slot)) {
+			m_adds[slot & ~pending_bit].removed = true;
+		}
+		else {
+			m_removes.push_back(slot);
+		}
+	}
+
+	void set_owner(uint32_t slot, flecs::entity_t owner) {
+		m_owners[slot] = owner;
+	}
+
+	// Apply everything queued since the last call.
+	// place(slot, pending) is called for each added slot, with the handle add() returned.
+	// move(from, to) is called for each slot that moved, in an order where from is always still intact, and to free.
+	// Returns true if anything changed.
+	template <typename Place, typename Move>
+	bool apply(Place&& place, Move&& move) {
+		if (m_adds.empty() && m_removes.empty()) return false;
+
+		auto move_slot = [&](uint32_t from, uint32_t to) {
+			m_owners[to] = m_owners[from];
+			move(from, to);
+		};
+
+		// Fill each hole from the end of its range. Highest first, so the end of the range is never itself a hole.
+		std::sort(m_removes.begin(), m_removes.end(), std::greater<>());
+		m_removes.erase(std::unique(m_removes.begin(), m_removes.end()), m_removes.end());
+
+		std::vector<uint32_t> removed(m_ranges.size(), 0);
+
+		for (uint32_t slot : m_removes) {
+			size_t r = range_of(slot);
+			Range& range = m_ranges[r];
+
+			uint32_t last = range.first + range.count - 1;
+			if (slot != last) move_slot(last, slot);
+
+			range.count--;
+			removed[r]++;
+		}
+
+		// Close up the gaps left at the ends of the ranges, front to back. Each range moves down by everything removed before it.
+		uint32_t shift = 0;
+
+		for (size_t r = 0; r < m_ranges.size(); r++) {
+			Range& range = m_ranges[r];
+
+			if (shift != 0) {
+				uint32_t new_first = range.first - shift;
+				uint32_t moves = std::min(range.count, shift);
+
+				// The last few go to the front
+				for (uint32_t i = 0; i < moves; i++) {
+					move_slot(range.first + range.count - moves + i, new_first + i);
+				}
+
+				range.first = new_first;
+			}
+
+			shift += removed[r];
+		}
+
+		uint32_t size = static_cast<uint32_t>(m_owners.size()) - shift;
+
+		// New keys get an empty range, in order
+		std::vector<uint32_t> added(m_ranges.size(), 0);
+
+		for (const Add& add : m_adds) {
+			if (add.removed) continue;
+
+			auto it = std::lower_bound(m_ranges.begin(), m_ranges.end(), add.key, [](const Range& range, Key key) { return range.key < key; });
+
+			if (it == m_ranges.end() || it->key != add.key) {
+				uint32_t first = it == m_ranges.end() ? size : it->first;
+				size_t r = it - m_ranges.begin();
+
+				m_ranges.insert(it, { add.key, first, 0 });
+				added.insert(added.begin() + r, 0);
+				it = m_ranges.begin() + r;
+			}
+
+			added[it - m_ranges.begin()]++;
+		}
+
+		uint32_t total_added = 0;
+		for (uint32_t count : added) total_added += count;
+
+		m_owners.resize(size + total_added);
+
+		// Open up room at the end of each range, back to front. Each range moves up by everything added before it.
+		std::vector<uint32_t> next(m_ranges.size());
+		shift = total_added;
+
+		for (size_t r = m_ranges.size(); r-- > 0;) {
+			Range& range = m_ranges[r];
+			shift -= added[r];
+
+			if (shift != 0) {
+				uint32_t new_first = range.first + shift;
+				uint32_t moves = std::min(range.count, shift);
+
+				// The first few go to the end
+				for (uint32_t i = 0; i < moves; i++) {
+					move_slot(range.first + i, new_first + range.count - moves + i);
+				}
+
+				range.first = new_first;
+			}
+
+			next[r] = range.first + range.count;
+		}
+
+		for (size_t i = 0; i < m_adds.size(); i++) {
+			const Add& add = m_adds[i];
+			if (add.removed) continue;
+
+			size_t r = std::lower_bound(m_ranges.begin(), m_ranges.end(), add.key, [](const Range& range, Key key) { return range.key < key; }) - m_ranges.begin();
+			uint32_t slot = next[r]++;
+
+			m_ranges[r].count++;
+			m_owners[slot] = add.owner;
+			place(slot, pending_bit | static_cast<uint32_t>(i));
+		}
+
+		std::erase_if(m_ranges, [](const Range& range) { return range.count == 0; });
+
+		m_adds.clear();
+		m_removes.clear();
+
+		return true;
+	}
+
+	// The ranges, in key order, as of the last apply()
+	const std::vector<Range>& ranges() const { return m_ranges; }
+
+	flecs::entity_t owner(uint32_t slot) const { return m_owners[slot]; }
+	size_t size() const { return m_owners.size(); }
+
+private:
+	struct Add {
+		Key key;
+		flecs::entity_t owner;
+		bool removed = false;
+	};
+
+	// Which range a slot is in, by the last range to start at or before it
+	size_t range_of(uint32_t slot) const {
+		auto it = std::upper_bound(m_ranges.begin(), m_ranges.end(), slot, [](uint32_t slot, const Range& range) { return slot < range.first; });
+		return (it - m_ranges.begin()) - 1;
+	}
+
+	std::vector<flecs::entity_t> m_owners;
+	std::vector<Range> m_ranges;
+
+	std::vector<Add> m_adds;
+	std::vector<uint32_t> m_removes;
+};
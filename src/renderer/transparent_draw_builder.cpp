@@ -0,0 +1,81 @@
+#include "transparent_draw_builder.hpp"
+
+#include <chrono>
+#include <algorithm>
+
+#include "instrumentation/instrumentor.hpp"
+
+
+void TransparentDrawBuilder::build(WorkerPool& pool, const CullData& cull, const glm::mat4& view,
+	std::span<const GPUEntity> entities, std::span<const glm::mat4> transforms, std::span<const GPUMesh> meshes) {
+
+	PROFILE_FUNC();
+
+	auto start = std::chrono::high_resolution_clock::now();
+
+	uint32_t entity_count = static_cast<uint32_t>(entities.size());
+
+	m_workers.resize(pool.size());
+
+	for (Worker& worker : m_workers) {
+		worker.keys.clear();
+		worker.visible.clear();
+	}
+
+	pool.parallel_for(entity_count, 4096, [&](uint32_t begin, uint32_t end, uint32_t worker_idx) {
+		Worker& worker = m_workers[worker_idx];
+
+		for (uint32_t i = begin; i < end; i++) {
+			const GPUEntity& e = entities[i];
+			const glm::mat4& model = transforms[e.transform_idx];
+			const GPUMesh& mesh = meshes[e.mesh_idx];
+
+			if (sphere_cull(cull, view, model, mesh.bounding_sphere, contribution_min_pixels(cull, mesh.min_pixels)) != CullResult::Visible) continue;
+
+			// Looking down -z, so the distance in front of the camera is -z
+			float cz = view[0].z * model[3].x + view[1].z * model[3].y + view[2].z * model[3].z + view[3].z;
+
+			worker.keys.push_back(depth_key(-cz));
+			worker.visible.push_back(i);
+		}
+	});
+
+	// The sort doesn't care what order they start in
+	m_keys.clear();
+	m_visible.clear();
+
+	for (const Worker& worker : m_workers) {
+		m_keys.insert(m_keys.end(), worker.keys.begin(), worker.keys.end());
+		m_visible.insert(m_visible.end(), worker.visible.begin(), worker.visible.end());
+	}
+
+	auto sort_start = std::chrono::high_resolution_clock::now();
+	m_sort.sort(pool, m_keys, m_visible);
+	m_stats.sort_ms = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - sort_start).count();
+
+	// A new command whenever the mesh changes
+	m_commands.clear();
+	m_instances.resize(m_visible.size());
+
+	uint32_t last_mesh = UINT32_MAX;
+
+	for (uint32_t i = 0; i < m_visible.size(); i++) {
+		const GPUEntity& e = entities[m_visible[i]];
+		m_instances[i] = { e.transform_idx, e.material_idx };
+
+		if (e.mesh_idx == last_mesh) {
+			m_commands.back().instance_count++;
+			continue;
+		}
+
+		const GPUMesh& mesh = meshes[e.mesh_idx];
+		m_commands.push_back({ mesh.num_vertices, 1, mesh.first_idx, mesh.base_vertex, i });
+		last_mesh = e.mesh_idx;
+	}
+
+	m_stats.tested = entity_count;
+	m_stats.visible = static_cast<uint32_t>(m_visible.size());
+	m_stats.commands = static_cast<uint32_t>(m_commands.size());
+	m_stats.sort_passes = m_sort.passes();
+	m_stats.ms = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <cstdint>
+#include <bit>
+#include <span>
+#include <vector>
+
+#include <glm.hpp>
+
+#include "draw_data.hpp"
+#include "culling.hpp"
+#include "radix_sort.hpp"
+#include "worker_pool.hpp"
+
+/*
+	Draws for blended entities, back to front. Blending needs them in order instance by instance, not mesh by
+	mesh, so these can't go through the instanced per mesh commands the opaque entities use, on either backend.
+
+	Entities are culled across a WorkerPool the same as CPUDrawBuilder's scalar reference (sphere_cull()), and every
+	one that's left gets a 32 bit key from the view space depth of its bounding sphere's centre. The keys are
+	radix sorted, and consecutive instances of the same mesh share a command, so a lot of the same thing at a
+	similar depth is still only a few draws.
+
+	Sorting by centre is only right between things which don't overlap. Anything crossing another object
+	can still come out in the wrong order for the pixels they share.
+*/
+
+class TransparentDrawBuilder {
+public:
+	struct Stats {
+		uint32_t tested = 0;
+		uint32_t visible = 0;
+		uint32_t commands = 0;
+		uint32_t sort_passes = 0;
+		double sort_ms = 0;
+		double ms = 0;
+	};
+
+	// Farther is smaller, so an ascending sort is back to front.
+	// Positive floats order the same as their bits, and anything behind the camera is clamped to it.
+	static uint32_t depth_key(float distance) {
+		return ~std::bit_cast<uint32_t>(std::max(distance, 0.0f));
+	}
+
+	// transforms and meshes are indexed by the entities' transform_idx and mesh_idx
+	void build(WorkerPool& pool, const CullData& cull, const glm::mat4& view,
+		std::span<const GPUEntity> entities, std::span<const glm::mat4> transforms, std::span<const GPUMesh> meshes);
+
+	// In the order they're drawn
+	std::span<const RenderCommand> commands() const { return m_commands; }
+	std::span<const PerInstanceData> instances() const { return m_instances; }
+
+	const Stats& stats() const { return m_stats; }
+
+private:
+	struct Worker {
+		std::vector<uint32_t> keys;
+		std::vector<uint32_t> visible;		// Entity indices
+	};
+
+	std::vector<Worker> m_workers;
+
+	// Every visible entity's key and index, sorted back to front
+	std::vector<uint32_t> m_keys;
+	std::vector<uint32_t> m_visible;
+	RadixSort<uint32_t, uint32_t> m_sort;
+
+	std::vector<RenderCommand> m_commands;
+	std::vector<PerInstanceData> m_instances;
+
+	Stats m_stats;
+};
@@ -6,7 +6,7 @@
 
 #include "util.hpp"
 
-VertexBuffer::VertexBuffer(uint32_t vao_id, uint32_t binding_idx) : Buffer(BufferUsage::STATIC)
+VertexBuffer::VertexBuffer(uint32_t vao_id, uint32_t binding_idx, size_t page_size) : GPUHeap(BufferUsage::STATIC, page_size)
 {
 	printf("Vertex Buffer Constructor\n");
 	if (vao_id == -1) {
@@ -37,9 +37,8 @@ void VertexBuffer::bind(int binding_index) {
 }
 
 
-void VertexBuffer::set_layout(VertexBufferLayout layout, uint32_t base_attrib) {
-
-	_layout = layout;
+// Points the layout's attributes, from base_attrib on, at binding_index of vao_id. Returns the stride.
+static int32_t set_attributes(uint32_t vao_id, uint32_t binding_index, VertexBufferLayout layout, uint32_t base_attrib) {
 
 		int32_t size = 0;
 
@@ -62,12 +61,12 @@ void VertexBuffer::set_layout(VertexBufferLayout layout, uint32_t base_attrib) {
 				for (int i = 0; i < 4; i++) {
 
 					std::cout << std::format("glVertexArrayAttribFormat(id={}, index={}, GetSize(dt)={}, GetGLType(dt)={}, false, offset={});\n",
-						m_vao_id, index + i, 4, GetGLPrimitiveType(dt), offset + (4 * sizeof(float)) * i);
+						vao_id, index + i, 4, GetGLPrimitiveType(dt), offset + (4 * sizeof(float)) * i);
 
 
-					glEnableVertexArrayAttrib(m_vao_id, index + i);
-					glVertexArrayAttribFormat(m_vao_id, index + i, 4, GetGLPrimitiveType(dt), false, offset + (4 * sizeof(float)) * i);
-					glVertexArrayAttribBinding(m_vao_id, index + i, m_binding_index); // TODO: ASSUMPTION THAT IFF MAT4  DIVISOR = 1 is bad
+					glEnableVertexArrayAttrib(vao_id, index + i);
+					glVertexArrayAttribFormat(vao_id, index + i, 4, GetGLPrimitiveType(dt), false, offset + (4 * sizeof(float)) * i);
+					glVertexArrayAttribBinding(vao_id, index + i, binding_index); // TODO: ASSUMPTION THAT IFF MAT4  DIVISOR = 1 is bad
 				}
 
 				index += 4;
@@ -76,18 +75,18 @@ void VertexBuffer::set_layout(VertexBufferLayout layout, uint32_t base_attrib) {
 			}
 			else {
 				std::cout << std::format("glVertexArrayAttribFormat(id={}, index={}, GetSize(dt)={}, GetGLType(dt)={}, false, offset={});\n",
-					m_vao_id, index, GetGLPrimitiveCount(dt), GetGLPrimitiveType(dt), offset);
+					vao_id, index, GetGLPrimitiveCount(dt), GetGLPrimitiveType(dt), offset);
 
-				glEnableVertexArrayAttrib(m_vao_id, index);
+				glEnableVertexArrayAttrib(vao_id, index);
 				if (dt == ShaderDataType::U32 || dt == ShaderDataType::I32) {
-					glVertexArrayAttribIFormat(m_vao_id, index, GetGLPrimitiveCount(dt) * attribute.count, GetGLPrimitiveType(dt), offset);
+					glVertexArrayAttribIFormat(vao_id, index, GetGLPrimitiveCount(dt) * attribute.count, GetGLPrimitiveType(dt), offset);
 				}
 				else {
-					glVertexArrayAttribFormat(m_vao_id, index, GetGLPrimitiveCount(dt) * attribute.count, GetGLPrimitiveType(dt), false, offset);
+					glVertexArrayAttribFormat(vao_id, index, GetGLPrimitiveCount(dt) * attribute.count, GetGLPrimitiveType(dt), false, offset);
 
 				}
 				
-				glVertexArrayAttribBinding(m_vao_id, index, m_binding_index);
+				glVertexArrayAttribBinding(vao_id, index, binding_index);
 
 				attribute.offset = offset;
 
@@ -96,7 +95,21 @@ void VertexBuffer::set_layout(VertexBufferLayout layout, uint32_t base_attrib) {
 			}
 		}
 
-		m_stride = size;
+		return size;
+}
+
+
+void VertexBuffer::set_layout(VertexBufferLayout layout, uint32_t base_attrib) {
+	_layout = layout;
+	m_base_attrib = base_attrib;
+
+	m_stride = set_attributes(m_vao_id, m_binding_index, layout, base_attrib);
+}
+
+
+void VertexBuffer::attach(uint32_t vao_id, uint32_t binding_index) {
+	set_attributes(vao_id, binding_index, _layout, m_base_attrib);
+	glVertexArrayBindingDivisor(vao_id, binding_index, m_per_instance ? 1 : 0);
 }
 
 
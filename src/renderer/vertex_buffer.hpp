@@ -6,7 +6,7 @@
 #include <vector>
 
 #include "types.hpp"
-#include "buffer.hpp"
+#include "gpu_heap.hpp"
 
 struct VertexAttribute {
 	std::string name;
@@ -57,9 +57,11 @@ private:
 };
 
 
-class VertexBuffer : public Buffer {
+class VertexBuffer : public GPUHeap {
 public:
-	VertexBuffer(uint32_t vao_id=-1, uint32_t binding_idx = 0);
+	// Mesh data is suballocated from a heap of immutable pages. A page size of 0 gives a plain mutable
+	// buffer instead, for per frame data which is resized all the time.
+	VertexBuffer(uint32_t vao_id=-1, uint32_t binding_idx = 0, size_t page_size = GPUHeap::default_page_size);
 	~VertexBuffer();
 
 	VertexBuffer(const VertexBuffer& other) = delete;
@@ -68,11 +70,17 @@ public:
 
 	void set_layout(VertexBufferLayout layout, uint32_t base_attrib=0);
 
+	// Set up the same attributes on another vertex array, fetched from binding_index there.
+	// The buffer itself still has to be bound to it.
+	void attach(uint32_t vao_id, uint32_t binding_index);
+
 	void resize(size_t size);
 
 	void set_data(void* data, size_t count);
 
 	void set_per_instance(bool per_instance) {
+		m_per_instance = per_instance;
+
 		if (per_instance) {
 			glVertexArrayBindingDivisor(m_vao_id, m_binding_index, 1);
 		}
@@ -110,6 +118,7 @@ private:
 	bool m_per_instance = false;
 
 	VertexBufferLayout _layout;
+	uint32_t m_base_attrib = 0;
 
 	int32_t m_stride = 0;
 
@@ -0,0 +1,64 @@
+#include "visible_lights.hpp"
+
+#include <chrono>
+#include <bit>
+
+#include "instrumentation/instrumentor.hpp"
+
+
+void VisibleLights::build(WorkerPool& pool, const CullData& cull, const glm::mat4& view, std::span<const Light::Packed> lights) {
+	PROFILE_FUNC();
+
+	auto start = std::chrono::high_resolution_clock::now();
+
+	uint32_t light_count = static_cast<uint32_t>(lights.size());
+
+	size_t padded = (light_count + 7) & ~size_t(7);
+	m_x.resize(padded);
+	m_y.resize(padded);
+	m_z.resize(padded);
+	m_radius_sq.resize(padded);
+	m_masks.resize(padded / 8);
+
+	// Lights are never contribution culled, a small one can still light a lot of screen
+	m_min_pixels.resize(padded, 0.0f);
+
+	// A multiple of 8, so chunks never share a group of lanes
+	pool.parallel_for(light_count, 4096, [&](uint32_t begin, uint32_t end, uint32_t worker_idx) {
+		for (uint32_t i = begin; i < end; i++) {
+			m_x[i] = lights[i].position.x;
+			m_y[i] = lights[i].position.y;
+			m_z[i] = lights[i].position.z;
+			m_radius_sq[i] = lights[i].radius_sq;
+		}
+
+		// Lanes past the end are whatever was there before, and masked off below
+		for (uint32_t i = begin; i < end; i += 8) {
+			uint32_t too_small;
+			uint32_t mask = sphere_visible_x8(cull, view, &m_x[i], &m_y[i], &m_z[i], &m_radius_sq[i], &m_min_pixels[i], too_small);
+
+			if (end - i < 8) mask &= (1u << (end - i)) - 1;
+			m_masks[i / 8] = static_cast<uint8_t>(mask);
+		}
+	});
+
+	// Packing them is only a copy each, so it's not worth another pass over the pool
+	m_spheres.resize(light_count);
+	m_radiance.resize(light_count);
+
+	uint32_t visible = 0;
+
+	for (uint32_t group = 0; group < m_masks.size(); group++) {
+		for (uint32_t mask = m_masks[group]; mask; mask &= mask - 1) {
+			const Light::Packed& light = lights[group * 8 + std::countr_zero(mask)];
+
+			m_spheres[visible] = glm::vec4(light.position, light.radius_sq);
+			m_radiance[visible] = { light.radiance[0], light.radiance[1], light.radiance[2], light.radiance[3] };
+			visible++;
+		}
+	}
+
+	m_stats.tested = light_count;
+	m_stats.visible = visible;
+	m_stats.ms = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <cstdint>
+#include <array>
+#include <span>
+#include <vector>
+
+#include <glm.hpp>
+
+#include "culling.hpp"
+#include "light.hpp"
+#include "worker_pool.hpp"
+
+/*
+	The lights in view, compacted every frame into dense SoA arrays, which is all the shaders see of them.
+
+	Each light's sphere of influence is frustum culled eight at a time with sphere_visible_x8(), split across
+	a WorkerPool, and the ones that pass are packed in light order into:
+		spheres: world space position, with the radius squared in w. All the cluster pass reads.
+		radiance: color * intensity as halfs, only read when shading.
+
+	That's 24 bytes a light, and the cluster pass only touches the first 16 of them.
+	Everything is kept between builds and only ever grows, so a steady scene doesn't allocate.
+*/
+
+class VisibleLights {
+public:
+	using Radiance = std::array<uint16_t, 4>;
+
+	struct Stats {
+		uint32_t tested = 0;
+		uint32_t visible = 0;
+		double ms = 0;
+	};
+
+	void build(WorkerPool& pool, const CullData& cull, const glm::mat4& view, std::span<const Light::Packed> lights);
+
+	std::span<const glm::vec4> spheres() const { return { m_spheres.data(), m_stats.visible }; }
+	std::span<const Radiance> radiance() const { return { m_radiance.data(), m_stats.visible }; }
+
+	const Stats& stats() const { return m_stats; }
+
+private:
+	// Bounding spheres, SoA, padded to a whole number of lanes
+	std::vector<float> m_x, m_y, m_z, m_radius_sq, m_min_pixels;
+	std::vector<uint8_t> m_masks;		// Which of each eight are visible
+
+	std::vector<glm::vec4> m_spheres;
+	std::vector<Radiance> m_radiance;
+
+	Stats m_stats;
+};
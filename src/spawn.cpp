@@ -0,0 +1,102 @@
+
+#include "spawn.hpp"
+
+#include <format>
+
+#include "renderer/renderer.hpp"
+#include "instrumentation/instrumentor.hpp"
+
+
+static std::vector<flecs::entity> s_suspended_observers;
+
+
+void suspend_during_bulk_spawn(flecs::entity observer) {
+	s_suspended_observers.push_back(observer);
+}
+
+
+// Pick the i'th element of an array which is either per entity or shared
+template <typename T>
+static const T& element(std::span<const T> values, size_t i) {
+	return values.size() == 1 ? values[0] : values[i];
+}
+
+
+std::vector<flecs::entity_t> spawn_bulk(MeshBundle& mb, const BulkSpawnDesc& desc) {
+	PROFILE_FUNC();
+
+	const size_t count = desc.transforms.size();
+	if (count == 0) return {};
+
+	assert(desc.meshes.size() == 1 || desc.meshes.size() == count);
+	assert(desc.materials.size() == 1 || desc.materials.size() == count);
+
+	glm::mat4 parent_transform = glm::mat4(1);
+
+	if (desc.parent && desc.parent.has<TransformComponent, World>()) {
+		parent_transform = *desc.parent.get<TransformComponent, World>();
+	}
+
+	// Build all the component arrays up front, so flecs can copy them straight into the table
+	std::vector<TransformComponent> world_transforms(count);
+	std::vector<Model> models(count);
+
+	for (size_t i = 0; i < count; i++) {
+		world_transforms[i] = parent_transform * desc.transforms[i].transform;
+		models[i] = Model(element(desc.meshes, i), element(desc.materials, i));
+	}
+
+	// One upload per buffer for the whole batch
+	std::vector<GPUResident> transform_residency(count);
+	std::vector<GPUResident> entity_residency(count);
+
+	uint32_t first_transform = mb.make_transforms_resident(world_transforms);
+
+	for (size_t i = 0; i < count; i++) {
+		transform_residency[i] = { first_transform + static_cast<uint32_t>(i) };
+	}
+
+	mb.make_entities_resident(models, transform_residency, entity_residency);
+
+
+	ecs_bulk_desc_t bulk = {};
+	bulk.count = static_cast<int32_t>(count);
+
+	std::vector<void*> data;
+
+	auto add_id = [&](flecs::id_t id, void* component_data) {
+		bulk.ids[data.size()] = id;
+		data.push_back(component_data);
+	};
+
+	add_id(ecs.pair<TransformComponent, Local>(), (void*)desc.transforms.data());
+	add_id(ecs.pair<TransformComponent, World>(), world_transforms.data());
+	add_id(ecs.id<Model>(), models.data());
+	add_id(ecs.pair<GPUResident, WorldTransform>(), transform_residency.data());
+	add_id(ecs.id<GPUResident>(), entity_residency.data());
+
+	if (desc.parent) {
+		add_id(ecs_pair(flecs::ChildOf, desc.parent.id()), nullptr);
+	}
+
+	bulk.data = data.data();
+
+
+	for (auto& observer : s_suspended_observers) observer.disable();
+
+	const ecs_entity_t* entities = ecs_bulk_init(ecs.c_ptr(), &bulk);
+	std::vector<flecs::entity_t> result(entities, entities + count);
+
+	for (auto& observer : s_suspended_observers) observer.enable();
+
+	mb.set_bulk_owners(transform_residency, entity_residency, result);
+
+
+	if (desc.name_prefix) {
+		for (size_t i = 0; i < count; i++) {
+			ecs_set_name(ecs.c_ptr(), result[i], std::format("{} {}", desc.name_prefix, i).c_str());
+		}
+	}
+
+	return result;
+}
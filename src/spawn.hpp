@@ -0,0 +1,39 @@
+#pragma once
+
+#include <span>
+#include <vector>
+
+#include "glm.hpp"
+#include "flecs.h"
+
+#include "ecs_componets.hpp"
+
+
+class MeshBundle;
+
+
+// Describes a batch of renderable entities to spawn in one go.
+// Each array either has one element per entity, or a single element shared by every entity.
+// The number of entities is the number of transforms.
+struct BulkSpawnDesc {
+	flecs::entity parent = {};
+
+	std::span<const TransformComponent> transforms;	// Local transforms, relative to parent
+	std::span<const MeshHandle> meshes;
+	std::span<const MaterialHandle> materials;
+
+	// Names are not free, so entities are only named ("{prefix} {i}") if this is set
+	const char* name_prefix = nullptr;
+};
+
+
+// Spawn many renderable entities using flecs bulk creation.
+// World transforms are computed here, and the entities' transform and GPUEntity slots
+// are reserved contiguously on the GPU and uploaded in a single call per buffer.
+// Returns the ids of the new entities.
+std::vector<flecs::entity_t> spawn_bulk(MeshBundle& mb, const BulkSpawnDesc& desc);
+
+
+// Per entity observers (transform propagation, dirty tracking) are redundant for a bulk
+// spawn, as it computes everything itself. Observers registered here are disabled while one runs.
+void suspend_during_bulk_spawn(flecs::entity observer);
@@ -0,0 +1,113 @@
+
+#include "systems.hpp"
+
+#include "spawn.hpp"
+#include "instrumentation/instrumentor.hpp"
+
+
+Phases register_phases(flecs::world& world) {
+	Phases phases;
+
+	phases.simulate = world.entity("Simulate")
+		.add(flecs::Phase)
+		.depends_on(flecs::OnUpdate);
+
+	phases.propagate_transforms = world.entity("PropagateTransforms")
+		.add(flecs::Phase)
+		.depends_on(phases.simulate);
+
+	phases.stage_gpu_data = world.entity("StageGPUData")
+		.add(flecs::Phase)
+		.depends_on(phases.propagate_transforms);
+
+	phases.render = world.entity("Render")
+		.add(flecs::Phase)
+		.depends_on(phases.stage_gpu_data);
+
+	return phases;
+}
+
+
+void update_tree_transforms(flecs::entity e, glm::mat4 parent_transform) {
+	glm::mat4 local_transform = e.has<TransformComponent, Local>() ? glm::mat4(*e.get<TransformComponent, Local>()) : glm::mat4(1);
+	glm::mat4 world_transform = parent_transform * local_transform;
+
+	e.set<TransformComponent, World>({ world_transform });
+
+	// Iterate children recursively
+	e.children([&](flecs::entity child) {
+		update_tree_transforms(child, world_transform);
+	});
+}
+
+
+// True if any ancestor of e will also be propagated this frame, which will cover e too
+static bool has_dirty_ancestor(flecs::entity e) {
+	for (flecs::entity parent = e.parent(); parent; parent = parent.parent()) {
+		if (parent.has<Dirty, LocalTransform>()) return true;
+	}
+
+	return false;
+}
+
+
+void register_transform_systems(flecs::world& world, const Phases& phases) {
+	// Changes to a local transform are only recorded here, and pushed down the hierarchy
+	// once per frame by PropagateTransforms. That way setting Position, Rotation and Scale
+	// on an entity with a big subtree doesn't walk the subtree three times.
+	suspend_during_bulk_spawn(world.observer<const LocalTransform>().event(flecs::OnSet | flecs::OnAdd).each(
+		[](flecs::entity e, const TransformComponent& t) {
+			e.add<Dirty, LocalTransform>();
+		}
+	));
+
+	suspend_during_bulk_spawn(world.observer().term<const Position>().or_().term<const Rotation>().or_().term<const Scale>().event(flecs::OnSet | flecs::OnAdd).each(
+		[](flecs::entity e) {
+			const glm::mat4 p = (e.has<Position>() ? *e.get<Position>() : Position()).mat4();
+			const glm::mat4 r = (e.has<Rotation>() ? *e.get<Rotation>() : Rotation()).mat4();
+			const glm::mat4 s = (e.has<Scale>() ? *e.get<Scale>() : Scale()).mat4();
+
+			glm::mat4 local_transform = p * r * s;
+			e.set<TransformComponent, Local>({ local_transform });
+		}
+	));
+
+
+	// Every entity is independent, so this can be spread over the workers.
+	// modified() is deferred, so the transform observers run when the stage is merged.
+	world.system<Position, const Velocity>("ApplyVelocity")
+		.kind(phases.simulate)
+		.multi_threaded()
+		.write<Dirty, LocalTransform>()
+		.each([](flecs::iter& it, size_t i, Position& p, const Velocity& v) {
+			p.position += v.velocity * it.delta_time();
+			it.entity(i).modified<Position>();
+		});
+
+
+	// Only the top-most dirty entity of a hierarchy walks it, and their subtrees never overlap,
+	// so every world transform is written by one worker. The sets go through the worker's stage,
+	// and nothing reads them back this frame: the walk hands each child its parent's transform.
+	world.system<const LocalTransform>("PropagateTransforms")
+		.kind(phases.propagate_transforms)
+		.term<Dirty, LocalTransform>()
+		.term(flecs::Prefab).optional()
+		.multi_threaded()
+		.write<TransformComponent, World>()
+		.each([](flecs::iter& it, size_t i, const TransformComponent& local) {
+			flecs::entity e = it.entity(i);
+
+			if (!has_dirty_ancestor(e)) {
+				flecs::entity parent = e.parent();
+				glm::mat4 parent_transform = glm::mat4(1);
+
+				if (parent && parent.has<TransformComponent, World>()) {
+					parent_transform = *parent.get<TransformComponent, World>();
+				}
+
+				update_tree_transforms(e, parent_transform);
+			}
+
+			e.remove<Dirty, LocalTransform>();
+		});
+}
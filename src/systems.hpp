@@ -0,0 +1,59 @@
+#pragma once
+
+#include <vector>
+#include <algorithm>
+
+#include "glm.hpp"
+#include "flecs.h"
+
+#include "ecs_componets.hpp"
+
+/*
+	The frame is run as a flecs pipeline, by calling ecs.progress() once per frame.
+	Systems are registered into these phases, which run in order:
+
+	Simulate				-> gameplay / animation, e.g. Velocity. Multithreaded.
+	PropagateTransforms		-> Local transforms marked Dirty are pushed down the hierarchy into World transforms.
+	StageGPUData			-> Residency, and copying dirty data into CPU side staging. No GL calls allowed!
+	Render					-> Upload staged data, and submit to GL. Always runs on the main thread.
+
+	Systems which are marked multi_threaded run on the ecs.set_threads() workers, so they must not
+	touch GL, or the Instrumentor (which is not thread safe).
+*/
+
+struct Phases {
+	flecs::entity simulate;
+	flecs::entity propagate_transforms;
+	flecs::entity stage_gpu_data;
+	flecs::entity render;
+};
+
+
+Phases register_phases(flecs::world& world);
+
+// Registers the transform observers, and the Simulate / PropagateTransforms systems
+void register_transform_systems(flecs::world& world, const Phases& phases);
+
+// Recompute the world transform of e and all its children, given the world transform of e's parent
+void update_tree_transforms(flecs::entity e, glm::mat4 parent_transform = glm::mat4(1));
+
+
+// Storage that multi_threaded systems can write into without locking: one T per stage (thread).
+// Must be sized after ecs.set_threads(), with the world's stage count.
+template <typename T>
+class PerStage {
+public:
+	void resize(int32_t stage_count) {
+		m_data.resize(std::max(stage_count, 1));
+	}
+
+	T& operator[](const flecs::iter& it) {
+		return m_data[it.world().get_stage_id()];
+	}
+
+	auto begin() { return m_data.begin(); }
+	auto end() { return m_data.end(); }
+
+private:
+	std::vector<T> m_data;
+};
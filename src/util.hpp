@@ -47,6 +47,9 @@ std::string gl_error_name(uint32_t error_code);
 
 
 #define DEBUG_BREAK() __debugbreak();
+
+// Each check is a round trip to the driver, so they only exist in debug builds
+#ifdef DEBUG
 #define GL_ERROR_CHECK() {\
 	uint32_t e = glGetError(); \
 	if(e != GL_NO_ERROR) { \
@@ -54,6 +57,9 @@ std::string gl_error_name(uint32_t error_code);
 		DEBUG_BREAK();\
 	}\
 }
+#else
+#define GL_ERROR_CHECK() {}
+#endif
 
 void skip_whitespace(const char*& it);
 void skip_whitespace_not_nl(const char*& it);
@@ -0,0 +1,85 @@
+
+#include "worker_pool.hpp"
+
+#include <algorithm>
+
+
+WorkerPool::WorkerPool(uint32_t workers) {
+	for (uint32_t i = 1; i < std::max(workers, 1u); i++) {
+		m_threads.emplace_back([this, i]() { worker_loop(i); });
+	}
+}
+
+
+WorkerPool::~WorkerPool() {
+	{
+		std::lock_guard lock(m_mutex);
+		m_stop = true;
+	}
+
+	m_wake.notify_all();
+
+	for (std::thread& thread : m_threads) thread.join();
+}
+
+
+void WorkerPool::parallel_for(uint32_t count, uint32_t grain, const Job& job) {
+	if (count == 0) return;
+
+	grain = std::max(grain, 1u);
+
+	// Not worth waking anyone for a single chunk
+	if (count <= grain || m_threads.empty()) {
+		job(0, count, 0);
+		return;
+	}
+
+	{
+		std::lock_guard lock(m_mutex);
+		m_job = &job;
+		m_count = count;
+		m_grain = grain;
+		m_next_chunk = 0;
+		m_working = static_cast<uint32_t>(m_threads.size());
+		m_generation++;
+	}
+
+	m_wake.notify_all();
+
+	run_chunks(0);
+
+	// Every thread has to check in, even if there was nothing left for it, before job can go out of scope
+	std::unique_lock lock(m_mutex);
+	m_done.wait(lock, [this]() { return m_working == 0; });
+	m_job = nullptr;
+}
+
+
+void WorkerPool::run_chunks(uint32_t worker) {
+	while (true) {
+		uint32_t begin = m_next_chunk.fetch_add(m_grain);
+		if (begin >= m_count) return;
+
+		(*m_job)(begin, std::min(begin + m_grain, m_count), worker);
+	}
+}
+
+
+void WorkerPool::worker_loop(uint32_t worker) {
+	uint64_t seen_generation = 0;
+
+	while (true) {
+		{
+			std::unique_lock lock(m_mutex);
+			m_wake.wait(lock, [&]() { return m_stop || m_generation != seen_generation; });
+
+			if (m_stop) return;
+			seen_generation = m_generation;
+		}
+
+		run_chunks(worker);
+
+		std::lock_guard lock(m_mutex);
+		if (--m_working == 0) m_done.notify_one();
+	}
+}
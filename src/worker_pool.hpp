@@ -0,0 +1,59 @@
+#pragma once
+
+#include <cstdint>
+#include <atomic>
+#include <algorithm>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <functional>
+#include <condition_variable>
+
+/*
+	A fixed set of threads for splitting loops outside of flecs systems, like CPU culling.
+	The calling thread joins in, so a pool of size() workers has size() - 1 threads of its own.
+
+	Usage:
+		pool.parallel_for(count, 1024, [&](uint32_t begin, uint32_t end, uint32_t worker) {
+			// worker is in [0, size()), for indexing per-worker storage without locking
+		});
+
+	Chunks are handed out as workers finish, so which worker gets which chunk changes from run to run.
+	Not reentrant: don't call parallel_for from inside a job.
+*/
+
+class WorkerPool {
+public:
+	using Job = std::function<void(uint32_t begin, uint32_t end, uint32_t worker)>;
+
+	explicit WorkerPool(uint32_t workers = std::max(std::thread::hardware_concurrency(), 1u));
+	~WorkerPool();
+
+	WorkerPool(const WorkerPool&) = delete;
+	WorkerPool& operator=(const WorkerPool&) = delete;
+
+	// Run job over [0, count) in chunks of up to grain, and return once it's all done
+	void parallel_for(uint32_t count, uint32_t grain, const Job& job);
+
+	uint32_t size() const { return static_cast<uint32_t>(m_threads.size()) + 1; }
+
+private:
+	void worker_loop(uint32_t worker);
+	void run_chunks(uint32_t worker);
+
+	std::vector<std::thread> m_threads;
+
+	std::mutex m_mutex;
+	std::condition_variable m_wake;
+	std::condition_variable m_done;
+
+	// The current job, changed under m_mutex
+	const Job* m_job = nullptr;
+	uint32_t m_count = 0;
+	uint32_t m_grain = 1;
+	uint64_t m_generation = 0;
+	uint32_t m_working = 0;		// Threads which haven't finished with the current job yet
+	bool m_stop = false;
+
+	std::atomic<uint32_t> m_next_chunk = 0;
+};